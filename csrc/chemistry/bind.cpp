@@ -1,15 +1,20 @@
 #include "bind.hpp"
 
 #include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
 #include <map>
 #include <memory>
 #include <optional>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 #include <pybind11/pybind11.h>
 #include <pybind11/pytypes.h>
 #include <pybind11/stl.h>
+#include <pybind11/stl/filesystem.h>
 
 #include <pybind11/detail/common.h>
 #include <pybind11/detail/using_smart_holder.h>
@@ -70,6 +75,8 @@ static void def_reaction(py::module &m) {
                     py::arg("smarts"), py::arg("reactant_names"))
         .def_static("from_smarts", py::overload_cast<const std::string &>(&Reaction::from_smarts))
         .def("num_reactants", &Reaction::num_reactants)
+        .def("heavy_atom_delta", &Reaction::heavy_atom_delta)
+        .def("heavy_atom_delta_is_exact", &Reaction::heavy_atom_delta_is_exact)
         .def("reactant_names", &Reaction::reactant_names,
              py::return_value_policy::reference_internal)
         .def("match_reactants",
@@ -92,10 +99,17 @@ static void def_reaction(py::module &m) {
              py::overload_cast<const std::map<std::string, std::shared_ptr<Molecule>> &, bool>(
                  &Reaction::apply, py::const_),
              py::arg("reactants"), py::arg("ignore_errors") = false)
-        .def("apply",
-             py::overload_cast<const std::vector<std::shared_ptr<Molecule>> &, bool>(
-                 &Reaction::apply, py::const_),
-             py::arg("reactants"), py::arg("ignore_errors") = false)
+        .def(
+            "apply",
+            [](const Reaction &rxn, const std::vector<std::shared_ptr<Molecule>> &reactants,
+               bool ignore_errors, bool main_product_only, std::optional<size_t> max_outcomes) {
+                return rxn.apply(reactants, {},
+                                 {.ignore_errors = ignore_errors,
+                                  .max_outcomes = max_outcomes,
+                                  .main_product_only = main_product_only});
+            },
+            py::arg("reactants"), py::arg("ignore_errors") = false,
+            py::arg("main_product_only") = false, py::arg("max_outcomes") = std::nullopt)
         .def(py::pickle([](const Reaction &rxn) { return py::bytes(rxn.serialize()); },
                         [](const py::bytes &pickle) {
                             std::string pickle_str(pickle);
@@ -116,29 +130,114 @@ static void def_reaction(py::module &m) {
     py::register_exception<ReactionError>(m, "ReactionError", PyExc_RuntimeError);
 }
 
+static void def_reaction_cache(py::module &m) {
+    py::class_<ReactionCache::Stats>(m, "ReactionCacheStats")
+        .def_readonly("hits", &ReactionCache::Stats::hits)
+        .def_readonly("misses", &ReactionCache::Stats::misses)
+        .def_readonly("size", &ReactionCache::Stats::size)
+        .def_readonly("capacity", &ReactionCache::Stats::capacity)
+        .def_property_readonly("hit_rate", &ReactionCache::Stats::hit_rate);
+
+    py::class_<ReactionCache, py::smart_holder>(m, "ReactionCache")
+        .def(py::init<size_t, size_t, std::uint64_t>(), py::arg("capacity"),
+             py::arg("num_shards") = ReactionCache::kDefaultNumShards,
+             py::arg("reactions_fingerprint") = 0)
+        .def("size", &ReactionCache::size)
+        .def("capacity", &ReactionCache::capacity)
+        .def("reactions_fingerprint", &ReactionCache::reactions_fingerprint)
+        .def("stats", &ReactionCache::stats)
+        .def("reset_stats", &ReactionCache::reset_stats)
+        .def("clear", &ReactionCache::clear)
+        .def(
+            "save",
+            [](const ReactionCache &cache, const std::filesystem::path &path) {
+                std::ofstream ofs(path, std::ios::binary);
+                if (!ofs) {
+                    throw std::runtime_error("failed to open file for writing: " + path.string());
+                }
+                cache.save(ofs);
+            },
+            py::arg("path"))
+        .def(
+            "load",
+            [](ReactionCache &cache, const std::filesystem::path &path) {
+                std::ifstream ifs(path, std::ios::binary);
+                if (!ifs) {
+                    throw std::runtime_error("failed to open file for reading: " + path.string());
+                }
+                cache.load(ifs);
+            },
+            py::arg("path"));
+}
+
+// Nodes of a chemical space synthesis hold molecules and reactions borrowed from the space, so
+// every node handed to Python keeps the object it was reached from alive, and molecules are handed
+// out as owning copies, see Molecule::owning().
+static py::object kept_alive_by(py::object nurse, py::handle patient) {
+    py::detail::keep_alive_impl(nurse, patient);
+    return nurse;
+}
+
+static py::list nodes_kept_alive_by(const std::vector<std::shared_ptr<SynthesisNode>> &nodes,
+                                    py::handle owner) {
+    py::list result;
+    for (const auto &node : nodes) {
+        result.append(kept_alive_by(py::cast(node), owner));
+    }
+    return result;
+}
+
 static void def_synthesis(py::module &m) {
     py::class_<SynthesisNode::PrecursorMolecule>(m, "PrecursorMolecule")
         .def_readonly("precursor_index", &SynthesisNode::PrecursorMolecule::precursor_index)
         .def_readonly("reactant_name", &SynthesisNode::PrecursorMolecule::reactant_name)
-        .def_readonly("precursor_node", &SynthesisNode::PrecursorMolecule::precursor_node)
+        .def_property_readonly(
+            "precursor_node",
+            [](const SynthesisNode::PrecursorMolecule &p) { return p.precursor_node; },
+            py::keep_alive<0, 1>())
         .def_readonly("item_index", &SynthesisNode::PrecursorMolecule::item_index)
-        .def_readonly("molecule", &SynthesisNode::PrecursorMolecule::molecule);
+        .def_property_readonly("molecule", [](const SynthesisNode::PrecursorMolecule &p) {
+            return Molecule::owning(p.molecule);
+        });
 
     py::class_<SynthesisNode, py::smart_holder>(m, "SynthesisNode")
         .def("index", &SynthesisNode::index)
         .def("size", &SynthesisNode::size)
-        .def("precursor_nodes", &SynthesisNode::precursor_nodes,
-             py::return_value_policy::reference_internal)
-        .def("at", &SynthesisNode::at, py::arg("i"), py::return_value_policy::reference_internal)
-        .def("precursors", &SynthesisNode::precursors, py::arg("index"),
-             py::return_value_policy::reference_internal);
+        .def("num_evaluated", &SynthesisNode::num_evaluated)
+        .def("is_fully_evaluated", &SynthesisNode::is_fully_evaluated)
+        .def("ensure", &SynthesisNode::ensure, py::arg("n"))
+        .def("precursor_nodes",
+             [](const py::object &self) {
+                 return nodes_kept_alive_by(self.cast<const SynthesisNode &>().precursor_nodes(),
+                                            self);
+             })
+        .def(
+            "at",
+            [](const SynthesisNode &node, size_t i) { return Molecule::owning(node.at(i)); },
+            py::arg("i"))
+        .def(
+            "precursors",
+            [](const py::object &self, size_t index) {
+                py::list result;
+                for (auto &precursor : self.cast<const SynthesisNode &>().precursors(index)) {
+                    result.append(kept_alive_by(py::cast(std::move(precursor)), self));
+                }
+                return result;
+            },
+            py::arg("index"));
 
     py::class_<Synthesis, py::smart_holder>(m, "Synthesis")
         .def(py::init<>())
-        .def("nodes", &Synthesis::nodes, py::return_value_policy::reference_internal)
+        .def("nodes",
+             [](const py::object &self) {
+                 return nodes_kept_alive_by(self.cast<const Synthesis &>().nodes(), self);
+             })
+        .def("num_nodes", &Synthesis::num_nodes)
         .def("stack_size", &Synthesis::stack_size)
-        .def("stack_top", &Synthesis::stack_top, py::arg("i") = 0,
-             py::return_value_policy::reference_internal)
+        .def(
+            "stack_top",
+            [](const Synthesis &s, size_t i) { return s.stack_top(i); }, py::arg("i") = 0,
+            py::keep_alive<0, 1>())
         .def(
             "push_molecule",
             [](Synthesis &s, const std::shared_ptr<Molecule> &mol) { s.push(mol); },
@@ -146,8 +245,15 @@ static void def_synthesis(py::module &m) {
         .def(
             "push_reaction",
             [](Synthesis &s, const std::shared_ptr<Reaction> &rxn,
-               std::optional<size_t> max_outcomes) { s.push(rxn, max_outcomes); },
-            py::arg("reaction"), py::arg("max_outcomes"))
+               std::optional<size_t> max_outcomes, bool lazy, bool main_product_only,
+               size_t num_threads) {
+                s.push(rxn, {.max_outcomes = max_outcomes,
+                             .lazy = lazy,
+                             .main_product_only = main_product_only,
+                             .num_threads = num_threads});
+            },
+            py::arg("reaction"), py::arg("max_outcomes"), py::arg("lazy") = false,
+            py::arg("main_product_only") = false, py::arg("num_threads") = 1)
         .def("undo", &Synthesis::undo);
 
     py::register_exception<SynthesisError>(m, "SynthesisError", PyExc_RuntimeError);
@@ -156,5 +262,6 @@ static void def_synthesis(py::module &m) {
 void def_module_chemistry(pybind11::module &m) {
     def_molecule(m);
     def_reaction(m);
+    def_reaction_cache(m);
     def_synthesis(m);
 }
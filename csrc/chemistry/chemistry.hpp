@@ -2,6 +2,8 @@
 
 // IWYU pragma: begin_exports
 #include "molecule.hpp"
+#include "pattern_fingerprint.hpp"
 #include "reaction.hpp"
+#include "reaction_cache.hpp"
 #include "synthesis.hpp"
 // IWYU pragma: end_exports
@@ -1,16 +1,32 @@
 #include "molecule.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <GraphMol/MolOps.h>
 #include <GraphMol/MolPickler.h>
 #include <GraphMol/MolStandardize/Fragment.h>
 #include <GraphMol/SmilesParse/SmilesParse.h>
 
+#include "../utility/borrow.hpp"
+#include "../utility/hash.hpp"
+
 namespace prexsyn {
 
+Molecule::Molecule(RDKit::ROMOL_SPTR rdkit_mol, std::string canonical_smiles)
+    : Molecule(std::move(rdkit_mol)) {
+    std::call_once(smiles_flag_, [&] {
+        smiles_ = std::move(canonical_smiles);
+        hash_ = hash_string(smiles_);
+    });
+}
+
 std::unique_ptr<Molecule> Molecule::from_smiles(const std::string &smiles) {
     RDKit::ROMOL_SPTR rdkit_mol(RDKit::SmilesToMol(smiles));
     if (!rdkit_mol) {
@@ -19,24 +35,58 @@ std::unique_ptr<Molecule> Molecule::from_smiles(const std::string &smiles) {
     return std::make_unique<Molecule>(std::move(rdkit_mol));
 }
 
-std::unique_ptr<Molecule> Molecule::from_unsanitized_rdkit(const RDKit::ROMOL_SPTR &rdkit_mol) {
+std::unique_ptr<Molecule> Molecule::from_unsanitized_rdkit(RDKit::ROMOL_SPTR rdkit_mol) {
+    auto result = try_from_unsanitized_rdkit(std::move(rdkit_mol));
+    if (!result) {
+        throw MoleculeError(result.message());
+    }
+    return std::move(result).value();
+}
+
+StatusOr<std::unique_ptr<Molecule>>
+Molecule::try_from_unsanitized_rdkit(RDKit::ROMOL_SPTR rdkit_mol) {
     if (!rdkit_mol) {
-        throw MoleculeError("RDKit molecule pointer is null");
+        return Status::error("RDKit molecule pointer is null");
+    }
+    auto *rw_mol =
+        rdkit_mol.use_count() == 1 ? dynamic_cast<RDKit::RWMol *>(rdkit_mol.get()) : nullptr;
+    if (rw_mol == nullptr) {
+        rw_mol = new RDKit::RWMol(*rdkit_mol);
+        rdkit_mol.reset(rw_mol);
     }
-    auto sanitized = std::make_unique<RDKit::RWMol>(*rdkit_mol);
     try {
-        RDKit::MolOps::sanitizeMol(*sanitized);
+        RDKit::MolOps::sanitizeMol(*rw_mol);
     } catch (const RDKit::MolSanitizeException &e) {
-        throw MoleculeError("Failed to sanitize RDKit molecule: " + std::string(e.what()));
+        // RDKit only reports sanitization failures by throwing
+        return Status::error("Failed to sanitize RDKit molecule: " + std::string(e.what()));
     }
-    return std::make_unique<Molecule>(std::move(sanitized));
+    return std::make_unique<Molecule>(std::move(rdkit_mol));
 }
 
 std::unique_ptr<Molecule> Molecule::from_rdkit_pickle(const std::string &pickle) {
+    RDKit::ROMOL_SPTR rdkit_mol(new RDKit::RWMol());
+    RDKit::MolPickler::MolPickler::molFromPickle(pickle, rdkit_mol.get(),
+                                                 RDKit::PicklerOps::AllProps);
+    return from_unsanitized_rdkit(std::move(rdkit_mol));
+}
+
+std::unique_ptr<Molecule> Molecule::from_trusted_rdkit_pickle(const std::string &pickle,
+                                                               std::string smiles) {
     RDKit::ROMOL_SPTR rdkit_mol(new RDKit::ROMol());
     RDKit::MolPickler::MolPickler::molFromPickle(pickle, rdkit_mol.get(),
                                                  RDKit::PicklerOps::AllProps);
-    return from_unsanitized_rdkit(rdkit_mol);
+    // Pickles carry aromaticity and valences but not always ring info, which matching needs
+    if (!rdkit_mol->getRingInfo()->isInitialized()) {
+        RDKit::MolOps::findSSSR(*rdkit_mol);
+    }
+    return std::make_unique<Molecule>(std::move(rdkit_mol), std::move(smiles));
+}
+
+std::shared_ptr<Molecule> Molecule::owning(const std::shared_ptr<Molecule> &ptr) {
+    if (!is_borrowed(ptr)) {
+        return ptr;
+    }
+    return std::make_shared<Molecule>(ptr->rdkit_mol_ptr(), ptr->smiles());
 }
 
 std::string Molecule::rdkit_pickle() const {
@@ -45,10 +95,58 @@ std::string Molecule::rdkit_pickle() const {
     return pickle;
 }
 
+void Molecule::compute_smiles() const {
+    std::call_once(smiles_flag_, [this] {
+        smiles_ = RDKit::MolToSmiles(*rdkit_mol_);
+        hash_ = hash_string(smiles_);
+    });
+}
+
+const std::string &Molecule::smiles() const {
+    compute_smiles();
+    return smiles_;
+}
+
+std::uint64_t Molecule::hash() const {
+    compute_smiles();
+    return hash_;
+}
+
 std::unique_ptr<Molecule> Molecule::largest_fragment() const {
     RDKit::MolStandardize::LargestFragmentChooser chooser{};
     auto lf = RDKit::ROMOL_SPTR(chooser.choose(rdkit_mol()));
     return std::make_unique<Molecule>(std::move(lf));
 }
 
+std::uint64_t Molecule::new_derived_key() {
+    static std::atomic<std::uint64_t> next_key{0};
+    return next_key.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::shared_ptr<const void> Molecule::DerivedData::get(std::uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::ranges::find(values_, key, &decltype(values_)::value_type::first);
+    return it == values_.end() ? nullptr : it->second;
+}
+
+std::shared_ptr<const void> Molecule::DerivedData::set(std::uint64_t key,
+                                                       std::shared_ptr<const void> value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::ranges::find(values_, key, &decltype(values_)::value_type::first);
+    if (it != values_.end()) {
+        return it->second;
+    }
+    values_.emplace_back(key, value);
+    return value;
+}
+
+std::shared_ptr<const void> Molecule::derived(std::uint64_t key) const {
+    return derived_data().get(key);
+}
+
+std::shared_ptr<const void> Molecule::set_derived(std::uint64_t key,
+                                                  std::shared_ptr<const void> value) const {
+    return derived_data().set(key, std::move(value));
+}
+
 } // namespace prexsyn
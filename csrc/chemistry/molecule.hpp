@@ -1,13 +1,18 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <GraphMol/GraphMol.h>
 #include <GraphMol/SmilesParse/SmilesWrite.h>
 
+#include "../utility/status.hpp"
+
 namespace prexsyn {
 
 class MoleculeError : public std::runtime_error {
@@ -16,20 +21,55 @@ public:
 };
 
 class Molecule {
+public:
+    // Data derived from a molecule by other components, see derived()
+    class DerivedData {
+    private:
+        std::mutex mutex_;
+        std::vector<std::pair<std::uint64_t, std::shared_ptr<const void>>> values_;
+
+    public:
+        std::shared_ptr<const void> get(std::uint64_t key);
+        std::shared_ptr<const void> set(std::uint64_t key, std::shared_ptr<const void> value);
+    };
+
 private:
     RDKit::ROMOL_SPTR rdkit_mol_;
-    std::string smiles_;
+
+    // Canonical SMILES is computed on first use, most reaction products never need it
+    mutable std::once_flag smiles_flag_;
+    mutable std::string smiles_;
+    mutable std::uint64_t hash_{};
+
+    mutable DerivedData derived_;
+    // Used instead of derived_ if set, see share_derived()
+    std::shared_ptr<DerivedData> shared_derived_;
+
+    void compute_smiles() const;
+    DerivedData &derived_data() const {
+        return shared_derived_ != nullptr ? *shared_derived_ : derived_;
+    }
 
 public:
     Molecule(RDKit::ROMOL_SPTR rdkit_mol) : rdkit_mol_(std::move(rdkit_mol)) {
         if (!rdkit_mol_) {
             throw MoleculeError("RDKit molecule pointer is null");
         }
-        smiles_ = RDKit::MolToSmiles(*rdkit_mol_);
     }
+    Molecule(RDKit::ROMOL_SPTR rdkit_mol, std::string canonical_smiles);
     static std::unique_ptr<Molecule> from_smiles(const std::string &smiles);
-    static std::unique_ptr<Molecule> from_unsanitized_rdkit(const RDKit::ROMOL_SPTR &rdkit_mol);
+    // Sanitizes in place if the caller hands over the only reference to an RWMol, copies otherwise
+    static std::unique_ptr<Molecule> from_unsanitized_rdkit(RDKit::ROMOL_SPTR rdkit_mol);
+    static StatusOr<std::unique_ptr<Molecule>> try_from_unsanitized_rdkit(RDKit::ROMOL_SPTR);
     static std::unique_ptr<Molecule> from_rdkit_pickle(const std::string &);
+    // For pickles written from sanitized molecules along with their canonical SMILES, skips
+    // sanitization and canonicalization. Only use on data produced by this library.
+    static std::unique_ptr<Molecule> from_trusted_rdkit_pickle(const std::string &pickle,
+                                                               std::string smiles);
+
+    // The molecule itself if ptr owns it, otherwise a new Molecule sharing the RDKit molecule.
+    // Use it to hand borrowed molecules (see borrow()) to code that may outlive their owner.
+    static std::shared_ptr<Molecule> owning(const std::shared_ptr<Molecule> &ptr);
 
     static std::unique_ptr<Molecule> deserialize(const std::string &data) {
         return from_rdkit_pickle(data);
@@ -42,9 +82,24 @@ public:
     std::string rdkit_pickle() const;
 
     unsigned int num_heavy_atoms() const { return rdkit_mol_->getNumHeavyAtoms(); }
-    const std::string &smiles() const { return smiles_; }
+    const std::string &smiles() const;
+    // 64-bit hash of the canonical SMILES
+    std::uint64_t hash() const;
 
     std::unique_ptr<Molecule> largest_fragment() const;
+
+    // Per-molecule storage for data that other components derive from it, e.g. fingerprint
+    // environments. Each component uses its own key from new_derived_key(). Molecules are shared
+    // between threads, so stored values must not be modified.
+    static std::uint64_t new_derived_key();
+    std::shared_ptr<const void> derived(std::uint64_t key) const;
+    // Returns the stored value, which is the one of the first caller if several threads race
+    std::shared_ptr<const void> set_derived(std::uint64_t key,
+                                            std::shared_ptr<const void> value) const;
+    // Keeps derived data in the given storage instead, so that it outlives this molecule, e.g.
+    // for library molecules that are decoded again after they are evicted. Only call it before
+    // the molecule is shared.
+    void share_derived(std::shared_ptr<DerivedData> data) { shared_derived_ = std::move(data); }
 };
 
 } // namespace prexsyn
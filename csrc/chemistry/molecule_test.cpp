@@ -0,0 +1,98 @@
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <GraphMol/RWMol.h>
+#include <GraphMol/SmilesParse/SmilesParse.h>
+#include <GraphMol/Substruct/SubstructMatch.h>
+#include <gtest/gtest.h>
+
+#include "../utility/borrow.hpp"
+#include "chemistry.hpp"
+
+namespace {
+
+using prexsyn::Molecule;
+
+} // namespace
+
+TEST(MoleculeTest, SmilesIsCanonical) {
+    auto molecule = Molecule::from_smiles("OC1=CC=CC=C1");
+    EXPECT_EQ(molecule->smiles(), "Oc1ccccc1");
+}
+
+TEST(MoleculeTest, SmilesIsConsistentAcrossThreads) {
+    auto molecule = Molecule::from_smiles("CN(C)CCCn1c(=O)[nH]c2csnc2c1=O");
+
+    std::vector<std::string> results(8);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < results.size(); ++i) {
+        threads.emplace_back([&, i] { results[i] = molecule->smiles(); });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (const auto &smiles : results) {
+        EXPECT_EQ(smiles, "CN(C)CCCn1c(=O)[nH]c2csnc2c1=O");
+    }
+}
+
+TEST(MoleculeTest, FromUnsanitizedRdkitReusesUniquelyOwnedMolecule) {
+    RDKit::ROMOL_SPTR rdkit_mol(RDKit::SmilesToMol("OC1=CC=CC=C1"));
+    const auto *raw = rdkit_mol.get();
+
+    auto molecule = Molecule::from_unsanitized_rdkit(std::move(rdkit_mol));
+    EXPECT_EQ(&molecule->rdkit_mol(), raw);
+    EXPECT_EQ(molecule->smiles(), "Oc1ccccc1");
+}
+
+TEST(MoleculeTest, FromUnsanitizedRdkitCopiesSharedMolecule) {
+    RDKit::ROMOL_SPTR rdkit_mol(RDKit::SmilesToMol("OC1=CC=CC=C1"));
+    const auto shared = rdkit_mol;
+
+    auto molecule = Molecule::from_unsanitized_rdkit(rdkit_mol);
+    EXPECT_NE(&molecule->rdkit_mol(), shared.get());
+    EXPECT_EQ(molecule->smiles(), "Oc1ccccc1");
+}
+
+TEST(MoleculeTest, TryFromUnsanitizedRdkitReportsSanitizationFailure) {
+    // Pentavalent carbon
+    RDKit::ROMOL_SPTR rdkit_mol(RDKit::SmilesToMol("C(C)(C)(C)(C)C", 0, /*sanitize=*/false));
+
+    auto result = Molecule::try_from_unsanitized_rdkit(std::move(rdkit_mol));
+    EXPECT_FALSE(result.is_ok());
+    EXPECT_NE(result.message().find("sanitize"), std::string::npos);
+}
+
+TEST(MoleculeTest, OwningKeepsBorrowedMoleculeAlive) {
+    std::shared_ptr<Molecule> owner = Molecule::from_smiles("OC1=CC=CC=C1");
+    auto borrowed = prexsyn::borrow(owner);
+    EXPECT_TRUE(prexsyn::is_borrowed(borrowed));
+    EXPECT_EQ(owner.use_count(), 1);
+
+    auto owning = Molecule::owning(borrowed);
+    owner.reset();
+    EXPECT_FALSE(prexsyn::is_borrowed(owning));
+    EXPECT_EQ(owning->smiles(), "Oc1ccccc1");
+}
+
+TEST(MoleculeTest, PatternFingerprintOfSubstructureIsSubset) {
+    auto molecule = Molecule::from_smiles("COC(=O)c1nscc1N");
+    // Only kept with the molecule if asked for
+    EXPECT_NE(prexsyn::PatternFingerprint::of(*molecule),
+              prexsyn::PatternFingerprint::of(*molecule));
+    auto fingerprint = prexsyn::PatternFingerprint::of(*molecule, true);
+    EXPECT_EQ(prexsyn::PatternFingerprint::of(*molecule), fingerprint);
+
+    for (const auto *smarts : {"[NH2]c", "[C](=O)O[CH3]", "c1nscc1", "[#6]", "C(=O)[OH]", "Br"}) {
+        std::unique_ptr<RDKit::RWMol> query(RDKit::SmartsToMol(smarts));
+        RDKit::MatchVectType match;
+        const bool matches = RDKit::SubstructMatch(molecule->rdkit_mol(), *query, match);
+        if (matches) {
+            EXPECT_TRUE(prexsyn::PatternFingerprint(*query).is_subset_of(*fingerprint)) << smarts;
+        }
+    }
+    std::unique_ptr<RDKit::RWMol> bromide(RDKit::SmartsToMol("[Br]"));
+    EXPECT_FALSE(prexsyn::PatternFingerprint(*bromide).is_subset_of(*fingerprint));
+}
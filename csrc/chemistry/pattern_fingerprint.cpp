@@ -0,0 +1,62 @@
+#include "pattern_fingerprint.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <DataStructs/ExplicitBitVect.h>
+#include <GraphMol/Fingerprints/Fingerprints.h>
+
+#include "molecule.hpp"
+
+namespace prexsyn {
+
+PatternFingerprint::PatternFingerprint(const RDKit::ROMol &mol) {
+    // PatternFingerprintMol returns a raw pointer with released ownership
+    std::unique_ptr<ExplicitBitVect> fp{RDKit::PatternFingerprintMol(mol, kNumBits)};
+    for (unsigned int i = 0; i < kNumBits; ++i) {
+        if (fp->getBit(i)) {
+            words_[i / 64] |= std::uint64_t{1} << (i % 64);
+        }
+    }
+}
+
+std::shared_ptr<const PatternFingerprint> PatternFingerprint::of(const Molecule &mol, bool keep) {
+    static const std::uint64_t derived_key = Molecule::new_derived_key();
+    if (auto cached = mol.derived(derived_key)) {
+        return std::static_pointer_cast<const PatternFingerprint>(cached);
+    }
+    auto fp = std::make_shared<const PatternFingerprint>(mol.rdkit_mol());
+    if (!keep) {
+        return fp;
+    }
+    return std::static_pointer_cast<const PatternFingerprint>(mol.set_derived(derived_key, fp));
+}
+
+bool PatternFingerprint::is_subset_of(const PatternFingerprint &other) const {
+#ifdef __AVX2__
+    static_assert(kNumWords % 4 == 0);
+    for (size_t i = 0; i < kNumWords; i += 4) {
+        auto bits = _mm256_load_si256(reinterpret_cast<const __m256i *>(&words_[i]));
+        auto other_bits = _mm256_load_si256(reinterpret_cast<const __m256i *>(&other.words_[i]));
+        // Carry flag: no bit of this fingerprint is missing from the other one
+        if (_mm256_testc_si256(other_bits, bits) == 0) {
+            return false;
+        }
+    }
+    return true;
+#else
+    for (size_t i = 0; i < kNumWords; ++i) {
+        if ((words_[i] & ~other.words_[i]) != 0) {
+            return false;
+        }
+    }
+    return true;
+#endif
+}
+
+} // namespace prexsyn
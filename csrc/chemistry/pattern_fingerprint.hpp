@@ -0,0 +1,36 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <GraphMol/GraphMol.h>
+
+#include "molecule.hpp"
+
+namespace prexsyn {
+
+// RDKit pattern fingerprint packed into words. A query can only be a substructure of a molecule
+// if all bits of its fingerprint are set in the fingerprint of the molecule, which rules out
+// most pairs without graph matching.
+class PatternFingerprint {
+public:
+    static constexpr unsigned int kNumBits = 2048;
+    static constexpr size_t kNumWords = kNumBits / 64;
+
+private:
+    alignas(32) std::array<std::uint64_t, kNumWords> words_{};
+
+public:
+    // Accepts query molecules, e.g. reaction templates
+    explicit PatternFingerprint(const RDKit::ROMol &);
+    // Reuses a fingerprint kept with the molecule, see Molecule::derived(). A new one is only
+    // kept if asked for, for molecules that are matched again and again, since it stays for the
+    // lifetime of the molecule.
+    static std::shared_ptr<const PatternFingerprint> of(const Molecule &, bool keep = false);
+
+    bool is_subset_of(const PatternFingerprint &other) const;
+};
+
+} // namespace prexsyn
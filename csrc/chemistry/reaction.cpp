@@ -2,22 +2,93 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <exception>
 #include <map>
 #include <memory>
+#include <numeric>
+#include <optional>
+#include <span>
 #include <sstream>
 #include <string>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include <GraphMol/ChemReactions/ReactionParser.h>
 #include <GraphMol/ChemReactions/ReactionPickler.h>
 
+#include "../utility/hash.hpp"
 #include "../utility/serialization.hpp"
+#include "../utility/status.hpp"
 #include "molecule.hpp"
 
 namespace prexsyn {
 
+namespace {
+
+// Set if every reactant template atom is mapped to the product, so that the reaction deletes no
+// atom, and with it nothing that is only attached through it
+bool keeps_reactant_atoms(const RDKit::ChemicalReaction &rxn) {
+    std::unordered_set<int> product_map_nums;
+    for (const auto &tmpl : rxn.getProducts()) {
+        for (const auto *atom : tmpl->atoms()) {
+            product_map_nums.insert(atom->getAtomMapNum());
+        }
+    }
+    product_map_nums.erase(0);
+    for (const auto &tmpl : rxn.getReactants()) {
+        for (const auto *atom : tmpl->atoms()) {
+            if (!product_map_nums.contains(atom->getAtomMapNum())) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+std::optional<int> compute_heavy_atom_delta(const RDKit::ChemicalReaction &rxn) {
+    if (rxn.getNumProductTemplates() != 1) {
+        return std::nullopt;
+    }
+    // Query atoms of unspecified element count as heavy atoms
+    auto is_heavy = [](const RDKit::Atom *atom) { return atom->getAtomicNum() != 1; };
+
+    const auto &product = *rxn.getProducts().front();
+    std::unordered_set<int> product_map_nums;
+    for (const auto *atom : product.atoms()) {
+        if (atom->getAtomMapNum() != 0) {
+            product_map_nums.insert(atom->getAtomMapNum());
+        }
+    }
+
+    int delta = 0;
+    std::unordered_set<int> reactant_map_nums;
+    for (const auto &tmpl : rxn.getReactants()) {
+        bool in_product = false;
+        for (const auto *atom : tmpl->atoms()) {
+            auto map_num = atom->getAtomMapNum();
+            if (map_num != 0 && product_map_nums.contains(map_num)) {
+                in_product = true;
+                reactant_map_nums.insert(map_num);
+            } else if (is_heavy(atom)) {
+                --delta;
+            }
+        }
+        if (!in_product) {
+            return std::nullopt;
+        }
+    }
+    for (const auto *atom : product.atoms()) {
+        if (is_heavy(atom) && !reactant_map_nums.contains(atom->getAtomMapNum())) {
+            ++delta;
+        }
+    }
+    return delta;
+}
+
+} // namespace
+
 Reaction::Reaction(std::shared_ptr<RDKit::ChemicalReaction> rdkit_rxn,
                    const std::vector<std::string> &reactant_names)
     : rdkit_rxn_(std::move(rdkit_rxn)), reactant_names_(reactant_names) {
@@ -40,6 +111,8 @@ Reaction::Reaction(std::shared_ptr<RDKit::ChemicalReaction> rdkit_rxn,
         size_t index = reactant_name_to_index_.size();
         reactant_name_to_index_[name] = index;
     }
+    heavy_atom_delta_ = compute_heavy_atom_delta(*rdkit_rxn_);
+    heavy_atom_delta_is_exact_ = heavy_atom_delta_.has_value() && keeps_reactant_atoms(*rdkit_rxn_);
 }
 
 std::shared_ptr<Molecule> ReactionOutcome::main_product() const {
@@ -66,6 +139,20 @@ std::string ReactionOutcome::dedup_key() const {
     return key_ss.str();
 }
 
+std::uint64_t ReactionOutcome::dedup_hash() const {
+    std::vector<std::uint64_t> product_hashes;
+    product_hashes.reserve(products.size());
+    for (const auto &prod : products) {
+        product_hashes.push_back(prod->hash());
+    }
+    std::sort(product_hashes.begin(), product_hashes.end());
+    std::uint64_t h = products.size();
+    for (auto product_hash : product_hashes) {
+        h = hash_combine(h, product_hash);
+    }
+    return h;
+}
+
 std::unique_ptr<Reaction> Reaction::from_smarts(const std::string &smarts,
                                                 const std::vector<std::string> &reactant_names) {
     try {
@@ -167,8 +254,6 @@ Reaction::apply(const std::map<std::string, std::shared_ptr<Molecule>> &reactant
             "Number of reactants provided does not match number of reactant templates");
     }
 
-    std::vector<ReactionOutcome> outcomes;
-
     std::vector<RDKit::ROMOL_SPTR> rdk_reactants;
     rdk_reactants.resize(reactants.size());
     for (const auto &[name, mol] : reactants) {
@@ -179,58 +264,192 @@ Reaction::apply(const std::map<std::string, std::shared_ptr<Molecule>> &reactant
         rdk_reactants[index] = mol->rdkit_mol_ptr();
     }
 
-    auto rdk_outcomes = rdkit_rxn_->runReactants(rdk_reactants);
+    auto outcomes =
+        run_reactants(rdk_reactants, {.ignore_errors = ignore_errors}, kDefaultMaxOutcomes);
+    if (!outcomes) {
+        throw ReactionError(outcomes.message());
+    }
+    return std::move(outcomes).value();
+}
+
+StatusOr<std::vector<ReactionOutcome>>
+Reaction::run_reactants(const std::vector<RDKit::ROMOL_SPTR> &rdk_reactants,
+                        const ReactionApplyOptions &options, size_t max_outcomes) const {
+    std::vector<ReactionOutcome> outcomes;
+    if (max_outcomes == 0) {
+        // RDKit reads a limit of zero as no limit
+        return outcomes;
+    }
+
+    // RDKit counts every outcome it builds, including the ones dropped below. It is asked for
+    // the outcomes still needed, and again for more when some were dropped and it may have
+    // stopped early. It builds outcomes in the same order every time, so the ones already seen
+    // are skipped.
+    const auto max_raw_outcomes = options.max_raw_outcomes.value_or(kDefaultMaxOutcomes);
+    auto request = std::min(max_outcomes, max_raw_outcomes);
+    size_t num_seen = 0;
     bool has_error = false;
-    for (const auto &rdk_outcome : rdk_outcomes) {
-        ReactionOutcome outcome;
-        for (const auto &rdk_prod : rdk_outcome) {
-            try {
-                auto prod = Molecule::from_unsanitized_rdkit(rdk_prod);
-                outcome.products.push_back(std::move(prod));
-            } catch (const MoleculeError &e) {
-                has_error = true;
-                if (ignore_errors) {
-                    continue;
-                } else {
-                    throw ReactionError("Failed to sanitize product molecule: " +
-                                        std::string(e.what()));
-                }
+    while (true) {
+        auto rdk_outcomes =
+            rdkit_rxn_->runReactants(rdk_reactants, static_cast<unsigned int>(request));
+        for (auto k = num_seen; k < rdk_outcomes.size() && outcomes.size() < max_outcomes;
+             ++k) {
+            auto status = accept_outcome(std::move(rdk_outcomes[k]), options, has_error, outcomes);
+            if (!status) {
+                return status;
             }
         }
+        num_seen = rdk_outcomes.size();
+        if (has_error || outcomes.size() >= max_outcomes || rdk_outcomes.size() < request ||
+            request >= max_raw_outcomes) {
+            return outcomes;
+        }
+        request = std::min(2 * request, max_raw_outcomes);
+    }
+}
+
+Status Reaction::accept_outcome(RDKit::MOL_SPTR_VECT rdk_outcome,
+                                const ReactionApplyOptions &options, bool &has_error,
+                                std::vector<ReactionOutcome> &outcomes) {
+    // Same choice as ReactionOutcome::main_product(): the first product with the most heavy
+    // atoms, sanitization does not change the count
+    auto main_it = std::ranges::max_element(
+        rdk_outcome, {}, [](const auto &prod) { return prod->getNumHeavyAtoms(); });
+    if (main_it != rdk_outcome.end() && options.max_heavy_atoms.has_value() &&
+        (*main_it)->getNumHeavyAtoms() > *options.max_heavy_atoms) {
+        return Status::ok();
+    }
+    if (options.main_product_only && rdk_outcome.size() > 1) {
+        auto main_product = std::move(*main_it);
+        rdk_outcome.clear();
+        rdk_outcome.push_back(std::move(main_product));
+    }
 
-        if (!has_error && !outcome.products.empty()) {
-            outcomes.push_back(std::move(outcome));
+    ReactionOutcome outcome;
+    for (auto &rdk_prod : rdk_outcome) {
+        // Products are not referenced elsewhere, hand them over so they are sanitized without a
+        // copy
+        auto prod = Molecule::try_from_unsanitized_rdkit(std::move(rdk_prod));
+        if (!prod) {
+            has_error = true;
+            if (options.ignore_errors) {
+                continue;
+            }
+            return Status::error("Failed to sanitize product molecule: " + prod.message());
         }
+        outcome.products.push_back(std::move(prod).value());
     }
 
-    return outcomes;
+    if (has_error || outcome.products.empty()) {
+        return Status::ok();
+    }
+    if (options.distinct_outcomes) {
+        auto hash = outcome.dedup_hash();
+        auto is_equal = [&](const ReactionOutcome &other) {
+            return other.dedup_hash() == hash && other.dedup_key() == outcome.dedup_key();
+        };
+        if (std::ranges::any_of(outcomes, is_equal)) {
+            return Status::ok();
+        }
+    }
+    outcomes.push_back(std::move(outcome));
+    return Status::ok();
 }
 
 std::vector<ReactionOutcomeWithReactantAssignment>
 Reaction::apply(const std::vector<std::shared_ptr<Molecule>> &reactants, bool ignore_errors) const {
+    return apply(reactants, {}, ignore_errors);
+}
+
+std::vector<ReactionOutcomeWithReactantAssignment>
+Reaction::apply(const std::vector<std::shared_ptr<Molecule>> &reactants,
+                std::span<const KnownMatches> known_matches, bool ignore_errors) const {
+    return apply(reactants, known_matches, ReactionApplyOptions{.ignore_errors = ignore_errors});
+}
+
+std::vector<ReactionOutcomeWithReactantAssignment>
+Reaction::apply(const std::vector<std::shared_ptr<Molecule>> &reactants,
+                std::span<const KnownMatches> known_matches,
+                const ReactionApplyOptions &options) const {
+    auto results = try_apply(reactants, known_matches, options);
+    if (!results) {
+        throw ReactionError(results.message());
+    }
+    return std::move(results).value();
+}
+
+StatusOr<std::vector<ReactionOutcomeWithReactantAssignment>>
+Reaction::try_apply(const std::vector<std::shared_ptr<Molecule>> &reactants,
+                    std::span<const KnownMatches> known_matches,
+                    const ReactionApplyOptions &options) const {
     if (reactants.size() != reactant_names_.size()) {
-        throw ReactionError(
+        return Status::error(
             "Number of reactants provided does not match number of reactant templates");
     }
 
-    std::vector<std::string> name_perm = reactant_names_;
-    std::sort(name_perm.begin(), name_perm.end());
+    // Match every molecule against every template once, so that assignments where some
+    // molecule does not fit its template are skipped without running the reaction.
+    const auto n = reactants.size();
+    std::vector<bool> feasible(n * n);
+    for (size_t i = 0; i < n; ++i) {
+        auto known =
+            std::ranges::find(known_matches, reactants.at(i).get(), &KnownMatches::molecule);
+        if (known != known_matches.end()) {
+            for (const auto &match : known->matches) {
+                feasible[i * n + match.index] = true;
+            }
+            continue;
+        }
+        for (size_t t = 0; t < n; ++t) {
+            RDKit::MatchVectType match;
+            feasible[i * n + t] = RDKit::SubstructMatch(reactants.at(i)->rdkit_mol(),
+                                                        *rdkit_rxn_->getReactants()[t], match);
+        }
+    }
+
+    // Permute template indices in the lexicographic order of their names, so assignments are
+    // visited in the same order as permutations of the sorted names.
+    auto name_less = [this](ReactantIndex a, ReactantIndex b) {
+        return reactant_names_[a] < reactant_names_[b];
+    };
+    std::vector<ReactantIndex> perm(n);
+    std::iota(perm.begin(), perm.end(), 0);
+    std::sort(perm.begin(), perm.end(), name_less);
 
+    const auto max_outcomes = options.max_outcomes.value_or(kDefaultMaxOutcomes);
     std::vector<ReactionOutcomeWithReactantAssignment> results;
+    std::vector<RDKit::ROMOL_SPTR> rdk_reactants(n);
     // NOLINTNEXTLINE(cppcoreguidelines-avoid-do-while)
     do {
-        std::map<std::string, std::shared_ptr<Molecule>> reactant_map;
-        for (size_t i = 0; i < name_perm.size(); ++i) {
-            reactant_map[name_perm.at(i)] = reactants.at(i);
+        if (results.size() >= max_outcomes) {
+            break;
+        }
+        bool is_feasible = true;
+        for (size_t i = 0; i < n && is_feasible; ++i) {
+            is_feasible = feasible[i * n + perm[i]];
+        }
+        if (!is_feasible) {
+            continue;
+        }
+
+        std::vector<std::string> assignment;
+        assignment.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            rdk_reactants[perm[i]] = reactants[i]->rdkit_mol_ptr();
+            assignment.push_back(reactant_names_[perm[i]]);
+        }
+        // Only the budget left over from earlier assignments is handed to RDKit
+        auto outcomes = run_reactants(rdk_reactants, options, max_outcomes - results.size());
+        if (!outcomes) {
+            return outcomes.status();
         }
-        auto outcomes = apply(reactant_map, ignore_errors);
-        for (auto &outcome : outcomes) {
+        for (auto &outcome : outcomes.value()) {
             ReactionOutcomeWithReactantAssignment outcome_with_assignment;
             outcome_with_assignment.products = std::move(outcome.products);
-            outcome_with_assignment.reactant_names = name_perm;
+            outcome_with_assignment.reactant_names = assignment;
             results.push_back(std::move(outcome_with_assignment));
         }
-    } while (std::next_permutation(name_perm.begin(), name_perm.end()));
+    } while (std::next_permutation(perm.begin(), perm.end(), name_less));
 
     return results;
 }
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <map>
 #include <memory>
+#include <optional>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <string_view>
@@ -10,6 +13,7 @@
 
 #include <GraphMol/ChemReactions/Reaction.h>
 
+#include "../utility/status.hpp"
 #include "molecule.hpp"
 
 namespace prexsyn {
@@ -26,20 +30,56 @@ struct ReactionOutcome {
     size_t num_products() const { return products.size(); }
     std::shared_ptr<Molecule> main_product() const;
     std::string dedup_key() const;
+    // Hash of the product multiset, equal for outcomes with equal dedup_key()
+    std::uint64_t dedup_hash() const;
 };
 
 struct ReactionOutcomeWithReactantAssignment : public ReactionOutcome {
     std::vector<std::string> reactant_names;
 };
 
+struct ReactionApplyOptions {
+    bool ignore_errors = false;
+    // Upper bound on the outcomes of one call. Only outcomes that are kept count against it, and
+    // RDKit is asked for no more outcomes than are still needed. Defaults to RDKit's own limit.
+    std::optional<size_t> max_outcomes = std::nullopt;
+    // Upper bound on the outcomes RDKit builds for one reactant assignment, kept or not, which
+    // bounds the cost of a call. Defaults to RDKit's own limit.
+    std::optional<size_t> max_raw_outcomes = std::nullopt;
+    // Drop outcomes equal to an earlier outcome of the same reactant assignment, see
+    // ReactionOutcome::dedup_key()
+    bool distinct_outcomes = false;
+    // Keep only the main product of each outcome. It is picked by heavy atom count on the raw
+    // RDKit products, so the other products are dropped without being sanitized, and outcomes
+    // that only differ in by-products become equal.
+    bool main_product_only = false;
+    // Outcomes whose main product has more heavy atoms are dropped on the raw RDKit products,
+    // before anything is sanitized
+    std::optional<unsigned int> max_heavy_atoms = std::nullopt;
+};
+
 class Reaction {
 public:
     using ReactantIndex = size_t;
+    // Default maxProducts of RDKit::ChemicalReaction::runReactants
+    static constexpr size_t kDefaultMaxOutcomes = 1000;
 
 private:
     std::shared_ptr<RDKit::ChemicalReaction> rdkit_rxn_;
     std::vector<std::string> reactant_names_;
     std::map<std::string, ReactantIndex> reactant_name_to_index_;
+    std::optional<int> heavy_atom_delta_;
+    bool heavy_atom_delta_is_exact_ = false;
+
+    // Runs the reaction with reactants already placed in template order
+    // max_outcomes overrides options.max_outcomes
+    StatusOr<std::vector<ReactionOutcome>>
+    run_reactants(const std::vector<RDKit::ROMOL_SPTR> &rdk_reactants,
+                  const ReactionApplyOptions &options, size_t max_outcomes) const;
+    // Sanitizes and filters one raw RDKit outcome, appends it to outcomes if it is kept
+    static Status accept_outcome(RDKit::MOL_SPTR_VECT rdk_outcome,
+                                 const ReactionApplyOptions &options, bool &has_error,
+                                 std::vector<ReactionOutcome> &outcomes);
 
 public:
     Reaction(std::shared_ptr<RDKit::ChemicalReaction> rdkit_rxn,
@@ -63,6 +103,14 @@ public:
     const std::map<std::string, ReactantIndex> &reactant_name_to_index() const {
         return reactant_name_to_index_;
     }
+    // Heavy atoms of the product minus those of the reactants, from the template atoms that the
+    // reaction deletes or creates. Reactant atoms only attached through deleted atoms are lost as
+    // well, so the product may come out smaller. Unset for reactions with several products or
+    // with a reactant that leaves no atom in the product.
+    std::optional<int> heavy_atom_delta() const { return heavy_atom_delta_; }
+    // Set if the reaction deletes no reactant atom, so that every product has exactly
+    // heavy_atom_delta() more heavy atoms than its reactants
+    bool heavy_atom_delta_is_exact() const { return heavy_atom_delta_is_exact_; }
 
     struct ReactantMatch {
         ReactantIndex index;
@@ -71,6 +119,13 @@ public:
     };
     std::vector<ReactantMatch> match_reactants(const Molecule &) const;
 
+    // Result of match_reactants() for one of the molecules passed to apply(), so that the
+    // molecule is not matched against the templates again
+    struct KnownMatches {
+        const Molecule *molecule;
+        std::span<const ReactantMatch> matches;
+    };
+
     std::vector<ReactionOutcome>
     apply(const std::map<std::string, std::shared_ptr<Molecule>> &reactants,
           bool ignore_errors = false) const;
@@ -78,6 +133,19 @@ public:
     std::vector<ReactionOutcomeWithReactantAssignment>
     apply(const std::vector<std::shared_ptr<Molecule>> &reactants,
           bool ignore_errors = false) const;
+
+    std::vector<ReactionOutcomeWithReactantAssignment>
+    apply(const std::vector<std::shared_ptr<Molecule>> &reactants,
+          std::span<const KnownMatches> known_matches, bool ignore_errors = false) const;
+
+    std::vector<ReactionOutcomeWithReactantAssignment>
+    apply(const std::vector<std::shared_ptr<Molecule>> &reactants,
+          std::span<const KnownMatches> known_matches, const ReactionApplyOptions &options) const;
+    // Reports errors through the returned status instead of throwing
+    StatusOr<std::vector<ReactionOutcomeWithReactantAssignment>>
+    try_apply(const std::vector<std::shared_ptr<Molecule>> &reactants,
+              std::span<const KnownMatches> known_matches,
+              const ReactionApplyOptions &options) const;
 };
 
 } // namespace prexsyn
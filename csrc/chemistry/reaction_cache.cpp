@@ -0,0 +1,187 @@
+#include "reaction_cache.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../utility/hash.hpp"
+#include "../utility/serialization.hpp"
+#include "molecule.hpp"
+#include "reaction.hpp"
+
+namespace prexsyn {
+
+std::uint64_t ReactionCache::Key::hash() const {
+    auto h = hash_combine(hash_mix(reaction), static_cast<std::uint64_t>(main_product_only));
+    h = hash_combine(h, max_outcomes);
+    h = hash_combine(h, max_raw_outcomes);
+    h = hash_combine(h, static_cast<std::uint64_t>(distinct_outcomes));
+    h = hash_combine(h, max_heavy_atoms);
+    for (auto reactant : reactants) {
+        h = hash_combine(h, reactant);
+    }
+    return h;
+}
+
+ReactionCache::ReactionCache(size_t capacity, size_t num_shards,
+                             std::uint64_t reactions_fingerprint)
+    : shard_capacity_(0), shards_(std::max<size_t>(num_shards, 1)),
+      reactions_fingerprint_(reactions_fingerprint) {
+    if (capacity == 0) {
+        throw std::invalid_argument("Reaction cache capacity must be positive");
+    }
+    shard_capacity_ = (capacity + shards_.size() - 1) / shards_.size();
+}
+
+ReactionCache::Value ReactionCache::get(const Key &key) {
+    auto &shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    return it->second->second;
+}
+
+ReactionCache::Value ReactionCache::put(const Key &key, Outcomes outcomes) {
+    // Cached products are shared between threads, so canonicalize them before publishing
+    for (const auto &outcome : outcomes) {
+        for (const auto &prod : outcome.products) {
+            prod->smiles();
+        }
+    }
+    auto value = std::make_shared<const Outcomes>(std::move(outcomes));
+
+    auto &shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        it->second->second = value;
+        shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+        return value;
+    }
+    shard.entries.emplace_front(key, value);
+    shard.index.emplace(key, shard.entries.begin());
+    if (shard.entries.size() > shard_capacity_) {
+        shard.index.erase(shard.entries.back().first);
+        shard.entries.pop_back();
+    }
+    return value;
+}
+
+size_t ReactionCache::size() const {
+    size_t total = 0;
+    for (const auto &shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total += shard.entries.size();
+    }
+    return total;
+}
+
+ReactionCache::Stats ReactionCache::stats() const {
+    return {
+        .hits = hits_.load(std::memory_order_relaxed),
+        .misses = misses_.load(std::memory_order_relaxed),
+        .size = size(),
+        .capacity = capacity(),
+    };
+}
+
+void ReactionCache::reset_stats() {
+    hits_.store(0, std::memory_order_relaxed);
+    misses_.store(0, std::memory_order_relaxed);
+}
+
+void ReactionCache::clear() {
+    for (auto &shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.index.clear();
+        shard.entries.clear();
+    }
+}
+
+void ReactionCache::save(std::ostream &os) const {
+    os.write(kFileMagic.data(), kFileMagic.size());
+    os.write(reinterpret_cast<const char *>(&kFileVersion), sizeof(kFileVersion));
+    os.write(reinterpret_cast<const char *>(&reactions_fingerprint_),
+             sizeof(reactions_fingerprint_));
+    boost::archive::binary_oarchive oa(os);
+    oa << shards_.size();
+    for (const auto &shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        oa << shard.entries.size();
+        // Least recently used first, so that loading restores the recency order
+        for (auto it = shard.entries.rbegin(); it != shard.entries.rend(); ++it) {
+            const auto &[key, outcomes] = *it;
+            oa << key.reaction << key.reactants << key.main_product_only << key.max_outcomes
+               << key.max_raw_outcomes << key.distinct_outcomes << key.max_heavy_atoms;
+            oa << outcomes->size();
+            for (const auto &outcome : *outcomes) {
+                std::vector<std::string> products;
+                products.reserve(outcome.products.size());
+                for (const auto &prod : outcome.products) {
+                    products.push_back(prod->serialize());
+                }
+                oa << outcome.reactant_names << products;
+            }
+        }
+    }
+}
+
+void ReactionCache::load(std::istream &is) {
+    std::array<char, kFileMagic.size()> magic{};
+    std::uint32_t version = 0;
+    is.read(magic.data(), magic.size());
+    if (!is || magic != kFileMagic) {
+        throw std::runtime_error("not a reaction cache file, or written before files had a header");
+    }
+    is.read(reinterpret_cast<char *>(&version), sizeof(version));
+    if (!is || version != kFileVersion) {
+        throw std::runtime_error("unsupported reaction cache file version: " +
+                                 std::to_string(version));
+    }
+    // Keys only hold reaction indices, which mean other reactions in another library
+    std::uint64_t reactions_fingerprint = 0;
+    is.read(reinterpret_cast<char *>(&reactions_fingerprint), sizeof(reactions_fingerprint));
+    if (!is || reactions_fingerprint != reactions_fingerprint_) {
+        throw std::runtime_error("reaction cache file was saved for other reactions");
+    }
+    boost::archive::binary_iarchive ia(is);
+    size_t num_shards = 0;
+    ia >> num_shards;
+    for (size_t s = 0; s < num_shards; ++s) {
+        size_t num_entries = 0;
+        ia >> num_entries;
+        for (size_t e = 0; e < num_entries; ++e) {
+            Key key;
+            size_t num_outcomes = 0;
+            ia >> key.reaction >> key.reactants >> key.main_product_only >> key.max_outcomes >>
+                key.max_raw_outcomes >> key.distinct_outcomes >> key.max_heavy_atoms;
+            ia >> num_outcomes;
+
+            Outcomes outcomes(num_outcomes);
+            for (auto &outcome : outcomes) {
+                std::vector<std::string> products;
+                ia >> outcome.reactant_names >> products;
+                for (const auto &data : products) {
+                    outcome.products.push_back(Molecule::deserialize(data));
+                }
+            }
+            put(key, std::move(outcomes));
+        }
+    }
+}
+
+} // namespace prexsyn
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "reaction.hpp"
+
+namespace prexsyn {
+
+// Bounded LRU cache of reaction outcomes, safe to share between threads. Entries are spread
+// over independently locked shards so that concurrent lookups rarely contend.
+class ReactionCache {
+public:
+    static constexpr size_t kDefaultNumShards = 16;
+    // Files written by save() start with the magic and the version, and load() rejects others
+    static constexpr std::array<char, 8> kFileMagic = {'P', 'X', 'R', 'X', 'C', 'A', 'C', 'H'};
+    // Version 2 keys hold max_raw_outcomes and distinct_outcomes, version 3 files hold the
+    // reactions fingerprint
+    static constexpr std::uint32_t kFileVersion = 3;
+
+    struct Key {
+        // Caller-defined reaction identity, e.g. the index in a reaction library
+        std::uint64_t reaction = 0;
+        // Molecule hashes of the reactants, in the order they are passed to the reaction
+        std::vector<std::uint64_t> reactants;
+        // Outcomes are cached separately for each of these ReactionApplyOptions
+        bool main_product_only = false;
+        std::uint64_t max_outcomes = 0;
+        std::uint64_t max_raw_outcomes = 0;
+        bool distinct_outcomes = false;
+        std::uint64_t max_heavy_atoms = 0;
+
+        std::uint64_t hash() const;
+        bool operator==(const Key &) const = default;
+    };
+
+    using Outcomes = std::vector<ReactionOutcomeWithReactantAssignment>;
+    using Value = std::shared_ptr<const Outcomes>;
+
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t size = 0;
+        size_t capacity = 0;
+
+        double hit_rate() const {
+            auto total = hits + misses;
+            return total == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(total);
+        }
+    };
+
+private:
+    struct KeyHash {
+        size_t operator()(const Key &key) const { return key.hash(); }
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        // Most recently used first
+        std::list<std::pair<Key, Value>> entries;
+        std::unordered_map<Key, std::list<std::pair<Key, Value>>::iterator, KeyHash> index;
+    };
+
+    size_t shard_capacity_;
+    std::vector<Shard> shards_;
+    std::uint64_t reactions_fingerprint_;
+    std::atomic<size_t> hits_{0};
+    std::atomic<size_t> misses_{0};
+
+    Shard &shard_for(const Key &key) { return shards_[key.hash() % shards_.size()]; }
+
+public:
+    // reactions_fingerprint identifies the reactions that Key::reaction refers to, e.g.
+    // ReactionLibrary::fingerprint(). It is saved with the entries, and load() rejects files
+    // saved with another one.
+    explicit ReactionCache(size_t capacity, size_t num_shards = kDefaultNumShards,
+                           std::uint64_t reactions_fingerprint = 0);
+
+    // Returns null on a miss
+    Value get(const Key &);
+    // Returns the stored value
+    Value put(const Key &, Outcomes outcomes);
+
+    size_t size() const;
+    size_t capacity() const { return shard_capacity_ * shards_.size(); }
+    std::uint64_t reactions_fingerprint() const { return reactions_fingerprint_; }
+    Stats stats() const;
+    void reset_stats();
+    void clear();
+
+    void save(std::ostream &) const;
+    void load(std::istream &);
+};
+
+} // namespace prexsyn
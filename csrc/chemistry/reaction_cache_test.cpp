@@ -0,0 +1,114 @@
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "chemistry.hpp"
+
+namespace {
+
+using prexsyn::Molecule;
+using prexsyn::ReactionCache;
+using prexsyn::ReactionOutcomeWithReactantAssignment;
+
+ReactionCache::Outcomes make_outcomes(const char *smiles) {
+    ReactionOutcomeWithReactantAssignment outcome;
+    outcome.products.push_back(Molecule::from_smiles(smiles));
+    outcome.reactant_names = {"A", "B"};
+    return {outcome};
+}
+
+} // namespace
+
+TEST(ReactionCacheTest, GetReturnsStoredOutcomesAndCountsHits) {
+    ReactionCache cache(8, 2);
+    const ReactionCache::Key key{.reaction = 1, .reactants = {10, 20}};
+
+    EXPECT_EQ(cache.get(key), nullptr);
+    cache.put(key, make_outcomes("CCO"));
+
+    auto outcomes = cache.get(key);
+    ASSERT_NE(outcomes, nullptr);
+    ASSERT_EQ(outcomes->size(), 1);
+    EXPECT_EQ(outcomes->front().main_product()->smiles(), "CCO");
+    EXPECT_EQ(cache.get({.reaction = 1, .reactants = {20, 10}}), nullptr);
+
+    const auto stats = cache.stats();
+    EXPECT_EQ(stats.hits, 1);
+    EXPECT_EQ(stats.misses, 2);
+    EXPECT_EQ(stats.size, 1);
+}
+
+TEST(ReactionCacheTest, EvictsLeastRecentlyUsedEntry) {
+    ReactionCache cache(2, 1);
+    const ReactionCache::Key k1{.reaction = 0, .reactants = {1}};
+    const ReactionCache::Key k2{.reaction = 0, .reactants = {2}};
+    const ReactionCache::Key k3{.reaction = 0, .reactants = {3}};
+
+    cache.put(k1, make_outcomes("C"));
+    cache.put(k2, make_outcomes("CC"));
+    EXPECT_NE(cache.get(k1), nullptr);
+    cache.put(k3, make_outcomes("CCC"));
+
+    EXPECT_EQ(cache.size(), 2);
+    EXPECT_NE(cache.get(k1), nullptr);
+    EXPECT_EQ(cache.get(k2), nullptr);
+    EXPECT_NE(cache.get(k3), nullptr);
+}
+
+TEST(ReactionCacheTest, SaveAndLoadRoundTrip) {
+    ReactionCache cache(8);
+    const ReactionCache::Key key{.reaction = 3, .reactants = {7, 8}};
+    cache.put(key, make_outcomes("c1ccccc1O"));
+
+    std::stringstream ss;
+    cache.save(ss);
+
+    ReactionCache restored(8);
+    restored.load(ss);
+    auto outcomes = restored.get(key);
+    ASSERT_NE(outcomes, nullptr);
+    ASSERT_EQ(outcomes->size(), 1);
+    EXPECT_EQ(outcomes->front().main_product()->smiles(), "Oc1ccccc1");
+    EXPECT_EQ(outcomes->front().reactant_names, (std::vector<std::string>{"A", "B"}));
+}
+
+TEST(ReactionCacheTest, LoadRejectsFilesWithoutMatchingHeader) {
+    ReactionCache cache(8);
+    cache.put({.reaction = 3, .reactants = {7, 8}}, make_outcomes("c1ccccc1O"));
+    std::stringstream ss;
+    cache.save(ss);
+    const auto saved = ss.str();
+
+    // Layout of the first cache files, which started directly with the archive
+    std::stringstream headerless(saved.substr(ReactionCache::kFileMagic.size() + 4));
+    ReactionCache restored(8);
+    EXPECT_THROW(restored.load(headerless), std::runtime_error);
+
+    auto other_version = saved;
+    other_version[ReactionCache::kFileMagic.size()] += 1;
+    std::stringstream newer(other_version);
+    EXPECT_THROW(restored.load(newer), std::runtime_error);
+    EXPECT_EQ(restored.size(), 0);
+}
+
+TEST(ReactionCacheTest, LoadRejectsFilesOfOtherReactions) {
+    ReactionCache cache(8, ReactionCache::kDefaultNumShards, 42);
+    cache.put({.reaction = 3, .reactants = {7, 8}}, make_outcomes("c1ccccc1O"));
+    std::stringstream ss;
+    cache.save(ss);
+    const auto saved = ss.str();
+
+    ReactionCache other(8, ReactionCache::kDefaultNumShards, 43);
+    std::stringstream for_other(saved);
+    EXPECT_THROW(other.load(for_other), std::runtime_error);
+    EXPECT_EQ(other.size(), 0);
+
+    ReactionCache same(8, ReactionCache::kDefaultNumShards, 42);
+    std::stringstream for_same(saved);
+    same.load(for_same);
+    EXPECT_EQ(same.size(), 1);
+}
@@ -54,6 +54,137 @@ TEST(ReactionTest, ApplyVectorReactantsTracksAssignmentAndProduct) {
     EXPECT_EQ(outcomes.front().main_product()->smiles(), kExpectedProductSmiles);
 }
 
+TEST(ReactionTest, ApplyVectorReactantsFindsAssignmentForReversedInput) {
+    auto reaction = make_test_reaction();
+
+    const auto outcomes = reaction->apply(std::vector{make_reactant_b(), make_reactant_a()});
+
+    ASSERT_EQ(outcomes.size(), 1);
+    ASSERT_EQ(outcomes.front().reactant_names.size(), 2);
+    EXPECT_EQ(outcomes.front().reactant_names.at(0), "B");
+    EXPECT_EQ(outcomes.front().reactant_names.at(1), "A");
+    EXPECT_EQ(outcomes.front().main_product()->smiles(), kExpectedProductSmiles);
+}
+
+TEST(ReactionTest, ApplyVectorReactantsReturnsNothingWithoutMatchingAssignment) {
+    auto reaction = make_test_reaction();
+
+    const auto outcomes = reaction->apply(std::vector{make_reactant_b(), make_reactant_b()});
+
+    EXPECT_TRUE(outcomes.empty());
+}
+
+TEST(ReactionTest, ApplyVectorReactantsReusesKnownMatches) {
+    auto reaction = make_test_reaction();
+    auto reactant_a = make_reactant_a();
+
+    const auto matches = reaction->match_reactants(*reactant_a);
+    ASSERT_EQ(matches.size(), 1);
+    EXPECT_EQ(matches.front().name, "A");
+    EXPECT_GT(matches.front().count, 0);
+
+    const std::vector<Reaction::KnownMatches> known{{reactant_a.get(), matches}};
+    const auto outcomes = reaction->apply(std::vector{make_reactant_b(), reactant_a}, known);
+
+    ASSERT_EQ(outcomes.size(), 1);
+    EXPECT_EQ(outcomes.front().reactant_names.at(0), "B");
+    EXPECT_EQ(outcomes.front().main_product()->smiles(), kExpectedProductSmiles);
+}
+
+TEST(ReactionTest, ApplyMainProductOnlyDropsByProducts) {
+    // Ester hydrolysis releases the alcohol as a by-product
+    auto reaction = Reaction::from_smarts("[C:1](=[O:2])[O][C:3]>>[C:1](=[O:2])O.[C:3]O", {"A"});
+    const std::vector<std::shared_ptr<Molecule>> reactants{Molecule::from_smiles("CCCCC(=O)OC")};
+
+    const auto full = reaction->apply(reactants);
+    const auto main_only = reaction->apply(reactants, {}, {.main_product_only = true});
+
+    ASSERT_EQ(full.size(), 1);
+    ASSERT_EQ(full.front().num_products(), 2);
+    ASSERT_EQ(main_only.size(), 1);
+    ASSERT_EQ(main_only.front().num_products(), 1);
+    EXPECT_EQ(main_only.front().main_product()->smiles(), full.front().main_product()->smiles());
+    EXPECT_EQ(main_only.front().main_product()->smiles(), "CCCCC(=O)O");
+}
+
+TEST(ReactionTest, ApplyStopsAtMaxOutcomesAcrossAssignments) {
+    // Both molecules fit both templates at two atoms each, so there are many outcomes
+    auto reaction = Reaction::from_smarts("[C:1].[C:2]>>[C:1][C:2]", {"A", "B"});
+    const std::vector<std::shared_ptr<Molecule>> reactants{Molecule::from_smiles("CC"),
+                                                           Molecule::from_smiles("CCO")};
+
+    const auto full = reaction->apply(reactants);
+    ASSERT_GT(full.size(), 5);
+
+    const auto limited = reaction->apply(reactants, {}, {.max_outcomes = 5});
+    ASSERT_EQ(limited.size(), 5);
+    for (size_t i = 0; i < limited.size(); ++i) {
+        EXPECT_EQ(limited[i].reactant_names, full[i].reactant_names);
+        EXPECT_EQ(limited[i].dedup_key(), full[i].dedup_key());
+    }
+}
+
+TEST(ReactionTest, ApplyCountsOnlyDistinctOutcomesAgainstMaxOutcomes) {
+    // Ethane is symmetric, so the raw outcomes repeat two products: CCCCO and CCC(C)O
+    auto reaction = Reaction::from_smarts("[C:1].[C:2]>>[C:1][C:2]", {"A", "B"});
+    const std::vector<std::shared_ptr<Molecule>> reactants{Molecule::from_smiles("CC"),
+                                                           Molecule::from_smiles("CCO")};
+
+    EXPECT_EQ(reaction->apply(reactants, {}, {.max_outcomes = 3}).size(), 3);
+    const auto distinct =
+        reaction->apply(reactants, {}, {.max_outcomes = 3, .distinct_outcomes = true});
+    ASSERT_EQ(distinct.size(), 2);
+    EXPECT_NE(distinct[0].main_product()->smiles(), distinct[1].main_product()->smiles());
+}
+
+TEST(ReactionTest, HeavyAtomDeltaPredictsProductSize) {
+    auto reaction = make_test_reaction();
+    auto reactant_a = make_reactant_a();
+    auto reactant_b = make_reactant_b();
+
+    // The methoxy group leaves and the carbonyl of the new ring is created
+    ASSERT_EQ(reaction->heavy_atom_delta(), 0);
+    const auto outcomes = reaction->apply(std::vector{reactant_a, reactant_b});
+    ASSERT_FALSE(outcomes.empty());
+    EXPECT_EQ(static_cast<int>(outcomes.front().main_product()->num_heavy_atoms()),
+              static_cast<int>(reactant_a->num_heavy_atoms() + reactant_b->num_heavy_atoms()) +
+                  *reaction->heavy_atom_delta());
+
+    auto hydrolysis = Reaction::from_smarts("[C:1](=[O:2])[O][C:3]>>[C:1](=[O:2])O.[C:3]O", {"A"});
+    EXPECT_FALSE(hydrolysis->heavy_atom_delta().has_value());
+}
+
+TEST(ReactionTest, HeavyAtomDeltaIsExactOnlyWithoutDeletedAtoms) {
+    auto coupling = Reaction::from_smarts("[C:1].[C:2]>>[C:1][C:2]", {"A", "B"});
+    EXPECT_EQ(coupling->heavy_atom_delta(), 0);
+    EXPECT_TRUE(coupling->heavy_atom_delta_is_exact());
+
+    // Deleting the ether oxygen also drops the ethyl group that is only attached through it
+    auto cleavage = Reaction::from_smarts("[C:1][O]>>[C:1]", {"A"});
+    const std::shared_ptr<Molecule> reactant = Molecule::from_smiles("CCOCC");
+    ASSERT_EQ(cleavage->heavy_atom_delta(), -1);
+    EXPECT_FALSE(cleavage->heavy_atom_delta_is_exact());
+    const auto outcomes = cleavage->apply(std::vector{reactant});
+    ASSERT_FALSE(outcomes.empty());
+    EXPECT_EQ(outcomes.front().main_product()->smiles(), "CC");
+    EXPECT_LT(static_cast<int>(outcomes.front().main_product()->num_heavy_atoms()),
+              static_cast<int>(reactant->num_heavy_atoms()) + *cleavage->heavy_atom_delta());
+    EXPECT_FALSE(make_test_reaction()->heavy_atom_delta_is_exact());
+}
+
+TEST(ReactionTest, ApplyDropsOutcomesOverMaxHeavyAtoms) {
+    auto reaction = make_test_reaction();
+    const std::vector<std::shared_ptr<Molecule>> reactants{make_reactant_a(), make_reactant_b()};
+    const auto product_heavy_atoms =
+        Molecule::from_smiles(kExpectedProductSmiles)->num_heavy_atoms();
+
+    EXPECT_TRUE(
+        reaction->apply(reactants, {}, {.max_heavy_atoms = product_heavy_atoms - 1}).empty());
+    const auto outcomes = reaction->apply(reactants, {}, {.max_heavy_atoms = product_heavy_atoms});
+    ASSERT_EQ(outcomes.size(), 1);
+    EXPECT_EQ(outcomes.front().main_product()->smiles(), kExpectedProductSmiles);
+}
+
 TEST(ReactionTest, ApplyNamedReactantsThrowsOnMismatchedReactantNames) {
     auto reaction = make_test_reaction();
 
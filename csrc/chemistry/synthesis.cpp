@@ -1,20 +1,123 @@
 #include "synthesis.hpp"
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <exception>
 #include <functional>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <ranges>
-#include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <omp.h>
+
+#include "../utility/hash.hpp"
+#include "../utility/status.hpp"
 #include "molecule.hpp"
 #include "reaction.hpp"
+#include "reaction_cache.hpp"
 
 namespace prexsyn {
 
+bool SynthesisNode::CellCursor::advance() {
+    for (size_t i = 0; i < cell_.size(); ++i) {
+        if (++cell_[i] < available_[i]) {
+            return true;
+        }
+        cell_[i] = 0;
+    }
+    return false;
+}
+
+const std::vector<size_t> *
+SynthesisNode::CellCursor::next(const std::function<bool(size_t, size_t)> &has_item) {
+    if (exhausted_) {
+        return nullptr;
+    }
+    if (!shells_) {
+        // The whole product is a single shell
+        if (in_shell_ ? advance() : std::ranges::find(available_, 0) == available_.end()) {
+            in_shell_ = true;
+            return &cell_;
+        }
+        exhausted_ = true;
+        return nullptr;
+    }
+
+    while (!exhausted_) {
+        if (!in_shell_) {
+            // Shell k holds the cells whose largest index is k, it is empty once no precursor
+            // has an item at index k
+            bool has_new_items = false;
+            for (size_t i = 0; i < available_.size(); ++i) {
+                if (available_[i] == shell_ && has_item(i, shell_)) {
+                    available_[i] = shell_ + 1;
+                    has_new_items = true;
+                }
+                if (available_[i] == 0) {
+                    exhausted_ = true;
+                }
+            }
+            if (exhausted_ || !has_new_items) {
+                exhausted_ = true;
+                break;
+            }
+            std::ranges::fill(cell_, 0);
+            in_shell_ = true;
+        } else if (!advance()) {
+            in_shell_ = false;
+            ++shell_;
+            continue;
+        }
+        if (std::ranges::max(cell_) < shell_) {
+            // Skip the cells of earlier shells in one step. The next cell of this shell in
+            // odometer order sets the first precursor with an item at index shell_ to it, and
+            // resets the precursors before it, which cannot reach shell_.
+            auto first = std::ranges::find_if(available_, [this](size_t n) { return n > shell_; });
+            auto i = static_cast<size_t>(first - available_.begin());
+            std::fill_n(cell_.begin(), i, 0);
+            cell_[i] = shell_;
+        }
+        return &cell_;
+    }
+    return nullptr;
+}
+
+std::uint64_t OutcomeDeduplicator::hash(const ReactionOutcomeWithReactantAssignment &outcome) {
+    auto h = outcome.dedup_hash();
+    for (const auto &name : outcome.reactant_names) {
+        h = hash_combine(h, hash_string(name));
+    }
+    return h;
+}
+
+std::string OutcomeDeduplicator::key(const ReactionOutcomeWithReactantAssignment &outcome) {
+    auto key = outcome.dedup_key() + "|";
+    for (const auto &name : outcome.reactant_names) {
+        key += name;
+        key += '.';
+    }
+    return key;
+}
+
+bool OutcomeDeduplicator::insert(std::uint64_t hash,
+                                 const ReactionOutcomeWithReactantAssignment &outcome) {
+    auto outcome_key = key(outcome);
+    auto duplicate =
+        index_.find(hash, [&](size_t key_index) { return keys_[key_index] == outcome_key; });
+    if (duplicate.has_value()) {
+        return false;
+    }
+    index_.insert(hash, keys_.size());
+    keys_.push_back(std::move(outcome_key));
+    return true;
+}
+
 std::unique_ptr<SynthesisNode> SynthesisNode::from_molecule(size_t index,
                                                             const std::shared_ptr<Molecule> &mol) {
     std::unique_ptr<SynthesisNode> node{new SynthesisNode()};
@@ -25,33 +128,285 @@ std::unique_ptr<SynthesisNode> SynthesisNode::from_molecule(size_t index,
 
 std::unique_ptr<SynthesisNode>
 SynthesisNode::from_reaction(size_t index, const std::shared_ptr<Reaction> &rxn,
-                             const std::vector<std::shared_ptr<SynthesisNode>> &prec) {
+                             const std::vector<std::shared_ptr<SynthesisNode>> &prec,
+                             const ReactionPushOptions &options) {
     std::unique_ptr<SynthesisNode> node{new SynthesisNode()};
     node->index_ = index;
     node->reaction_ = rxn;
     node->precursor_nodes_ = prec;
+
+    std::vector<size_t> sizes;
+    if (!options.lazy) {
+        // Eager nodes keep the odometer order, so that their items do not depend on laziness
+        // being available
+        for (const auto &node : prec) {
+            sizes.push_back(node->size());
+        }
+    }
+    node->pending_.reset(new Pending{
+        .options = options,
+        .known_match_storage = {},
+        .known_matches = {},
+        .cursor = options.lazy ? CellCursor::shells(prec.size())
+                               : CellCursor::odometer(std::move(sizes)),
+    });
+    // Evaluation may outlive the caller's known matches, so keep a copy
+    auto &pending = *node->pending_;
+    for (const auto &known : options.known_matches) {
+        pending.known_match_storage.emplace_back(known.matches.begin(), known.matches.end());
+    }
+    for (size_t i = 0; i < options.known_matches.size(); ++i) {
+        pending.known_matches.push_back(
+            {options.known_matches[i].molecule, pending.known_match_storage[i]});
+    }
+    pending.options.known_matches = pending.known_matches;
     return node;
 }
 
 void SynthesisNode::add_reaction_outcome(const ReactionOutcomeWithReactantAssignment &outcome,
-                                         const std::vector<size_t> &precursor_item_indices) {
-    std::stringstream key_ss;
-    key_ss << outcome.dedup_key() << "|";
-    for (const auto &name : outcome.reactant_names) {
-        key_ss << name << ".";
-    }
-    const auto dedup_key = key_ss.str();
-    if (dedup_keys_.contains(dedup_key)) {
+                                         const std::vector<size_t> &precursor_item_indices) const {
+    if (!dedup_.insert(outcome)) {
         return;
     }
-    dedup_keys_.insert(dedup_key);
     items_.push_back({outcome.main_product(), outcome.reactant_names, precursor_item_indices});
 }
 
+StatusOr<ReactionCache::Value>
+SynthesisNode::compute_outcomes(const std::vector<size_t> &precursor_item_indices) const {
+    const auto &options = pending_->options;
+
+    std::vector<std::shared_ptr<Molecule>> reactants;
+    reactants.reserve(precursor_nodes_.size());
+    for (size_t i = 0; i < precursor_nodes_.size(); ++i) {
+        reactants.push_back(precursor_nodes_[i]->at(precursor_item_indices[i]));
+    }
+
+    // RDKit builds the outcomes of a cell up to the per-call cap, and the node takes what it
+    // needs from them. The items still needed are not passed on: cells of a batch are evaluated
+    // together and deduplicated against each other only when they are merged, so the outcomes of
+    // a cell must not depend on the cells before it.
+    const ReactionApplyOptions apply_options{
+        .ignore_errors = true,
+        .max_raw_outcomes = options.max_outcomes_per_call,
+        .distinct_outcomes = true,
+        .main_product_only = options.main_product_only,
+        .max_heavy_atoms = options.max_heavy_atoms,
+    };
+
+    ReactionCache::Value outcomes;
+    ReactionCache::Key cache_key;
+    if (options.cache != nullptr) {
+        cache_key.reaction = options.cache_key;
+        cache_key.main_product_only = apply_options.main_product_only;
+        cache_key.max_outcomes = apply_options.max_outcomes.value_or(0);
+        cache_key.max_raw_outcomes = apply_options.max_raw_outcomes.value_or(0);
+        cache_key.distinct_outcomes = apply_options.distinct_outcomes;
+        cache_key.max_heavy_atoms =
+            apply_options.max_heavy_atoms.value_or(std::numeric_limits<unsigned int>::max());
+        cache_key.reactants.reserve(reactants.size());
+        for (const auto &reactant : reactants) {
+            cache_key.reactants.push_back(reactant->hash());
+        }
+        outcomes = options.cache->get(cache_key);
+    }
+    if (outcomes == nullptr) {
+        auto applied = reaction_->try_apply(reactants, options.known_matches, apply_options);
+        if (!applied) {
+            return applied.status();
+        }
+        outcomes = options.cache != nullptr
+                       ? options.cache->put(cache_key, std::move(applied).value())
+                       : std::make_shared<const ReactionCache::Outcomes>(
+                             std::move(applied).value());
+    }
+    return outcomes;
+}
+
+StatusOr<std::vector<ReactionCache::Value>>
+SynthesisNode::compute_cells(const std::vector<std::vector<size_t>> &cells) const {
+    const auto &options = pending_->options;
+
+    std::vector<StatusOr<ReactionCache::Value>> results(cells.size(), ReactionCache::Value{});
+    if (cells.size() == 1) {
+        results[0] = compute_outcomes(cells[0]);
+    } else {
+        // Exceptions are unexpected here, e.g. from RDKit, and still reach the caller
+        std::vector<std::exception_ptr> errors(cells.size());
+        auto compute = [&](size_t i) {
+            try {
+                results[i] = compute_outcomes(cells[i]);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        };
+        if (omp_in_parallel() != 0) {
+            // Idle threads of the enclosing team pick up the tasks, e.g. at the end of a
+            // parallel loop over several syntheses
+#pragma omp taskloop grainsize(1)
+            for (size_t i = 0; i < cells.size(); ++i) {
+                compute(i);
+            }
+        } else {
+#pragma omp parallel for schedule(dynamic) num_threads(static_cast<int>(options.num_threads))
+            for (size_t i = 0; i < cells.size(); ++i) {
+                compute(i);
+            }
+        }
+        for (const auto &error : errors) {
+            if (error != nullptr) {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+    std::vector<ReactionCache::Value> outcomes;
+    outcomes.reserve(results.size());
+    for (auto &result : results) {
+        if (!result) {
+            return result.status();
+        }
+        outcomes.push_back(std::move(result).value());
+    }
+    return outcomes;
+}
+
+void SynthesisNode::merge_cells(const std::vector<std::vector<size_t>> &cells,
+                                const std::vector<ReactionCache::Value> &outcomes) const {
+    // Merge in cell order so that items do not depend on how the cells were scheduled
+    for (size_t i = 0; i < cells.size(); ++i) {
+        for (const auto &outcome : *outcomes[i]) {
+            if (items_.size() >= pending_->max_items()) {
+                return;
+            }
+            add_reaction_outcome(outcome, cells[i]);
+        }
+    }
+}
+
+Status SynthesisNode::ensure_locked(std::unique_lock<std::mutex> &lock, size_t n) const {
+    // Cells evaluated together per thread, more of them balance uneven reaction costs better
+    constexpr size_t kCellsPerThread = 4;
+
+    std::vector<std::vector<size_t>> cells;
+    while (status_ && items_.size() < n && pending_ != nullptr) {
+        if (evaluating_) {
+            // Items of the cells taken by the other thread come first
+            evaluated_.wait(lock);
+            continue;
+        }
+        const auto &options = pending_->options;
+        auto limit = std::min(n, pending_->max_items());
+        if (items_.size() >= limit) {
+            pending_.reset();
+            break;
+        }
+        // Most cells produce an outcome, so evaluating more cells than the number of items still
+        // needed would mostly be wasted work
+        auto max_batch_size = options.num_threads > 1 ? options.num_threads * kCellsPerThread : 1;
+        auto batch_size = std::min(limit - items_.size(), max_batch_size);
+
+        cells.clear();
+        auto has_item = [this](size_t i, size_t k) {
+            auto evaluated = precursor_nodes_[i]->try_evaluate(k + 1);
+            if (!evaluated) {
+                status_ = evaluated.status();
+                return false;
+            }
+            return evaluated.value() > k;
+        };
+        while (status_ && cells.size() < batch_size) {
+            const auto *cell = pending_->cursor.next(has_item);
+            if (cell == nullptr) {
+                break;
+            }
+            cells.push_back(*cell);
+        }
+        if (!status_ || cells.empty()) {
+            pending_.reset();
+            break;
+        }
+
+        // Reactions run without the lock, so that readers of evaluated items and OpenMP tasks
+        // that reach this node again are not blocked by them. Only this thread takes cells from
+        // the cursor until the results are merged.
+        evaluating_ = true;
+        lock.unlock();
+        StatusOr<std::vector<ReactionCache::Value>> outcomes = Status::error("not evaluated");
+        std::exception_ptr error;
+        try {
+            outcomes = compute_cells(cells);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        lock.lock();
+        evaluating_ = false;
+        evaluated_.notify_all();
+        if (error != nullptr) {
+            std::rethrow_exception(error);
+        }
+        if (!outcomes) {
+            // The cells are gone from the cursor, so the node cannot be evaluated further
+            status_ = outcomes.status();
+            pending_.reset();
+            break;
+        }
+        merge_cells(cells, outcomes.value());
+    }
+    return status_;
+}
+
+StatusOr<size_t> SynthesisNode::try_evaluate(size_t n) const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto status = ensure_locked(lock, n);
+    if (!status) {
+        return status;
+    }
+    return items_.size();
+}
+
+bool SynthesisNode::ensure(size_t n) const {
+    auto evaluated = try_evaluate(n);
+    if (!evaluated) {
+        throw SynthesisError(evaluated.message());
+    }
+    return evaluated.value() >= n;
+}
+
+size_t SynthesisNode::size() const {
+    auto evaluated = try_evaluate(std::numeric_limits<size_t>::max());
+    if (!evaluated) {
+        throw SynthesisError(evaluated.message());
+    }
+    return evaluated.value();
+}
+
+size_t SynthesisNode::num_evaluated() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return items_.size();
+}
+
+bool SynthesisNode::is_fully_evaluated() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_ == nullptr;
+}
+
+const std::shared_ptr<Molecule> &SynthesisNode::at(size_t i) const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (auto status = ensure_locked(lock, i + 1); !status) {
+        throw SynthesisError(status.message);
+    }
+    return items_.at(i).molecule;
+}
+
 std::vector<SynthesisNode::PrecursorMolecule> SynthesisNode::precursors(size_t index) const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (auto status = ensure_locked(lock, index + 1); !status) {
+        throw SynthesisError(status.message);
+    }
     const auto &item = items_.at(index);
-    std::vector<PrecursorMolecule> result;
+    lock.unlock();
 
+    std::vector<PrecursorMolecule> result;
     for (size_t i = 0; i < precursor_nodes_.size(); ++i) {
         const auto &reactant_name = item.reactant_names.at(i);
         const auto &pre_item_index = item.precursor_item_indices.at(i);
@@ -70,92 +425,71 @@ const std::shared_ptr<SynthesisNode> &Synthesis::stack_top(size_t i) const {
     if (i >= stack_.size()) {
         throw SynthesisError("Stack index out of range");
     }
-    return stack_.at(stack_.size() - 1 - i);
+    return stack_.at(i);
 }
 
 void Synthesis::push(const std::shared_ptr<Molecule> &molecule) {
-    auto new_index = nodes_.size();
-    nodes_.push_back(SynthesisNode::from_molecule(new_index, molecule));
-    stack_.push_back(nodes_.back());
+    std::shared_ptr<SynthesisNode> new_node =
+        SynthesisNode::from_molecule(nodes_.size(), molecule);
+    nodes_ = nodes_.push(new_node);
+    stack_ = stack_.push(std::move(new_node));
 }
 
-static void cartesian_product(const std::vector<size_t> &sizes,
-                              const std::function<bool(const std::vector<size_t> &)> &callback) {
-    std::vector<size_t> indices(sizes.size(), 0);
-    while (true) {
-        if (!callback(indices)) {
-            break;
-        }
-        size_t i = 0;
-        while (i < sizes.size()) {
-            indices[i]++;
-            if (indices[i] < sizes[i]) {
-                break;
-            }
-            indices[i] = 0;
-            i++;
-        }
-        if (i == sizes.size()) {
-            break;
-        }
-    }
-};
-
 void Synthesis::push(const std::shared_ptr<Reaction> &reaction,
                      std::optional<size_t> max_outcomes) {
+    push(reaction, ReactionPushOptions{.max_outcomes = max_outcomes});
+}
+
+void Synthesis::push(const std::shared_ptr<Reaction> &reaction,
+                     const ReactionPushOptions &options) {
+    auto status = try_push(reaction, options);
+    if (!status) {
+        throw SynthesisError(status.message);
+    }
+}
+
+Status Synthesis::try_push(const std::shared_ptr<Reaction> &reaction,
+                           const ReactionPushOptions &options) {
     if (stack_.size() < reaction->num_reactants()) {
-        throw SynthesisError("Not enough reactants on the stack for the reaction, got " +
+        return Status::error("Not enough reactants on the stack for the reaction, got " +
                              std::to_string(stack_.size()) + " but need " +
                              std::to_string(reaction->num_reactants()));
     }
 
     std::vector<std::shared_ptr<SynthesisNode>> precursor_nodes;
     precursor_nodes.reserve(reaction->num_reactants());
-    std::vector<size_t> sizes;
-    auto stack_iter = stack_.end();
     for (size_t i = 0; i < reaction->num_reactants(); ++i) {
-        const auto &node = *(--stack_iter);
-        precursor_nodes.push_back(node);
-        sizes.push_back(node->size());
+        precursor_nodes.push_back(stack_.at(i));
     }
 
     auto new_index = nodes_.size();
-    auto new_node = SynthesisNode::from_reaction(new_index, reaction, precursor_nodes);
-    cartesian_product(sizes, [&](const std::vector<size_t> &item_indices) -> bool {
-        std::vector<std::shared_ptr<Molecule>> reactants;
-        reactants.reserve(precursor_nodes.size());
-        for (size_t i = 0; i < precursor_nodes.size(); ++i) {
-            reactants.push_back(precursor_nodes.at(i)->at(item_indices.at(i)));
-        }
-        auto outcomes = reaction->apply(reactants, /*ignore_errors=*/true);
-        for (const auto &outcome : outcomes) {
-            new_node->add_reaction_outcome(outcome, item_indices);
-            if (max_outcomes.has_value() && new_node->size() >= max_outcomes.value()) {
-                return false;
-            }
-        }
-        return true;
-    });
-
-    if (new_node->size() == 0) {
-        throw SynthesisError("The reaction did not produce any products.");
+    std::shared_ptr<SynthesisNode> new_node =
+        SynthesisNode::from_reaction(new_index, reaction, precursor_nodes, options);
+    auto evaluated =
+        new_node->try_evaluate(options.lazy ? 1 : std::numeric_limits<size_t>::max());
+    if (!evaluated) {
+        return evaluated.status();
+    }
+    if (evaluated.value() == 0) {
+        return Status::error("The reaction did not produce any products.");
     }
 
-    nodes_.push_back(std::move(new_node));
-    stack_.erase(stack_iter, stack_.end());
-    stack_.push_back(nodes_.back());
+    nodes_ = nodes_.push(new_node);
+    stack_ = stack_.pop(reaction->num_reactants()).push(std::move(new_node));
+    return Status::ok();
 }
 
 void Synthesis::undo() {
     if (stack_.empty()) {
         throw SynthesisError("Cannot undo because the stack is empty");
     }
-    auto top_node = stack_.back();
-    stack_.pop_back();
-    nodes_.pop_back();
+    auto top_node = stack_.top();
+    auto stack = stack_.pop();
     for (const auto &it : std::ranges::reverse_view(top_node->precursor_nodes())) {
-        stack_.push_back(it);
+        stack = stack.push(it);
     }
+    stack_ = std::move(stack);
+    nodes_ = nodes_.pop();
 }
 
 } // namespace prexsyn
@@ -1,15 +1,25 @@
 #pragma once
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <optional>
-#include <set>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "../utility/hash.hpp"
+#include "../utility/persistent_stack.hpp"
+#include "../utility/status.hpp"
 #include "molecule.hpp"
 #include "reaction.hpp"
+#include "reaction_cache.hpp"
 
 namespace prexsyn {
 
@@ -18,6 +28,47 @@ public:
     explicit SynthesisError(const std::string &message) : std::runtime_error(message) {}
 };
 
+struct ReactionPushOptions {
+    std::optional<size_t> max_outcomes = std::nullopt;
+    // Hard cap on the outcomes RDKit builds for one reactant combination. Outcomes past the cap
+    // are lost, so the items can differ from an uncapped push.
+    std::optional<size_t> max_outcomes_per_call = std::nullopt;
+    // Optional shared cache of reaction outcomes, cache_key identifies the reaction in it. Nodes
+    // that are evaluated lazily keep it alive.
+    std::shared_ptr<ReactionCache> cache = nullptr;
+    std::uint64_t cache_key = 0;
+    // Template matches of reactants that the caller has already computed
+    std::span<const Reaction::KnownMatches> known_matches = {};
+    // Only evaluate the first item on push, the rest on demand
+    bool lazy = false;
+    // See ReactionApplyOptions, nodes only keep the main product anyway
+    bool main_product_only = false;
+    // See ReactionApplyOptions
+    std::optional<unsigned int> max_heavy_atoms = std::nullopt;
+    // Reactant combinations evaluated concurrently, as OpenMP tasks when called from inside a
+    // parallel region. Items and their order do not depend on this.
+    size_t num_threads = 1;
+};
+
+// Outcomes seen by a node, keyed by their product multiset and reactant assignment. Lookups go
+// through a 64-bit hash, and hash hits are confirmed against the full key.
+class OutcomeDeduplicator {
+private:
+    HashIndex index_;
+    std::vector<std::string> keys_;
+
+public:
+    static std::uint64_t hash(const ReactionOutcomeWithReactantAssignment &);
+    static std::string key(const ReactionOutcomeWithReactantAssignment &);
+
+    // Returns false if an equal outcome was inserted before
+    bool insert(const ReactionOutcomeWithReactantAssignment &outcome) {
+        return insert(hash(outcome), outcome);
+    }
+    bool insert(std::uint64_t hash, const ReactionOutcomeWithReactantAssignment &);
+    size_t size() const { return keys_.size(); }
+};
+
 class SynthesisNode {
 private:
     struct Item {
@@ -26,28 +77,97 @@ private:
         std::vector<size_t> precursor_item_indices;
     };
 
+    // Walks the cartesian product of precursor items. Eagerly evaluated nodes know the precursor
+    // sizes up front and walk it in odometer order, first precursor fastest. Lazy nodes walk it in
+    // shells of increasing maximum index, so the first items of all precursors are combined
+    // before later ones, and discover precursor sizes along the way, which allows precursors to
+    // be evaluated lazily as well.
+    class CellCursor {
+        std::vector<size_t> available_;
+        std::vector<size_t> cell_;
+        bool shells_ = false;
+        size_t shell_ = 0;
+        bool in_shell_ = false;
+        bool exhausted_ = false;
+
+        CellCursor(std::vector<size_t> available, bool shells)
+            : available_(std::move(available)), cell_(available_.size(), 0), shells_(shells) {}
+        bool advance();
+
+    public:
+        static CellCursor odometer(std::vector<size_t> sizes) {
+            return {std::move(sizes), false};
+        }
+        static CellCursor shells(size_t num_dims) {
+            return {std::vector<size_t>(num_dims, 0), true};
+        }
+        // has_item(i, k) tells whether precursor i has an item at index k, only asked in shell
+        // order
+        const std::vector<size_t> *next(const std::function<bool(size_t, size_t)> &has_item);
+    };
+
+    // Reaction cells not evaluated yet
+    struct Pending {
+        ReactionPushOptions options;
+        std::vector<std::vector<Reaction::ReactantMatch>> known_match_storage;
+        std::vector<Reaction::KnownMatches> known_matches;
+        CellCursor cursor;
+
+        // A node keeps its first item even when max_outcomes is zero, as it always has
+        size_t max_items() const {
+            return std::max<size_t>(options.max_outcomes.value_or(SIZE_MAX), 1);
+        }
+    };
+
     size_t index_{};
-    std::vector<Item> items_;
     std::shared_ptr<Reaction> reaction_;
     std::vector<std::shared_ptr<SynthesisNode>> precursor_nodes_;
-    std::set<std::string> dedup_keys_;
+
+    // Items are appended on demand, a deque keeps references to earlier items valid
+    mutable std::mutex mutex_;
+    // Set while a thread evaluates cells with the mutex released
+    mutable bool evaluating_ = false;
+    mutable std::condition_variable evaluated_;
+    // Error that stopped the evaluation, items evaluated before it are kept
+    mutable Status status_ = Status::ok();
+    mutable std::deque<Item> items_;
+    mutable OutcomeDeduplicator dedup_;
+    mutable std::unique_ptr<Pending> pending_;
 
     SynthesisNode() = default;
 
+    void add_reaction_outcome(const ReactionOutcomeWithReactantAssignment &outcome,
+                              const std::vector<size_t> &precursor_item_indices) const;
+    StatusOr<ReactionCache::Value>
+    compute_outcomes(const std::vector<size_t> &precursor_item_indices) const;
+    StatusOr<std::vector<ReactionCache::Value>>
+    compute_cells(const std::vector<std::vector<size_t>> &cells) const;
+    void merge_cells(const std::vector<std::vector<size_t>> &cells,
+                     const std::vector<ReactionCache::Value> &outcomes) const;
+    Status ensure_locked(std::unique_lock<std::mutex> &lock, size_t n) const;
+
 public:
     static std::unique_ptr<SynthesisNode> from_molecule(size_t index,
                                                         const std::shared_ptr<Molecule> &);
     static std::unique_ptr<SynthesisNode>
     from_reaction(size_t index, const std::shared_ptr<Reaction> &,
-                  const std::vector<std::shared_ptr<SynthesisNode>> &);
-
-    void add_reaction_outcome(const ReactionOutcomeWithReactantAssignment &outcome,
-                              const std::vector<size_t> &precursor_item_indices);
+                  const std::vector<std::shared_ptr<SynthesisNode>> &,
+                  const ReactionPushOptions & = {});
 
     size_t index() const { return index_; }
-    size_t size() const { return items_.size(); }
+    // Evaluates until the node has at least n items or nothing is left, returns the number of
+    // items evaluated. Errors are reported through the status and again by later calls.
+    StatusOr<size_t> try_evaluate(size_t n) const;
+    // Evaluates until the node has at least n items or nothing is left, returns size() >= n
+    bool ensure(size_t n) const;
+    // Evaluates the node fully
+    size_t size() const;
+    size_t num_evaluated() const;
+    bool is_fully_evaluated() const;
+    // Null for building block nodes
+    const std::shared_ptr<Reaction> &reaction() const { return reaction_; }
     const auto &precursor_nodes() const { return precursor_nodes_; }
-    const std::shared_ptr<Molecule> &at(size_t i) const { return items_.at(i).molecule; }
+    const std::shared_ptr<Molecule> &at(size_t i) const;
 
     struct PrecursorMolecule {
         size_t precursor_index;
@@ -59,18 +179,25 @@ public:
     std::vector<PrecursorMolecule> precursors(size_t index) const;
 };
 
+// Nodes are never modified once pushed and both the node list and the stack are persistent, so
+// copying a synthesis is O(1) and the copy is not affected by later pushes or undos.
 class Synthesis {
 private:
-    std::vector<std::shared_ptr<SynthesisNode>> nodes_;
-    std::vector<std::shared_ptr<SynthesisNode>> stack_;
+    PersistentStack<std::shared_ptr<SynthesisNode>> nodes_;
+    PersistentStack<std::shared_ptr<SynthesisNode>> stack_;
 
 public:
-    const std::vector<std::shared_ptr<SynthesisNode>> &nodes() const { return nodes_; }
+    // In the order they were pushed
+    std::vector<std::shared_ptr<SynthesisNode>> nodes() const { return nodes_.to_vector(); }
+    size_t num_nodes() const { return nodes_.size(); }
     size_t stack_size() const { return stack_.size(); }
     const std::shared_ptr<SynthesisNode> &stack_top(size_t i = 0) const;
 
     void push(const std::shared_ptr<Molecule> &);
     void push(const std::shared_ptr<Reaction> &, std::optional<size_t> max_outcomes);
+    void push(const std::shared_ptr<Reaction> &, const ReactionPushOptions &);
+    // Like push(), but reports a reaction that cannot be applied through the returned status
+    Status try_push(const std::shared_ptr<Reaction> &, const ReactionPushOptions &);
     void undo();
 };
 
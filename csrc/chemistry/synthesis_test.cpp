@@ -11,7 +11,10 @@
 namespace {
 
 using prexsyn::Molecule;
+using prexsyn::OutcomeDeduplicator;
 using prexsyn::Reaction;
+using prexsyn::ReactionOutcomeWithReactantAssignment;
+using prexsyn::ReactionCache;
 using prexsyn::Synthesis;
 using prexsyn::SynthesisError;
 
@@ -60,6 +63,265 @@ TEST(SynthesisTest, PushReactionBuildsExpectedTopNodeAndPrecursors) {
     EXPECT_EQ(precursors.at(1).molecule->smiles(), reactant_a->smiles());
 }
 
+TEST(SynthesisTest, PushReactionReusesCachedOutcomes) {
+    const auto cache = std::make_shared<ReactionCache>(16);
+    const auto reaction = make_test_reaction();
+
+    for (int i = 0; i < 2; ++i) {
+        Synthesis synthesis;
+        synthesis.push(make_reactant_a());
+        synthesis.push(make_reactant_b());
+        synthesis.push(reaction, {.max_outcomes = std::nullopt, .cache = cache, .cache_key = 0});
+
+        ASSERT_EQ(synthesis.stack_top()->size(), 1);
+        EXPECT_EQ(synthesis.stack_top()->at(0)->smiles(), kExpectedProductSmiles);
+    }
+
+    const auto stats = cache->stats();
+    EXPECT_EQ(stats.misses, 1);
+    EXPECT_EQ(stats.hits, 1);
+}
+
+TEST(SynthesisTest, LazyPushEvaluatesItemsOnDemand) {
+    // Chlorinating either methyl group gives two intermediates, each brominated into one product
+    const std::shared_ptr<Reaction> chlorination = Reaction::from_smarts("[CH3:1]>>[C:1]Cl", {"A"});
+    const std::shared_ptr<Reaction> bromination = Reaction::from_smarts("[C:1]Cl>>[C:1]Br", {"A"});
+
+    auto build = [&](bool lazy) {
+        Synthesis synthesis;
+        synthesis.push(Molecule::from_smiles("CC(=O)CCC"));
+        synthesis.push(chlorination, std::nullopt);
+        synthesis.push(bromination, {.max_outcomes = std::nullopt, .lazy = lazy});
+        return synthesis;
+    };
+
+    const auto eager = build(false);
+    const auto &eager_top = eager.stack_top();
+    EXPECT_TRUE(eager_top->is_fully_evaluated());
+    ASSERT_EQ(eager_top->num_evaluated(), 2);
+
+    const auto lazy = build(true);
+    const auto &lazy_top = lazy.stack_top();
+    EXPECT_FALSE(lazy_top->is_fully_evaluated());
+    EXPECT_EQ(lazy_top->num_evaluated(), 1);
+
+    ASSERT_EQ(lazy_top->size(), eager_top->size());
+    EXPECT_TRUE(lazy_top->is_fully_evaluated());
+    for (size_t i = 0; i < eager_top->size(); ++i) {
+        EXPECT_EQ(lazy_top->at(i)->smiles(), eager_top->at(i)->smiles());
+        EXPECT_EQ(lazy_top->precursors(i).at(0).item_index,
+                  eager_top->precursors(i).at(0).item_index);
+    }
+}
+
+TEST(SynthesisTest, EagerPushKeepsOdometerOrderAndLazyPushGoesByShells) {
+    const std::shared_ptr<Reaction> chlorination = Reaction::from_smarts("[CH3:1]>>[C:1]Cl", {"A"});
+    const std::shared_ptr<Reaction> coupling =
+        Reaction::from_smarts("[C:1]Cl.[C:2]Cl>>[C:1][C:2]", {"A", "B"});
+
+    // Precursor item indices of each item, combinations that give several items counted once
+    auto cells = [&](bool lazy) {
+        Synthesis synthesis;
+        synthesis.push(Molecule::from_smiles("CC(=O)CCC"));
+        synthesis.push(chlorination, std::nullopt);
+        synthesis.push(Molecule::from_smiles("CCC(C)(O)CCCC"));
+        synthesis.push(chlorination, std::nullopt);
+        synthesis.push(coupling, {.max_outcomes = std::nullopt, .lazy = lazy});
+        std::vector<std::vector<size_t>> result;
+        const auto &top = synthesis.stack_top();
+        for (size_t i = 0; i < top->size(); ++i) {
+            std::vector<size_t> cell;
+            for (const auto &precursor : top->precursors(i)) {
+                cell.push_back(precursor.item_index);
+            }
+            if (result.empty() || result.back() != cell) {
+                result.push_back(cell);
+            }
+        }
+        return result;
+    };
+
+    const std::vector<std::vector<size_t>> odometer{{0, 0}, {1, 0}, {2, 0},
+                                                    {0, 1}, {1, 1}, {2, 1}};
+    const std::vector<std::vector<size_t>> shells{{0, 0}, {1, 0}, {0, 1},
+                                                  {1, 1}, {2, 0}, {2, 1}};
+    EXPECT_EQ(cells(false), odometer);
+    EXPECT_EQ(cells(true), shells);
+}
+
+TEST(SynthesisTest, ZeroMaxOutcomesKeepsFirstItem) {
+    const std::shared_ptr<Reaction> chlorination = Reaction::from_smarts("[CH3:1]>>[C:1]Cl", {"A"});
+    for (bool lazy : {false, true}) {
+        Synthesis synthesis;
+        synthesis.push(Molecule::from_smiles("CC(=O)CCC"));
+        ASSERT_NO_THROW(synthesis.push(chlorination, {.max_outcomes = 0, .lazy = lazy}));
+        EXPECT_EQ(synthesis.stack_top()->size(), 1);
+    }
+}
+
+TEST(SynthesisTest, PerCallCapCountsOnlyDistinctOutcomes) {
+    // The first two methyl groups are equivalent, so RDKit's first two outcomes are equal
+    const std::shared_ptr<Reaction> chlorination = Reaction::from_smarts("[CH3:1]>>[C:1]Cl", {"A"});
+    auto build = [&](std::optional<size_t> max_outcomes_per_call) {
+        Synthesis synthesis;
+        synthesis.push(Molecule::from_smiles("CC(C)CC(=O)CCC"));
+        synthesis.push(chlorination, {.max_outcomes = 2,
+                                      .max_outcomes_per_call = max_outcomes_per_call});
+        std::vector<std::string> smiles;
+        for (size_t i = 0; i < synthesis.stack_top()->size(); ++i) {
+            smiles.push_back(synthesis.stack_top()->at(i)->smiles());
+        }
+        return smiles;
+    };
+
+    const auto uncapped = build(std::nullopt);
+    ASSERT_EQ(uncapped.size(), 2);
+    EXPECT_EQ(build(8), uncapped);
+}
+
+TEST(SynthesisTest, LazyNodeKeepsReactionCacheAlive) {
+    const std::shared_ptr<Reaction> chlorination = Reaction::from_smarts("[CH3:1]>>[C:1]Cl", {"A"});
+    const std::shared_ptr<Reaction> bromination = Reaction::from_smarts("[C:1]Cl>>[C:1]Br", {"A"});
+    auto cache = std::make_shared<ReactionCache>(16);
+    const std::weak_ptr<ReactionCache> weak_cache = cache;
+
+    Synthesis synthesis;
+    synthesis.push(Molecule::from_smiles("CC(=O)CCC"));
+    synthesis.push(chlorination, std::nullopt);
+    synthesis.push(bromination,
+                   {.max_outcomes = std::nullopt, .cache = cache, .cache_key = 1, .lazy = true});
+    ASSERT_FALSE(synthesis.stack_top()->is_fully_evaluated());
+
+    // The owner disables the cache while the node still has items to evaluate
+    cache.reset();
+    EXPECT_FALSE(weak_cache.expired());
+    EXPECT_EQ(synthesis.stack_top()->size(), 2);
+    EXPECT_TRUE(weak_cache.expired());
+}
+
+TEST(SynthesisTest, ParallelPushMatchesSerialPush) {
+    const std::shared_ptr<Reaction> chlorination = Reaction::from_smarts("[CH3:1]>>[C:1]Cl", {"A"});
+    const std::shared_ptr<Reaction> coupling =
+        Reaction::from_smarts("[C:1]Cl.[C:2]Cl>>[C:1][C:2]", {"A", "B"});
+
+    auto build = [&](std::optional<size_t> max_outcomes, size_t num_threads) {
+        Synthesis synthesis;
+        synthesis.push(Molecule::from_smiles("CC(C)CC(=O)CCC"));
+        synthesis.push(chlorination, std::nullopt);
+        synthesis.push(Molecule::from_smiles("CCC(C)CCN"));
+        synthesis.push(chlorination, std::nullopt);
+        synthesis.push(coupling, {.max_outcomes = max_outcomes, .num_threads = num_threads});
+        std::vector<std::string> smiles;
+        for (size_t i = 0; i < synthesis.stack_top()->size(); ++i) {
+            smiles.push_back(synthesis.stack_top()->at(i)->smiles());
+        }
+        return smiles;
+    };
+
+    for (auto max_outcomes : {std::optional<size_t>{}, std::optional<size_t>{2}}) {
+        const auto serial = build(max_outcomes, 1);
+        ASSERT_FALSE(serial.empty());
+        EXPECT_EQ(build(max_outcomes, 4), serial);
+
+        // Nested in a parallel region the cells are evaluated as tasks
+        std::vector<std::vector<std::string>> nested(4);
+#pragma omp parallel for
+        for (size_t i = 0; i < nested.size(); ++i) {
+            nested[i] = build(max_outcomes, 4);
+        }
+        for (const auto &result : nested) {
+            EXPECT_EQ(result, serial);
+        }
+    }
+}
+
+TEST(SynthesisTest, CappedPushDoesNotDependOnThreadCount) {
+    // Both precursors hold the same chlorides, so cells that swap them repeat each other's
+    // products and are dropped when the cells are merged
+    const std::shared_ptr<Reaction> chlorination = Reaction::from_smarts("[CH3:1]>>[C:1]Cl", {"A"});
+    const std::shared_ptr<Reaction> coupling =
+        Reaction::from_smarts("[C:1]Cl.[C:2]Cl>>[C:1][C:2]", {"A", "B"});
+
+    auto build = [&](size_t num_threads) {
+        Synthesis synthesis;
+        for (int i = 0; i < 2; ++i) {
+            synthesis.push(Molecule::from_smiles("CC(C)CC(=O)CCC"));
+            synthesis.push(chlorination, std::nullopt);
+        }
+        synthesis.push(coupling, {.max_outcomes = 3,
+                                  .max_outcomes_per_call = 2,
+                                  .num_threads = num_threads});
+        const auto &top = synthesis.stack_top();
+        top->ensure(3);
+        std::vector<std::string> smiles;
+        for (size_t i = 0; i < top->num_evaluated(); ++i) {
+            smiles.push_back(top->at(i)->smiles());
+        }
+        return smiles;
+    };
+
+    const auto serial = build(1);
+    ASSERT_EQ(serial.size(), 3);
+    EXPECT_EQ(build(4), serial);
+}
+
+TEST(SynthesisTest, LazyNodeSharedByThreadsKeepsItemOrder) {
+    const std::shared_ptr<Reaction> chlorination = Reaction::from_smarts("[CH3:1]>>[C:1]Cl", {"A"});
+    const std::shared_ptr<Reaction> coupling =
+        Reaction::from_smarts("[C:1]Cl.[C:2]Cl>>[C:1][C:2]", {"A", "B"});
+
+    auto build = [&](bool lazy) {
+        Synthesis synthesis;
+        synthesis.push(Molecule::from_smiles("CC(C)CC(=O)CCC"));
+        synthesis.push(chlorination, std::nullopt);
+        synthesis.push(Molecule::from_smiles("CCC(C)CCN"));
+        synthesis.push(chlorination, std::nullopt);
+        synthesis.push(coupling, {.max_outcomes = std::nullopt, .lazy = lazy, .num_threads = 4});
+        return synthesis;
+    };
+    const auto lazy = build(true);
+    const auto &top = lazy.stack_top();
+    std::vector<std::string> expected;
+    {
+        const auto copy = build(true);
+        for (size_t i = 0; i < copy.stack_top()->size(); ++i) {
+            expected.push_back(copy.stack_top()->at(i)->smiles());
+        }
+    }
+
+    // Threads ask for items in different order, each evaluating with nested tasks
+    std::vector<std::string> actual(expected.size());
+#pragma omp parallel for schedule(dynamic, 1)
+    for (size_t k = 0; k < actual.size(); ++k) {
+        auto i = actual.size() - 1 - k;
+        actual[i] = top->at(i)->smiles();
+    }
+    EXPECT_EQ(actual, expected);
+    EXPECT_EQ(top->size(), expected.size());
+}
+
+TEST(SynthesisTest, OutcomeDeduplicatorKeepsCollidingOutcomesApart) {
+    // Same main product and reactant names, different side products
+    ReactionOutcomeWithReactantAssignment with_water;
+    with_water.products = {Molecule::from_smiles("CCN"), Molecule::from_smiles("O")};
+    with_water.reactant_names = {"A"};
+    ReactionOutcomeWithReactantAssignment with_methanol;
+    with_methanol.products = {Molecule::from_smiles("CCN"), Molecule::from_smiles("CO")};
+    with_methanol.reactant_names = {"A"};
+
+    // Force a hash collision between the two outcomes
+    OutcomeDeduplicator dedup;
+    EXPECT_TRUE(dedup.insert(42, with_water));
+    EXPECT_TRUE(dedup.insert(42, with_methanol));
+    EXPECT_FALSE(dedup.insert(42, with_water));
+    EXPECT_FALSE(dedup.insert(42, with_methanol));
+    EXPECT_EQ(dedup.size(), 2);
+
+    OutcomeDeduplicator hashed;
+    EXPECT_TRUE(hashed.insert(with_water));
+    EXPECT_FALSE(hashed.insert(with_water));
+}
+
 TEST(SynthesisTest, PushReactionThrowsWhenStackHasTooFewReactants) {
     Synthesis synthesis;
     synthesis.push(make_reactant_a());
@@ -75,6 +337,18 @@ TEST(SynthesisTest, PushReactionThrowsWhenReactionDoesNotProduceAnyProducts) {
     EXPECT_THROW({ synthesis.push(make_test_reaction(), std::nullopt); }, SynthesisError);
 }
 
+TEST(SynthesisTest, TryPushReportsFailureWithoutChangingTheStack) {
+    Synthesis synthesis;
+    synthesis.push(make_non_matching_reactant());
+    synthesis.push(make_non_matching_reactant());
+
+    const auto status = synthesis.try_push(make_test_reaction(), {});
+    EXPECT_FALSE(status);
+    EXPECT_EQ(status.message, "The reaction did not produce any products.");
+    EXPECT_EQ(synthesis.stack_size(), 2);
+    EXPECT_EQ(synthesis.num_nodes(), 2);
+}
+
 TEST(SynthesisTest, UndoRestoresPrecursorNodesInOriginalStackOrder) {
     Synthesis synthesis;
     const auto reactant_a = make_reactant_a();
@@ -96,6 +370,26 @@ TEST(SynthesisTest, UndoRestoresPrecursorNodesInOriginalStackOrder) {
     EXPECT_EQ(synthesis.stack_top(1)->at(0)->smiles(), reactant_a->smiles());
 }
 
+TEST(SynthesisTest, CopyIsUnaffectedByLaterPushAndUndo) {
+    Synthesis synthesis;
+    synthesis.push(make_reactant_a());
+    synthesis.push(make_reactant_b());
+    synthesis.push(make_test_reaction(), std::nullopt);
+
+    const auto snapshot = synthesis;
+    synthesis.undo();
+    synthesis.push(make_non_matching_reactant());
+
+    EXPECT_EQ(synthesis.stack_size(), 3);
+    EXPECT_EQ(synthesis.num_nodes(), 3);
+    ASSERT_EQ(snapshot.stack_size(), 1);
+    ASSERT_EQ(snapshot.num_nodes(), 3);
+    EXPECT_EQ(snapshot.stack_top()->at(0)->smiles(), kExpectedProductSmiles);
+    EXPECT_EQ(snapshot.nodes().back(), snapshot.stack_top());
+    // The precursor nodes are shared rather than copied
+    EXPECT_EQ(snapshot.stack_top()->precursor_nodes().at(0), synthesis.stack_top(1));
+}
+
 TEST(SynthesisTest, PrecursorMoleculesThrowsOnInvalidItemIndex) {
     Synthesis synthesis;
     synthesis.push(make_reactant_a());
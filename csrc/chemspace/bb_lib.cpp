@@ -4,10 +4,14 @@
 #include <istream>
 #include <memory>
 #include <ostream>
+#include <set>
+#include <span>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <utility>
 
+#include "../utility/chunked_archive.hpp"
 #include "../utility/serialization.hpp"
 
 namespace prexsyn::chemspace {
@@ -21,6 +25,8 @@ std::unique_ptr<BuildingBlockLibrary> BuildingBlockLibrary::deserialize(std::ist
     for (size_t i = 0; i < num_items; ++i) {
         BuildingBlockItem item;
         ia >> item;
+        // Molecules stay serialized until they are first accessed
+        item.molecule.attach(bb_lib->molecule_cache_.get(), i);
         bb_lib->building_blocks_.push_back(std::move(item));
     }
     ia >> bb_lib->identifier_to_index_;
@@ -36,6 +42,30 @@ void BuildingBlockLibrary::serialize(std::ostream &stream) const {
     oa << identifier_to_index_;
 }
 
+std::unique_ptr<BuildingBlockLibrary>
+BuildingBlockLibrary::deserialize_chunked(std::istream &data) {
+    auto bb_lib = std::make_unique<BuildingBlockLibrary>();
+    bb_lib->building_blocks_ = read_chunked<BuildingBlockItem>(data);
+    for (size_t i = 0; i < bb_lib->building_blocks_.size(); ++i) {
+        // Molecules stay serialized until they are first accessed
+        bb_lib->building_blocks_[i].molecule.attach(bb_lib->molecule_cache_.get(), i);
+    }
+    std::istringstream is(read_section(data));
+    boost::archive::binary_iarchive ia(is);
+    ia >> bb_lib->identifier_to_index_;
+    return bb_lib;
+}
+
+void BuildingBlockLibrary::serialize_chunked(std::ostream &stream) const {
+    write_chunked(stream, std::span<const BuildingBlockItem>(building_blocks_));
+    std::ostringstream os;
+    {
+        boost::archive::binary_oarchive oa(os);
+        oa << identifier_to_index_;
+    }
+    write_section(stream, std::move(os).str());
+}
+
 const BuildingBlockItem &BuildingBlockLibrary::get(Index index) const {
     if (index >= building_blocks_.size()) {
         throw std::out_of_range("Building block index out of range");
@@ -51,14 +81,35 @@ const BuildingBlockItem &BuildingBlockLibrary::get(const std::string &identifier
     return building_blocks_[it->second];
 }
 
-BuildingBlockLibrary::Index BuildingBlockLibrary::add(const BuildingBlockEntry &entry) {
-    if (identifier_to_index_.contains(entry.identifier)) {
-        throw BuildingBlockLibraryError("duplicate identifier: " + entry.identifier);
+BuildingBlockLibrary::Index BuildingBlockLibrary::insert(BuildingBlockItem item) {
+    if (identifier_to_index_.contains(item.identifier)) {
+        throw BuildingBlockLibraryError("duplicate identifier: " + item.identifier);
     }
-    auto new_index = building_blocks_.size();
-    building_blocks_.push_back(BuildingBlockItem{entry, new_index});
-    identifier_to_index_[entry.identifier] = new_index;
-    return new_index;
+    item.index = building_blocks_.size();
+    item.molecule.attach(molecule_cache_.get(), item.index);
+    identifier_to_index_[item.identifier] = item.index;
+    building_blocks_.push_back(std::move(item));
+    return building_blocks_.back().index;
+}
+
+BuildingBlockLibrary::Index BuildingBlockLibrary::add(const BuildingBlockEntry &entry) {
+    // Library molecules are read concurrently by workers, canonicalize before publishing them
+    entry.molecule->smiles();
+    return insert({
+        .molecule = entry.molecule,
+        .identifier = entry.identifier,
+        .labels = entry.labels,
+    });
+}
+
+BuildingBlockLibrary::Index BuildingBlockLibrary::add_serialized(LazyMolecule molecule,
+                                                                 std::string identifier,
+                                                                 std::set<std::string> labels) {
+    return insert({
+        .molecule = std::move(molecule),
+        .identifier = std::move(identifier),
+        .labels = std::move(labels),
+    });
 }
 
 } // namespace prexsyn::chemspace
@@ -8,9 +8,13 @@
 #include <set>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include <boost/serialization/version.hpp>
+
 #include "../chemistry/chemistry.hpp"
+#include "molecule_cache.hpp"
 
 namespace prexsyn::chemspace {
 
@@ -25,16 +29,28 @@ struct BuildingBlockEntry {
     std::set<std::string> labels;
 };
 
-struct BuildingBlockItem : BuildingBlockEntry {
+struct BuildingBlockItem {
+    // Resident for building blocks added from molecules, decoded on access for deserialized ones
+    LazyMolecule molecule;
+    std::string identifier;
+    std::set<std::string> labels;
     size_t index{};
 
-    template <typename Archive> void serialize(Archive &ar, const unsigned int /* version */) {
+    template <typename Archive> void serialize(Archive &ar, const unsigned int version) {
         if constexpr (Archive::is_saving::value) {
-            ar << molecule->serialize();
+            ar << molecule.pickle();
+            ar << molecule.smiles();
         } else {
             std::string mol_data;
             ar >> mol_data;
-            molecule = Molecule::deserialize(mol_data);
+            if (version >= 1) {
+                // Written from a sanitized molecule together with its canonical SMILES
+                std::string smiles;
+                ar >> smiles;
+                molecule = LazyMolecule(std::move(mol_data), std::move(smiles));
+            } else {
+                molecule = std::shared_ptr<Molecule>(Molecule::deserialize(mol_data));
+            }
         }
         ar & identifier;
         ar & labels;
@@ -49,20 +65,37 @@ public:
 private:
     std::vector<BuildingBlockItem> building_blocks_;
     std::map<std::string, Index> identifier_to_index_;
+    std::shared_ptr<MoleculeCache> molecule_cache_ = std::make_shared<MoleculeCache>();
+
+    Index insert(BuildingBlockItem);
 
 public:
     BuildingBlockLibrary() = default;
 
     static std::unique_ptr<BuildingBlockLibrary> deserialize(std::istream &);
     void serialize(std::ostream &) const;
+    // Form used by ChemicalSpace, with items in chunks that are encoded and decoded in parallel
+    static std::unique_ptr<BuildingBlockLibrary> deserialize_chunked(std::istream &);
+    void serialize_chunked(std::ostream &) const;
 
     size_t size() const { return building_blocks_.size(); }
     const BuildingBlockItem &get(Index) const;
     const BuildingBlockItem &get(const std::string &) const;
     Index add(const BuildingBlockEntry &);
+    // Adds a building block that is decoded on first access, see LazyMolecule
+    Index add_serialized(LazyMolecule molecule, std::string identifier,
+                         std::set<std::string> labels);
+    void reserve(size_t capacity) { building_blocks_.reserve(capacity); }
+
+    // Decoded building blocks, shared by copies of this library
+    MoleculeCache &molecule_cache() const { return *molecule_cache_; }
+    // Keeps a frequently used building block decoded for good
+    void pin(Index index) const { get(index).molecule.pin(); }
 
     auto begin() const noexcept { return building_blocks_.begin(); }
     auto end() const noexcept { return building_blocks_.end(); }
 };
 
 } // namespace prexsyn::chemspace
+
+BOOST_CLASS_VERSION(prexsyn::chemspace::BuildingBlockItem, 1)
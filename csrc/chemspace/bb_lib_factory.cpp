@@ -1,14 +1,23 @@
 #include "bb_lib_factory.hpp"
 
+#include <array>
 #include <cstddef>
+#include <exception>
 #include <filesystem>
+#include <fstream>
+#include <future>
+#include <istream>
 #include <memory>
+#include <optional>
 #include <set>
+#include <stdexcept>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <GraphMol/FileParsers/MolSupplier.h>
 #include <GraphMol/FileParsers/MolSupplier.v1API.h>
+#include <RDStreams/streams.h>
 #include <csv.hpp>
 
 #include "../chemistry/chemistry.hpp"
@@ -33,81 +42,180 @@ struct identifier_deduplicator {
     }
 };
 
-std::unique_ptr<BuildingBlockLibrary>
-bb_lib_from_sdf(const std::filesystem::path &path, const BuildingBlockPreprocessor &preprocessor) {
+// Records are read in batches. The next batch is read while the workers parse the current one, and
+// the parsed batch is committed in file order, so the library and the renamed duplicates are the
+// same as if the file was loaded record by record.
+static constexpr size_t kLoaderBatchSize = 4096;
+
+static bool is_gzip(const std::filesystem::path &path) {
+    std::ifstream file(path, std::ios::binary);
+    std::array<char, 2> magic{};
+    file.read(magic.data(), magic.size());
+    return file && static_cast<unsigned char>(magic[0]) == 0x1f &&
+           static_cast<unsigned char>(magic[1]) == 0x8b;
+}
+
+static std::unique_ptr<std::istream> open_input(const std::filesystem::path &path) {
+    if (!std::filesystem::is_regular_file(path)) {
+        throw std::runtime_error("Cannot open file: " + path.string());
+    }
+    if (is_gzip(path)) {
+#ifdef RDK_USE_BOOST_IOSTREAMS
+        return std::make_unique<RDKit::gzstream>(path.string());
+#else
+        throw std::runtime_error("Built without gzip support: " + path.string());
+#endif
+    }
+    return std::make_unique<std::ifstream>(path, std::ios::binary);
+}
+
+struct ParsedBuildingBlock {
+    std::shared_ptr<Molecule> molecule;
+    std::string identifier;
+    // Reported by the committer so that warnings come out in file order
+    std::optional<std::string> warning;
+    std::exception_ptr error;
+};
+
+template <typename Record, typename ReadBatch, typename Parse>
+std::unique_ptr<BuildingBlockLibrary> load_pipelined(ReadBatch &&read_batch, const Parse &parse) {
     auto bb_lib = std::make_unique<BuildingBlockLibrary>();
     identifier_deduplicator deduplicator;
 
-    RDKit::SDMolSupplier supplier(path.string(), true, false, true);
-    logger()->info("Starting to load building blocks from SDF: {}", path.string());
     size_t count = 0;
-    while (!supplier.atEnd()) {
-        try {
-            RDKit::ROMOL_SPTR rdkit_mol{supplier.next()};
-            auto mol = preprocessor(std::make_shared<Molecule>(rdkit_mol));
-            auto identifier = mol->smiles();
-            if (rdkit_mol->hasProp("id")) {
-                identifier = rdkit_mol->getProp<std::string>("id");
+    std::vector<Record> batch = read_batch();
+    while (!batch.empty()) {
+        auto next_batch = std::async(std::launch::async, read_batch);
+
+        std::vector<ParsedBuildingBlock> parsed(batch.size());
+#pragma omp parallel for schedule(dynamic, 16)
+        for (size_t i = 0; i < batch.size(); ++i) {
+            try {
+                parse(batch[i], parsed[i]);
+                if (parsed[i].molecule != nullptr) {
+                    // Canonicalize on the worker instead of the committer, see add()
+                    parsed[i].molecule->smiles();
+                }
+            } catch (const MoleculeError &e) {
+                parsed[i].warning = std::string("MoleculeError: ") + e.what();
+            } catch (...) {
+                parsed[i].error = std::current_exception();
+            }
+        }
+
+        for (auto &item : parsed) {
+            if (item.error != nullptr) {
+                std::rethrow_exception(item.error);
+            }
+            if (item.warning.has_value()) {
+                logger()->warn("{}", *item.warning);
+                continue;
             }
-            bb_lib->add({
-                .molecule = std::move(mol),
-                .identifier = deduplicator(identifier),
-                .labels = {},
-            });
-            count++;
-            if (count % 10000 == 0) {
-                logger()->info("Loaded {} building blocks ...", count);
+            try {
+                bb_lib->add({
+                    .molecule = std::move(item.molecule),
+                    .identifier = deduplicator(item.identifier),
+                    .labels = {},
+                });
+                count++;
+                if (count % 10000 == 0) {
+                    logger()->info("Loaded {} building blocks ...", count);
+                }
+            } catch (const BuildingBlockLibraryError &e) {
+                logger()->warn("BuildingBlockLibraryError: {}", e.what());
+                continue;
             }
-        } catch (const MoleculeError &e) {
-            logger()->warn("MoleculeError: {}", e.what());
-            continue;
-        } catch (const BuildingBlockLibraryError &e) {
-            logger()->warn("BuildingBlockLibraryError: {}", e.what());
-            continue;
         }
+        batch = next_batch.get();
     }
     logger()->info("Done. Loaded: {}", count);
     return bb_lib;
 }
 
+// Splits the stream on "$$$$" lines the same way SDMolSupplier does
+static std::vector<std::string> read_sdf_records(std::istream &is, size_t max_records) {
+    std::vector<std::string> records;
+    std::string record, line;
+    while (records.size() < max_records && std::getline(is, line)) {
+        record += line;
+        record += '\n';
+        if (line.starts_with("$$$$")) {
+            records.push_back(std::move(record));
+            record.clear();
+        }
+    }
+    // Last record without a terminator, skipping trailing blank lines
+    if (record.find_first_not_of(" \t\r\n") != std::string::npos) {
+        records.push_back(std::move(record));
+    }
+    return records;
+}
+
+std::unique_ptr<BuildingBlockLibrary>
+bb_lib_from_sdf(const std::filesystem::path &path, const BuildingBlockPreprocessor &preprocessor) {
+    auto input = open_input(path);
+    logger()->info("Starting to load building blocks from SDF: {}", path.string());
+
+    return load_pipelined<std::string>(
+        [&] { return read_sdf_records(*input, kLoaderBatchSize); },
+        [&](const std::string &record, ParsedBuildingBlock &out) {
+            RDKit::SDMolSupplier supplier;
+            supplier.setData(record, true, false, true);
+            RDKit::ROMOL_SPTR rdkit_mol{supplier.next()};
+            out.molecule = preprocessor(std::make_shared<Molecule>(rdkit_mol));
+            out.identifier = out.molecule->smiles();
+            if (rdkit_mol->hasProp("id")) {
+                out.identifier = rdkit_mol->getProp<std::string>("id");
+            }
+        });
+}
+
+struct CSVRecord {
+    size_t rowno = 0;
+    std::optional<std::string> identifier;
+    std::optional<std::string> smiles;
+};
+
 std::unique_ptr<BuildingBlockLibrary>
 bb_lib_from_csv(const std::filesystem::path &path, const BuildingBlockCSVConfig &config,
                 const BuildingBlockPreprocessor &preprocessor) {
-    auto bb_lib = std::make_unique<BuildingBlockLibrary>();
-    identifier_deduplicator deduplicator;
-
-    csv::CSVReader reader(path.string());
+    // Decompressed input is parsed from a stream, plain files are read by the parser itself
+    std::unique_ptr<std::istream> input;
+    std::unique_ptr<csv::CSVReader> reader;
+    if (is_gzip(path)) {
+        input = open_input(path);
+        reader = std::make_unique<csv::CSVReader>(*input, csv::CSVFormat::guess_csv());
+    } else {
+        reader = std::make_unique<csv::CSVReader>(path.string());
+    }
     logger()->info("Starting to load building blocks from CSV: {}", path.string());
-    size_t count = 0, rowno = 0;
-    for (auto &row : reader) {
-        rowno++;
-        try {
+
+    auto row = reader->begin();
+    size_t rowno = 0;
+    auto read_batch = [&] {
+        std::vector<CSVRecord> records;
+        for (; records.size() < kLoaderBatchSize && row != reader->end(); ++row) {
+            auto &record = records.emplace_back();
+            record.rowno = ++rowno;
             std::string identifier, smiles;
-            if (!row[config.identifier_column].try_get(identifier) ||
-                !row[config.smiles_column].try_get(smiles)) {
-                logger()->warn("Missing required columns at row {}", rowno);
-                continue;
+            if ((*row)[config.identifier_column].try_get(identifier) &&
+                (*row)[config.smiles_column].try_get(smiles)) {
+                record.identifier = std::move(identifier);
+                record.smiles = std::move(smiles);
             }
-            auto mol = preprocessor(Molecule::from_smiles(smiles));
-            bb_lib->add({
-                .molecule = std::move(mol),
-                .identifier = deduplicator(identifier),
-                .labels = {},
-            });
-            count++;
-            if (count % 10000 == 0) {
-                logger()->info("Loaded {} building blocks ...", count);
-            }
-        } catch (const MoleculeError &e) {
-            logger()->warn("MoleculeError: {}", e.what());
-            continue;
-        } catch (const BuildingBlockLibraryError &e) {
-            logger()->warn("BuildingBlockLibraryError: {}", e.what());
-            continue;
         }
-    }
-    logger()->info("Done. Loaded: {}", count);
-    return bb_lib;
+        return records;
+    };
+
+    return load_pipelined<CSVRecord>(
+        read_batch, [&](const CSVRecord &record, ParsedBuildingBlock &out) {
+            if (!record.identifier.has_value() || !record.smiles.has_value()) {
+                out.warning = "Missing required columns at row " + std::to_string(record.rowno);
+                return;
+            }
+            out.molecule = preprocessor(Molecule::from_smiles(*record.smiles));
+            out.identifier = *record.identifier;
+        });
 }
 
 } // namespace prexsyn::chemspace
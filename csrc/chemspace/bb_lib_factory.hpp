@@ -19,6 +19,8 @@ struct BuildingBlockPreprocessor {
     }
 };
 
+// Loaders parse and preprocess records on all OpenMP threads and add them in file order. Inputs may
+// be gzip-compressed.
 std::unique_ptr<BuildingBlockLibrary> bb_lib_from_sdf(const std::filesystem::path &,
                                                       const BuildingBlockPreprocessor & = {});
 
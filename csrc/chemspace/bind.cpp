@@ -85,6 +85,21 @@ static void def_postfix_notation(py::module &m) {
         });
 }
 
+static void def_molecule_cache(py::module &m) {
+    py::class_<MoleculeCache::Stats>(m, "MoleculeCacheStats")
+        .def_readonly("hits", &MoleculeCache::Stats::hits)
+        .def_readonly("misses", &MoleculeCache::Stats::misses)
+        .def_readonly("size", &MoleculeCache::Stats::size)
+        .def_readonly("pinned", &MoleculeCache::Stats::pinned)
+        .def_readonly("capacity", &MoleculeCache::Stats::capacity);
+
+    py::class_<MoleculeCache, py::smart_holder>(m, "MoleculeCache")
+        .def("capacity", &MoleculeCache::capacity)
+        .def("set_capacity", &MoleculeCache::set_capacity, py::arg("capacity"))
+        .def("stats", &MoleculeCache::stats)
+        .def("clear", &MoleculeCache::clear);
+}
+
 static void def_bb_lib(py::module &m) {
     py::class_<BuildingBlockEntry>(m, "BuildingBlockEntry")
         .def(py::init<>())
@@ -92,8 +107,12 @@ static void def_bb_lib(py::module &m) {
         .def_readwrite("identifier", &BuildingBlockEntry::identifier)
         .def_readwrite("labels", &BuildingBlockEntry::labels);
 
-    py::class_<BuildingBlockItem, BuildingBlockEntry>(m, "BuildingBlockItem")
+    py::class_<BuildingBlockItem>(m, "BuildingBlockItem")
         .def(py::init<>())
+        .def_property_readonly("molecule",
+                               [](const BuildingBlockItem &item) { return item.molecule.get(); })
+        .def_readonly("identifier", &BuildingBlockItem::identifier)
+        .def_readonly("labels", &BuildingBlockItem::labels)
         .def_readonly("index", &BuildingBlockItem::index);
 
     py::class_<BuildingBlockLibrary, py::smart_holder>(m, "BuildingBlockLibrary")
@@ -105,6 +124,9 @@ static void def_bb_lib(py::module &m) {
         .def("get", py::overload_cast<const std::string &>(&BuildingBlockLibrary::get, py::const_),
              py::arg("identifier"), py::return_value_policy::reference_internal)
         .def("add", &BuildingBlockLibrary::add, py::arg("entry"))
+        .def("pin", &BuildingBlockLibrary::pin, py::arg("index"))
+        .def("molecule_cache", &BuildingBlockLibrary::molecule_cache,
+             py::return_value_policy::reference_internal)
         .def("serialize", &serialize_to_file<BuildingBlockLibrary>, py::arg("path"))
         .def_static("deserialize", &deserialize_from_file<BuildingBlockLibrary>, py::arg("path"))
         .def("__len__", &BuildingBlockLibrary::size)
@@ -160,7 +182,10 @@ static void def_rxn_lib(py::module &m) {
         .def("get", py::overload_cast<const std::string &>(&ReactionLibrary::get, py::const_),
              py::arg("name"), py::return_value_policy::reference_internal)
         .def("add", &ReactionLibrary::add, py::arg("entry"))
-        .def("match_reactants", &ReactionLibrary::match_reactants, py::arg("molecule"))
+        .def("match_reactants", &ReactionLibrary::match_reactants, py::arg("molecule"),
+             py::arg("max_count") = std::nullopt)
+        .def("num_reactant_templates", &ReactionLibrary::num_reactant_templates)
+        .def("fingerprint", &ReactionLibrary::fingerprint)
         .def("serialize", &serialize_to_file<ReactionLibrary>, py::arg("path"))
         .def_static("deserialize", &deserialize_from_file<ReactionLibrary>, py::arg("path"))
         .def("__len__", &ReactionLibrary::size)
@@ -194,8 +219,12 @@ static void def_int_lib(py::module &m) {
         .def_readwrite("molecule", &IntermediateEntry::molecule)
         .def_readwrite("identifier", &IntermediateEntry::identifier);
 
-    py::class_<IntermediateItem, IntermediateEntry>(m, "IntermediateItem")
+    py::class_<IntermediateItem>(m, "IntermediateItem")
         .def(py::init<>())
+        .def_readonly("postfix_notation", &IntermediateItem::postfix_notation)
+        .def_property_readonly("molecule",
+                               [](const IntermediateItem &item) { return item.molecule.get(); })
+        .def_readonly("identifier", &IntermediateItem::identifier)
         .def_readonly("index", &IntermediateItem::index);
 
     py::class_<IntermediateLibrary, py::smart_holder>(m, "IntermediateLibrary")
@@ -207,6 +236,9 @@ static void def_int_lib(py::module &m) {
         .def("get", py::overload_cast<const std::string &>(&IntermediateLibrary::get, py::const_),
              py::arg("identifier"), py::return_value_policy::reference_internal)
         .def("add", &IntermediateLibrary::add, py::arg("entry"))
+        .def("pin", &IntermediateLibrary::pin, py::arg("index"))
+        .def("molecule_cache", &IntermediateLibrary::molecule_cache,
+             py::return_value_policy::reference_internal)
         .def("clear", &IntermediateLibrary::clear)
         .def("serialize", &serialize_to_file<IntermediateLibrary>, py::arg("path"))
         .def_static("deserialize", &deserialize_from_file<IntermediateLibrary>, py::arg("path"))
@@ -224,10 +256,31 @@ static void def_chemical_space(py::module &m) {
 
     py::class_<ReactantLists, py::smart_holder>(m, "ReactantLists")
         .def(py::init<>())
-        .def("get", &ReactantLists::get, py::arg("reaction_index"), py::arg("reactant_index"),
-             py::return_value_policy::reference_internal)
-        .def("set", &ReactantLists::set, py::arg("reaction_index"), py::arg("reactant_index"),
+        .def(
+            "get",
+            [](const ReactantLists &lists, ReactionLibrary::Index reaction_index,
+               Reaction::ReactantIndex reactant_index) {
+                auto entries = lists.get(reaction_index, reactant_index);
+                return std::vector<ReactantLists::MolIndex>(entries.begin(), entries.end());
+            },
+            py::arg("reaction_index"), py::arg("reactant_index"))
+        .def("set",
+             py::overload_cast<ReactionLibrary::Index, Reaction::ReactantIndex,
+                               const std::vector<size_t> &>(&ReactantLists::set),
+             py::arg("reaction_index"), py::arg("reactant_index"),
              py::arg("building_block_indices"))
+        .def("set", &ReactantLists::set<BuildingBlockLibrary>, py::arg("reaction_index"),
+             py::arg("reactant_index"), py::arg("building_block_indices"), py::arg("library"))
+        .def("set", &ReactantLists::set<IntermediateLibrary>, py::arg("reaction_index"),
+             py::arg("reactant_index"), py::arg("building_block_indices"), py::arg("library"))
+        .def(
+            "get_within",
+            [](const ReactantLists &lists, ReactionLibrary::Index reaction_index,
+               Reaction::ReactantIndex reactant_index, size_t max_heavy_atoms) {
+                auto entries = lists.get_within(reaction_index, reactant_index, max_heavy_atoms);
+                return std::vector<ReactantLists::MolIndex>(entries.begin(), entries.end());
+            },
+            py::arg("reaction_index"), py::arg("reactant_index"), py::arg("max_heavy_atoms"))
         .def("num_matches", &ReactantLists::num_matches);
 
     py::class_<ChemicalSpace::PeekStats>(m, "ChemicalSpacePeekStats")
@@ -242,7 +295,28 @@ static void def_chemical_space(py::module &m) {
              py::arg("bb_lib"), py::arg("rxn_lib"), py::arg("int_lib"),
              py::arg("matching_config") = ReactantMatchingConfig{})
         .def("serialize", &serialize_to_file<ChemicalSpace>, py::arg("path"))
-        .def_static("deserialize", &deserialize_from_file<ChemicalSpace>, py::arg("path"))
+        .def_static(
+            "deserialize",
+            [](const std::filesystem::path &path, bool verify) {
+                std::ifstream ifs(path, std::ios::binary);
+                if (!ifs) {
+                    throw std::runtime_error("failed to open file for reading: " + path.string());
+                }
+                return ChemicalSpace::deserialize(ifs, verify);
+            },
+            py::arg("path"), py::arg("verify") = false)
+        .def("save_mapped", &ChemicalSpace::save_mapped, py::arg("path"))
+        .def_static("load_mapped", &ChemicalSpace::load_mapped, py::arg("path"))
+        .def_static(
+            "convert_to_mapped",
+            [](const std::filesystem::path &src, const std::filesystem::path &dst) {
+                std::ifstream ifs(src, std::ios::binary);
+                if (!ifs) {
+                    throw std::runtime_error("failed to open file for reading: " + src.string());
+                }
+                ChemicalSpace::convert_to_mapped(ifs, dst);
+            },
+            py::arg("src"), py::arg("dst"))
         .def_static("peek",
                     [](const py::bytes &data) {
                         std::string raw(data);
@@ -278,6 +352,10 @@ static void def_chemical_space(py::module &m) {
              static_cast<ReactantLists &(ChemicalSpace::*)()>(
                  &ChemicalSpace::intermediate_reactant_lists),
              py::return_value_policy::reference_internal)
+        .def("enable_reaction_cache", &ChemicalSpace::enable_reaction_cache, py::arg("capacity"),
+             py::arg("num_shards") = prexsyn::ReactionCache::kDefaultNumShards)
+        .def("disable_reaction_cache", &ChemicalSpace::disable_reaction_cache)
+        .def("reaction_cache", &ChemicalSpace::reaction_cache)
         .def("generate_intermediates", &ChemicalSpace::generate_intermediates)
         .def("build_reactant_lists_for_building_blocks",
              &ChemicalSpace::build_reactant_lists_for_building_blocks)
@@ -317,7 +395,7 @@ static void def_chemical_space_synthesis(py::module &m) {
                 std::stringstream ss(raw);
                 return ChemicalSpaceSynthesis::deserialize(ss, chemspace);
             },
-            py::arg("data"), py::arg("chemspace"))
+            py::arg("data"), py::arg("chemspace"), py::keep_alive<0, 2>())
         .def("chemical_space", &ChemicalSpaceSynthesis::chemical_space,
              py::return_value_policy::reference_internal)
         .def("postfix_notation", &ChemicalSpaceSynthesis::postfix_notation,
@@ -326,7 +404,30 @@ static void def_chemical_space_synthesis(py::module &m) {
              py::return_value_policy::reference_internal)
         .def("count_building_blocks", &ChemicalSpaceSynthesis::count_building_blocks)
         .def("count_reactions", &ChemicalSpaceSynthesis::count_reactions)
-        .def("products", &ChemicalSpaceSynthesis::products)
+        .def(
+            "products",
+            [](const ChemicalSpaceSynthesis &synthesis, std::optional<size_t> limit) {
+                // Borrowed building blocks must not outlive the chemical space in Python
+                auto products = synthesis.products(limit);
+                for (auto &product : products) {
+                    product = Molecule::owning(product);
+                }
+                return products;
+            },
+            py::arg("limit") = std::nullopt)
+        .def("lazy_evaluation", &ChemicalSpaceSynthesis::lazy_evaluation)
+        .def("set_lazy_evaluation", &ChemicalSpaceSynthesis::set_lazy_evaluation, py::arg("lazy"))
+        .def("main_product_only", &ChemicalSpaceSynthesis::main_product_only)
+        .def("set_main_product_only", &ChemicalSpaceSynthesis::set_main_product_only,
+             py::arg("main_product_only"))
+        .def("max_outcomes_per_call", &ChemicalSpaceSynthesis::max_outcomes_per_call)
+        .def("set_max_outcomes_per_call", &ChemicalSpaceSynthesis::set_max_outcomes_per_call,
+             py::arg("limit"))
+        .def("max_heavy_atoms", &ChemicalSpaceSynthesis::max_heavy_atoms)
+        .def("set_max_heavy_atoms", &ChemicalSpaceSynthesis::set_max_heavy_atoms,
+             py::arg("limit"))
+        .def("num_threads", &ChemicalSpaceSynthesis::num_threads)
+        .def("set_num_threads", &ChemicalSpaceSynthesis::set_num_threads, py::arg("num_threads"))
         .def("add_building_block",
              py::overload_cast<BuildingBlockLibrary::Index>(
                  &ChemicalSpaceSynthesis::add_building_block),
@@ -357,6 +458,7 @@ static void def_chemical_space_synthesis(py::module &m) {
 
 void def_module_chemspace(pybind11::module &m) {
     def_postfix_notation(m);
+    def_molecule_cache(m);
     def_bb_lib(m);
     def_rxn_lib(m);
     def_rxn_lib_factory(m);
@@ -1,71 +1,297 @@
 #include "chemical_space.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <compare>
 #include <cstddef>
 #include <exception>
+#include <future>
 #include <istream>
+#include <limits>
 #include <memory>
+#include <optional>
 #include <ostream>
+#include <span>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include <omp.h>
 
 #include "../chemistry/chemistry.hpp"
+#include "../utility/chunked_archive.hpp"
 #include "../utility/logging.hpp"
 #include "../utility/serialization.hpp"
 #include "bb_lib.hpp"
 #include "int_lib.hpp"
+#include "mapped_format.hpp"
 #include "postfix_notation.hpp"
 #include "rxn_lib.hpp"
 #include "synthesis.hpp"
 
 namespace prexsyn::chemspace {
 
-void ReactantLists::init(const ReactionLibrary &rxn_lib) {
-    r2b_.clear();
-    r2b_.resize(rxn_lib.size());
+size_t ReactantLists::slot(ReactionLibrary::Index rxn, Reaction::ReactantIndex rnt) const {
+    if (rxn >= num_reactions()) {
+        throw std::out_of_range("Reaction index out of range");
+    }
+    if (rnt >= num_reactants(rxn)) {
+        throw std::out_of_range("Reactant index out of range");
+    }
+    return slot_begin_[rxn] + rnt;
+}
+
+size_t ReactantLists::num_reactants(ReactionLibrary::Index rxn) const {
+    if (rxn >= num_reactions()) {
+        throw std::out_of_range("Reaction index out of range");
+    }
+    return slot_begin_[rxn + 1] - slot_begin_[rxn];
+}
+
+std::span<const ReactantLists::MolIndex> ReactantLists::get(ReactionLibrary::Index rxn,
+                                                            Reaction::ReactantIndex rnt) const {
+    auto s = slot(rxn, rnt);
+    return entries_.view().subspan(entry_begin_[s], entry_begin_[s + 1] - entry_begin_[s]);
+}
+
+std::span<const ReactantLists::MolIndex>
+ReactantLists::get_within(ReactionLibrary::Index rxn, Reaction::ReactantIndex rnt,
+                          size_t max_heavy_atoms) const {
+    auto list = get(rxn, rnt);
+    if (!is_sorted_by_heavy_atoms()) {
+        return list;
+    }
+    auto s = slot(rxn, rnt);
+    auto heavy_atoms = heavy_atoms_.view().subspan(entry_begin_[s], list.size());
+    auto end = std::ranges::upper_bound(heavy_atoms, max_heavy_atoms);
+    return list.first(static_cast<size_t>(end - heavy_atoms.begin()));
+}
+
+ReactantLists::Builder::Builder(const ReactionLibrary &rxn_lib) : r2b_(rxn_lib.size()) {
     for (size_t rxn_idx = 0; rxn_idx < rxn_lib.size(); ++rxn_idx) {
-        const auto &rxn_item = rxn_lib.get(rxn_idx);
-        size_t num_reactants = rxn_item.reaction->num_reactants();
-        r2b_[rxn_idx].resize(num_reactants);
+        r2b_[rxn_idx].resize(rxn_lib.get(rxn_idx).reaction->num_reactants());
+    }
+}
+
+ReactantLists::Builder::Builder(const ReactantLists &lists) : r2b_(lists.num_reactions()) {
+    for (size_t rxn_idx = 0; rxn_idx < r2b_.size(); ++rxn_idx) {
+        r2b_[rxn_idx].resize(lists.num_reactants(rxn_idx));
+        for (size_t rnt_idx = 0; rnt_idx < r2b_[rxn_idx].size(); ++rnt_idx) {
+            auto list = lists.get(rxn_idx, rnt_idx);
+            r2b_[rxn_idx][rnt_idx].assign(list.begin(), list.end());
+        }
     }
 }
 
-void ReactantLists::add(MolIndex bb, ReactionLibrary::Index rxn, Reaction::ReactantIndex rnt) {
+ReactantLists::MolIndex ReactantLists::to_mol_index(size_t index) {
+    if (index > std::numeric_limits<MolIndex>::max()) {
+        throw std::out_of_range("Molecule index does not fit in a reactant list");
+    }
+    return static_cast<MolIndex>(index);
+}
+
+std::uint32_t ReactantLists::to_slot_index(size_t index) {
+    if (index > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::out_of_range("Too many reactant lists");
+    }
+    return static_cast<std::uint32_t>(index);
+}
+
+void ReactantLists::replace(ReactionLibrary::Index rxn, Reaction::ReactantIndex rnt,
+                            const std::vector<size_t> &molecules) {
+    Builder builder(*this);
+    builder.set(rxn, rnt, molecules);
+    *this = builder.build();
+}
+
+void ReactantLists::set(ReactionLibrary::Index rxn, Reaction::ReactantIndex rnt,
+                        const std::vector<size_t> &molecules) {
+    if (!heavy_atoms_.empty()) {
+        throw std::logic_error("Sorted reactant lists need their library to be modified");
+    }
+    replace(rxn, rnt, molecules);
+}
+
+void ReactantLists::Builder::add(size_t molecule, ReactionLibrary::Index rxn,
+                                 Reaction::ReactantIndex rnt) {
     if (rxn >= r2b_.size()) {
-        throw std::out_of_range("Reaction index out of range. Did you forget to call init?");
+        throw std::out_of_range("Reaction index out of range");
     }
     if (rnt >= r2b_[rxn].size()) {
-        throw std::out_of_range("Reactant index out of range. Did you forget to call init?");
+        throw std::out_of_range("Reactant index out of range");
     }
-    r2b_[rxn][rnt].push_back(bb);
-    num_matches_++;
+    r2b_[rxn][rnt].push_back(to_mol_index(molecule));
 }
 
-void ReactantLists::set(ReactionLibrary::Index rxn, Reaction::ReactantIndex rnt,
-                        const std::vector<MolIndex> &bbs) {
+void ReactantLists::Builder::set(ReactionLibrary::Index rxn, Reaction::ReactantIndex rnt,
+                                 const std::vector<size_t> &molecules) {
     if (rxn >= r2b_.size()) {
-        throw std::out_of_range("Reaction index out of range. Did you forget to call init?");
+        throw std::out_of_range("Reaction index out of range");
     }
     if (rnt >= r2b_[rxn].size()) {
-        throw std::out_of_range("Reactant index out of range. Did you forget to call init?");
+        throw std::out_of_range("Reactant index out of range");
+    }
+    auto &list = r2b_[rxn][rnt];
+    list.clear();
+    for (auto molecule : molecules) {
+        list.push_back(to_mol_index(molecule));
     }
-    num_matches_ -= r2b_[rxn][rnt].size();
-    r2b_[rxn][rnt] = bbs;
-    num_matches_ += r2b_[rxn][rnt].size();
 }
 
-std::unique_ptr<ChemicalSpace> ChemicalSpace::deserialize(std::istream &is) {
-    logger()->info("Deserializing chemical space...");
+ReactantLists ReactantLists::Builder::build() const {
+    ReactantLists lists;
+    lists.assign(r2b_);
+    return lists;
+}
 
-    auto vtag = SerializationVersionTag::read(is);
-    if (vtag != 1) {
+template <typename Library> static void verify_molecules(const Library &lib, const char *name) {
+    std::optional<std::string> failed_identifier;
+#pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < lib.size(); ++i) {
+        const auto &item = lib.get(i);
+        bool ok = false;
+        try {
+            auto sanitized = Molecule::from_rdkit_pickle(item.molecule.pickle());
+            ok = sanitized->smiles() == item.molecule.smiles();
+        } catch (const std::exception &) {
+            ok = false;
+        }
+        if (!ok) {
+#pragma omp critical
+            {
+                if (!failed_identifier.has_value()) {
+                    failed_identifier = item.identifier;
+                }
+            }
+        }
+    }
+    if (failed_identifier.has_value()) {
+        throw std::runtime_error(std::string("verification failed for ") + name + ": " +
+                                 failed_identifier.value());
+    }
+}
+
+namespace {
+
+struct ReactantListEntry {
+    size_t molecule;
+    ReactionLibrary::Index reaction;
+    Reaction::ReactantIndex reactant;
+    size_t count;
+
+    auto operator<=>(const ReactantListEntry &) const = default;
+};
+
+// Padded so that threads appending to their own buffer do not share cache lines
+struct alignas(64) ReactantListBuffer {
+    std::vector<ReactantListEntry> entries;
+};
+
+} // namespace
+
+// Every thread collects the matches of its molecules in its own buffer, and the buffers are merged
+// in molecule index order at the end, so the lists do not depend on the thread schedule. The
+// matches of every molecule are also kept in match_index, unless it is null.
+template <typename Library>
+static void build_reactant_lists(ReactantLists &lists, ReactantMatchIndex *match_index,
+                                 const Library &lib, const ReactionLibrary &rxn_lib,
+                                 const ReactantMatchingConfig &config, const char *name) {
+    auto max_count = config.max_count();
+    std::vector<ReactantListBuffer> buffers(static_cast<size_t>(omp_get_max_threads()));
+    std::atomic<size_t> count_processed{0};
+    std::atomic<size_t> count_matches{0};
+#pragma omp parallel
+    {
+        auto &buffer = buffers[static_cast<size_t>(omp_get_thread_num())].entries;
+#pragma omp for schedule(dynamic)
+        for (size_t i = 0; i < lib.size(); ++i) {
+            size_t num_matches = 0;
+            auto molecule = lib.get(i).molecule.get();
+            for (const auto &match : rxn_lib.match_reactants(*molecule, max_count)) {
+                buffer.push_back({i, match.reaction_index, match.reactant_index, match.count});
+                num_matches += config.check(match) ? 1 : 0;
+            }
+
+            auto matches = count_matches.fetch_add(num_matches, std::memory_order_relaxed);
+            auto processed = count_processed.fetch_add(1, std::memory_order_relaxed) + 1;
+            if (processed % 10000 == 0) {
+                logger()->info("Processed {} {}, found {} reactant matches...", processed, name,
+                               matches + num_matches);
+            }
+        }
+    }
+
+    std::vector<ReactantListEntry> entries;
+    for (auto &buffer : buffers) {
+        entries.insert(entries.end(), buffer.entries.begin(), buffer.entries.end());
+        buffer.entries = {};
+    }
+    std::ranges::sort(entries);
+
+    ReactantLists::Builder builder(rxn_lib);
+    if (match_index != nullptr) {
+        match_index->clear(max_count);
+    }
+    std::vector<ReactantMatchIndex::Entry> molecule_matches;
+    auto it = entries.begin();
+    for (size_t i = 0; i < lib.size(); ++i) {
+        molecule_matches.clear();
+        for (; it != entries.end() && it->molecule == i; ++it) {
+            molecule_matches.push_back({it->reaction, it->reactant, it->count});
+            if (config.check(it->count)) {
+                builder.add(it->molecule, it->reaction, it->reactant);
+            }
+        }
+        if (match_index != nullptr) {
+            match_index->push_back(molecule_matches);
+        }
+    }
+    lists = builder.build();
+    lists.sort_by_heavy_atoms(lib);
+}
+
+static void check_serialization_version(int version) {
+    if (version < ChemicalSpace::kMinSerializationVersion ||
+        version > ChemicalSpace::kCurrentSerializationVersion) {
         throw std::runtime_error("unsupported chemical space serialization version: " +
-                                 std::to_string(vtag));
+                                 std::to_string(version));
+    }
+}
+
+ChemicalSpace::ReactantMappings ChemicalSpace::read_reactant_mappings(std::istream &is,
+                                                                     int version) {
+    boost::archive::binary_iarchive ia(is);
+    ReactantMappings mappings;
+    ia >> mappings.matching_config;
+    ia >> mappings.bb_lists;
+    ia >> mappings.int_lists;
+    if (version >= 3) {
+        ia >> mappings.bb_match_index;
+    }
+    if (version >= 3 && version < 7) {
+        // Match index of intermediates, no longer kept
+        ReactantMatchIndex int_match_index;
+        ia >> int_match_index;
     }
+    return mappings;
+}
+
+void ChemicalSpace::write_reactant_mappings(std::ostream &os) const {
+    boost::archive::binary_oarchive oa(os);
+    oa << reactant_matching_config_;
+    oa << rnt_bb_mapping_;
+    oa << rnt_int_mapping_;
+    oa << bb_match_index_;
+}
+
+std::unique_ptr<ChemicalSpace> ChemicalSpace::deserialize(std::istream &is, bool verify) {
+    logger()->info("Deserializing chemical space...");
+
+    auto vtag = SerializationVersionTag::read(is);
+    check_serialization_version(vtag);
     logger()->info(" - Serialization version: {}", static_cast<int>(vtag));
 
     {
@@ -76,39 +302,85 @@ std::unique_ptr<ChemicalSpace> ChemicalSpace::deserialize(std::istream &is) {
                        rxn_lib_size, int_lib_size);
     }
 
-    auto bb_lib = BuildingBlockLibrary::deserialize(is);
-    logger()->info(" - Building block library deserialized. Size: {}", bb_lib->size());
-
-    auto rxn_lib = ReactionLibrary::deserialize(is);
-    logger()->info(" - Reaction library deserialized. Size: {}", rxn_lib->size());
-
-    auto int_lib = IntermediateLibrary::deserialize(is);
-    logger()->info(" - Intermediate library deserialized. Size: {}", int_lib->size());
+    std::unique_ptr<BuildingBlockLibrary> bb_lib;
+    std::unique_ptr<ReactionLibrary> rxn_lib;
+    std::unique_ptr<IntermediateLibrary> int_lib;
+    std::future<ReactantMappings> mappings;
+    if (vtag >= 6) {
+        {
+            std::istringstream section(read_section(is));
+            rxn_lib = ReactionLibrary::deserialize(section);
+        }
+        logger()->info(" - Reaction library deserialized. Size: {}", rxn_lib->size());
+        // Decoded while the library chunks are read and decoded
+        mappings = std::async(std::launch::async, [section = read_section(is), vtag]() mutable {
+            std::istringstream ss(std::move(section));
+            return read_reactant_mappings(ss, vtag);
+        });
+        bb_lib = BuildingBlockLibrary::deserialize_chunked(is);
+        logger()->info(" - Building block library deserialized. Size: {}", bb_lib->size());
+        int_lib = IntermediateLibrary::deserialize_chunked(is);
+        logger()->info(" - Intermediate library deserialized. Size: {}", int_lib->size());
+    } else {
+        bb_lib = BuildingBlockLibrary::deserialize(is);
+        logger()->info(" - Building block library deserialized. Size: {}", bb_lib->size());
+        rxn_lib = ReactionLibrary::deserialize(is);
+        logger()->info(" - Reaction library deserialized. Size: {}", rxn_lib->size());
+        int_lib = IntermediateLibrary::deserialize(is);
+        logger()->info(" - Intermediate library deserialized. Size: {}", int_lib->size());
+    }
 
-    {
-        boost::archive::binary_iarchive ia(is);
-        ReactantMatchingConfig matching_config;
-        ia >> matching_config;
-        auto chemspace = std::make_unique<ChemicalSpace>(std::move(bb_lib), std::move(rxn_lib),
-                                                         std::move(int_lib), matching_config);
-        ia >> chemspace->rnt_bb_mapping_;
-        logger()->info(" - Reactant-building block mapping deserialized. Matches: {}",
-                       chemspace->rnt_bb_mapping_.num_matches());
+    if (verify) {
+        verify_molecules(*bb_lib, "building block");
+        verify_molecules(*int_lib, "intermediate");
+        logger()->info(" - Library molecules verified");
+    }
 
-        ia >> chemspace->rnt_int_mapping_;
-        logger()->info(" - Reactant-intermediate mapping deserialized. Matches: {}",
-                       chemspace->rnt_int_mapping_.num_matches());
+    auto [matching_config, bb_lists, int_lists, bb_match_index] =
+        vtag >= 6 ? mappings.get() : read_reactant_mappings(is, vtag);
+    auto chemspace = std::make_unique<ChemicalSpace>(std::move(bb_lib), std::move(rxn_lib),
+                                                     std::move(int_lib), matching_config);
+    chemspace->rnt_bb_mapping_ = std::move(bb_lists);
+    logger()->info(" - Reactant-building block mapping deserialized. Matches: {}",
+                   chemspace->rnt_bb_mapping_.num_matches());
+    chemspace->rnt_int_mapping_ = std::move(int_lists);
+    logger()->info(" - Reactant-intermediate mapping deserialized. Matches: {}",
+                   chemspace->rnt_int_mapping_.num_matches());
+    if (vtag >= 3) {
+        chemspace->bb_match_index_ = std::move(bb_match_index);
+        logger()->info(" - Reactant match index deserialized. Entries: {}",
+                       chemspace->bb_match_index_.num_entries());
+    }
 
-        return chemspace;
+    // Files written before the heavy atom counts were stored are sorted here, which decodes
+    // every molecule in the lists
+    if (!chemspace->rnt_bb_mapping_.is_sorted_by_heavy_atoms()) {
+        chemspace->rnt_bb_mapping_.sort_by_heavy_atoms(*chemspace->bb_lib_);
     }
+    if (!chemspace->rnt_int_mapping_.is_sorted_by_heavy_atoms()) {
+        chemspace->rnt_int_mapping_.sort_by_heavy_atoms(*chemspace->int_lib_);
+    }
+
+    return chemspace;
 }
 
 ChemicalSpace::PeekStats ChemicalSpace::peek(std::istream &is) {
-    auto vtag = SerializationVersionTag::read(is);
-    if (vtag != 1) {
-        throw std::runtime_error("unsupported chemical space serialization version: " +
-                                 std::to_string(vtag));
+    // Mapped files are told apart by their magic, the header has the counts at fixed offsets
+    auto start = is.tellg();
+    mapped_format::Header header;
+    if (is.read(reinterpret_cast<char *>(&header), sizeof(header)) &&
+        header.magic == mapped_format::kMagic) {
+        return {
+            .num_reactions = header.num_reactions,
+            .num_building_blocks = header.num_building_blocks,
+            .num_intermediates = header.num_intermediates,
+        };
     }
+    is.clear();
+    is.seekg(start);
+
+    auto vtag = SerializationVersionTag::read(is);
+    check_serialization_version(vtag);
 
     boost::archive::binary_iarchive ia(is);
     PeekStats stats;
@@ -124,15 +396,25 @@ void ChemicalSpace::serialize(std::ostream &os) const {
         boost::archive::binary_oarchive oa(os);
         oa << bb_lib_->size() << rxn_lib_->size() << int_lib_->size();
     }
-    bb_lib_->serialize(os);
-    rxn_lib_->serialize(os);
-    int_lib_->serialize(os);
     {
-        boost::archive::binary_oarchive oa(os);
-        oa << reactant_matching_config_;
-        oa << rnt_bb_mapping_;
-        oa << rnt_int_mapping_;
+        std::ostringstream section;
+        rxn_lib_->serialize(section);
+        write_section(os, std::move(section).str());
     }
+    {
+        std::ostringstream section;
+        write_reactant_mappings(section);
+        write_section(os, std::move(section).str());
+    }
+    bb_lib_->serialize_chunked(os);
+    int_lib_->serialize_chunked(os);
+}
+
+std::shared_ptr<ReactionCache> ChemicalSpace::enable_reaction_cache(size_t capacity,
+                                                                    size_t num_shards) {
+    auto cache = std::make_shared<ReactionCache>(capacity, num_shards, rxn_lib_->fingerprint());
+    reaction_cache_.store(cache);
+    return cache;
 }
 
 void ChemicalSpace::generate_intermediates() {
@@ -147,48 +429,70 @@ void ChemicalSpace::generate_intermediates() {
     int_lib_->clear();
     std::vector<std::pair<BuildingBlockLibrary::Index, ReactionLibrary::Index>> bb_rxn_pairs;
 
-    for (size_t rxn_idx = 0; rxn_idx < rnt_bb_mapping_.r2b_.size(); ++rxn_idx) {
-        const auto &reactant_lists = rnt_bb_mapping_.r2b_[rxn_idx];
-        if (reactant_lists.size() != 1) {
+    for (size_t rxn_idx = 0; rxn_idx < rnt_bb_mapping_.num_reactions(); ++rxn_idx) {
+        if (rnt_bb_mapping_.num_reactants(rxn_idx) != 1) {
             continue;
         }
-        const auto &bb_indices = reactant_lists[0];
-        for (const auto &bb_idx : bb_indices) {
+        for (auto bb_idx : rnt_bb_mapping_.get(rxn_idx, 0)) {
             bb_rxn_pairs.emplace_back(bb_idx, rxn_idx);
         }
     }
+    // Intermediates are numbered in (building block, reaction, outcome) order
+    std::ranges::sort(bb_rxn_pairs);
 
+    // Every pair writes to its own slot, so workers do not contend and the result does not
+    // depend on the thread schedule
+    std::vector<std::vector<IntermediateEntry>> generated(bb_rxn_pairs.size());
+    std::atomic<size_t> count_generated{0};
 #pragma omp parallel for schedule(dynamic)
-    for (const auto &[bb_idx, rxn_idx] : bb_rxn_pairs) {
+    for (size_t pair_idx = 0; pair_idx < bb_rxn_pairs.size(); ++pair_idx) {
+        const auto &[bb_idx, rxn_idx] = bb_rxn_pairs[pair_idx];
         const auto &bb_item = bb_lib_->get(bb_idx);
         const auto &rxn_item = rxn_lib_->get(rxn_idx);
         PostfixNotation pfn{};
         pfn.append(bb_idx, PostfixNotation::Token::BuildingBlock);
         pfn.append(rxn_idx, PostfixNotation::Token::Reaction);
 
+        auto &entries = generated[pair_idx];
         try {
-            auto outcomes = rxn_item.reaction->apply(std::vector{bb_item.molecule}, true);
+            // Only main products become intermediates, by-products are never sanitized
+            auto outcomes = rxn_item.reaction->apply(
+                std::vector{bb_item.molecule.get()}, {},
+                ReactionApplyOptions{.ignore_errors = true, .main_product_only = true});
+            std::unordered_set<std::string> seen;
             for (size_t i = 0; i < outcomes.size(); ++i) {
-                std::string identifier =
-                    bb_item.identifier + "@" + rxn_item.name + ":" + std::to_string(i);
-#pragma omp critical
-                {
-                    int_lib_->add({
-                        .postfix_notation = pfn,
-                        .molecule = outcomes.at(i).main_product(),
-                        .identifier = identifier,
-                    });
-                    if (int_lib_->size() % 10000 == 0) {
-                        logger()->info("Generated {} intermediates...", int_lib_->size());
-                    }
+                auto product = outcomes.at(i).main_product();
+                // Several outcomes of the same pair often give the same molecule
+                if (!seen.insert(product->smiles()).second) {
+                    continue;
                 }
+                entries.push_back({
+                    .postfix_notation = pfn,
+                    .molecule = std::move(product),
+                    .identifier = bb_item.identifier + "@" + rxn_item.name + ":" +
+                                  std::to_string(i),
+                });
             }
         } catch (const std::exception &e) {
             logger()->warn(
                 "Error generating intermediate for building block {} and reaction {}: {}",
                 bb_item.identifier, rxn_item.name, e.what());
+            entries.clear();
             continue;
         }
+
+        auto before = count_generated.fetch_add(entries.size(), std::memory_order_relaxed);
+        if (before / 10000 != (before + entries.size()) / 10000) {
+            logger()->info("Generated {} intermediates...", before + entries.size());
+        }
+    }
+
+    int_lib_->reserve(count_generated.load());
+    for (auto &entries : generated) {
+        for (auto &entry : entries) {
+            int_lib_->add(entry);
+        }
+        entries = {};
     }
 
     logger()->info("Done. Intermediates: {}", int_lib_->size());
@@ -196,68 +500,25 @@ void ChemicalSpace::generate_intermediates() {
 
 void ChemicalSpace::build_reactant_lists_for_building_blocks() {
     logger()->info("Starting to build reactant-building block lists...");
-    rnt_bb_mapping_.init(*rxn_lib_);
-
-    size_t count_processed = 0;
-#pragma omp parallel for schedule(dynamic)
-    for (size_t i = 0; i < bb_lib_->size(); ++i) {
-        const auto &bb = bb_lib_->get(i);
-        auto matches = rxn_lib_->match_reactants(*bb.molecule);
-#pragma omp critical
-        {
-            for (const auto &match : matches) {
-                if (!reactant_matching_config_.check(match)) {
-                    continue;
-                }
-                rnt_bb_mapping_.add(bb.index, match.reaction_index, match.reactant_index);
-            }
-
-            count_processed++;
-            if (count_processed % 10000 == 0) {
-                logger()->info("Processed {} building blocks, found {} reactant matches...",
-                               count_processed, rnt_bb_mapping_.num_matches());
-            }
-        }
-    }
+    build_reactant_lists(rnt_bb_mapping_, &bb_match_index_, *bb_lib_, *rxn_lib_,
+                         reactant_matching_config_, "building blocks");
     logger()->info("Done. Reactant-building block matches: {}", rnt_bb_mapping_.num_matches());
 }
 
 void ChemicalSpace::build_reactant_lists_for_intermediates() {
     logger()->info("Starting to build reactant-intermediate lists...");
-    rnt_int_mapping_.init(*rxn_lib_);
-
-    size_t count_processed = 0;
-#pragma omp parallel for schedule(dynamic)
-    for (size_t i = 0; i < int_lib_->size(); ++i) {
-        const auto &intm = int_lib_->get(i);
-        auto matches = rxn_lib_->match_reactants(*intm.molecule);
-#pragma omp critical
-        {
-            for (const auto &match : matches) {
-                if (!reactant_matching_config_.check(match)) {
-                    continue;
-                }
-
-                rnt_int_mapping_.add(intm.index, match.reaction_index, match.reactant_index);
-            }
-
-            count_processed++;
-            if (count_processed % 10000 == 0) {
-                logger()->info("Processed {} intermediates, found {} reactant matches...",
-                               count_processed, rnt_int_mapping_.num_matches());
-            }
-        }
-    }
+    build_reactant_lists(rnt_int_mapping_, nullptr, *int_lib_, *rxn_lib_,
+                         reactant_matching_config_, "intermediates");
     logger()->info("Done. Reactant-intermediate matches: {}", rnt_int_mapping_.num_matches());
 }
 
 void ChemicalSpace::print_reactant_lists(std::ostream &os) const {
-    for (size_t rxn_idx = 0; rxn_idx < rnt_bb_mapping_.r2b_.size(); ++rxn_idx) {
+    for (size_t rxn_idx = 0; rxn_idx < rnt_bb_mapping_.num_reactions(); ++rxn_idx) {
         const auto &rxn_item = rxn_lib_->get(rxn_idx);
         os << "- " << rxn_item.name << " (index=" << rxn_idx << "):\n";
-        for (size_t rnt_idx = 0; rnt_idx < rnt_bb_mapping_.r2b_[rxn_idx].size(); ++rnt_idx) {
-            const auto &bb_indices = rnt_bb_mapping_.r2b_[rxn_idx][rnt_idx];
-            const auto &int_indices = rnt_int_mapping_.r2b_[rxn_idx][rnt_idx];
+        for (size_t rnt_idx = 0; rnt_idx < rnt_bb_mapping_.num_reactants(rxn_idx); ++rnt_idx) {
+            auto bb_indices = rnt_bb_mapping_.get(rxn_idx, rnt_idx);
+            auto int_indices = rnt_int_mapping_.get(rxn_idx, rnt_idx);
             os << "    " << rxn_item.reaction->reactant_names()[rnt_idx] << ": "
                << bb_indices.size() << " building blocks, " << int_indices.size()
                << " intermediates ";
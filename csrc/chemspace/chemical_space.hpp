@@ -1,14 +1,24 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <filesystem>
 #include <istream>
 #include <memory>
 #include <ostream>
+#include <span>
 #include <stdexcept>
+#include <tuple>
 #include <utility>
 #include <vector>
 
+#include <boost/serialization/version.hpp>
+
 #include "../chemistry/chemistry.hpp"
+#include "../utility/array_storage.hpp"
+#include "../utility/mmap_file.hpp"
 #include "bb_lib.hpp"
 #include "int_lib.hpp"
 #include "rxn_lib.hpp"
@@ -23,37 +33,204 @@ struct ReactantMatchingConfig {
         ar & selectivity_cutoff;
     }
 
-    bool check(const ReactionLibrary::Match &match) const {
-        bool selectivity_ok = match.count <= selectivity_cutoff;
+    bool check(const ReactionLibrary::Match &match) const { return check(match.count); }
+    bool check(size_t count) const {
+        bool selectivity_ok = count <= selectivity_cutoff;
         return selectivity_ok;
     }
+
+    // Counting more template matches than this does not change the outcome of check()
+    size_t max_count() const { return selectivity_cutoff + 1; }
 };
 
+// Reactant lists of every (reaction, reactant) slot in compressed sparse row form. The entries of
+// all slots are stored back to back as 32-bit molecule indices, so sampling a partner touches one
+// contiguous range instead of a vector per slot.
 class ReactantLists {
 public:
-    using MolIndex = size_t;
+    using MolIndex = std::uint32_t;
+    class Builder;
+
+private:
+    // First slot of each reaction, which has one slot per reactant
+    ArrayStorage<std::uint32_t> slot_begin_{0};
+    // First entry of each slot
+    ArrayStorage<std::uint64_t> entry_begin_{0};
+    // Ordered by heavy atom count within each slot once sorted
+    ArrayStorage<MolIndex> entries_;
+    // Heavy atom counts of entries_, empty if the lists are not sorted. They are serialized so
+    // that loading does not decode every library molecule to count its atoms.
+    ArrayStorage<std::uint32_t> heavy_atoms_;
+    friend class ChemicalSpace;
+
+    size_t slot(ReactionLibrary::Index, Reaction::ReactantIndex) const;
+    // Throws if the index does not fit in 32 bits
+    static MolIndex to_mol_index(size_t);
+    static std::uint32_t to_slot_index(size_t);
+    // Rebuilds the lists with one of them replaced, they are not sorted afterwards
+    void replace(ReactionLibrary::Index, Reaction::ReactantIndex, const std::vector<size_t> &);
+
+    template <typename Index> void assign(const std::vector<std::vector<std::vector<Index>>> &r2b) {
+        std::vector<std::uint32_t> slot_begin{0};
+        std::vector<std::uint64_t> entry_begin{0};
+        std::vector<MolIndex> entries;
+        for (const auto &reactants : r2b) {
+            for (const auto &list : reactants) {
+                for (auto index : list) {
+                    entries.push_back(to_mol_index(index));
+                }
+                entry_begin.push_back(entries.size());
+            }
+            slot_begin.push_back(to_slot_index(entry_begin.size() - 1));
+        }
+        slot_begin_ = std::move(slot_begin);
+        entry_begin_ = std::move(entry_begin);
+        entries_ = std::move(entries);
+        heavy_atoms_ = {};
+    }
+
+public:
+    template <typename Archive> void serialize(Archive &ar, const unsigned int version) {
+        if constexpr (Archive::is_loading::value) {
+            if (version == 0) {
+                // Nested vectors of 64-bit indices, written before the lists were flattened
+                std::vector<std::vector<std::vector<size_t>>> r2b;
+                size_t num_matches = 0;
+                ar & r2b;
+                ar & num_matches;
+                assign(r2b);
+                return;
+            }
+        }
+        slot_begin_.serialize(ar);
+        entry_begin_.serialize(ar);
+        entries_.serialize(ar);
+        if (version >= 2) {
+            heavy_atoms_.serialize(ar);
+        } else {
+            heavy_atoms_ = {};
+        }
+    }
+
+    std::span<const MolIndex> get(ReactionLibrary::Index, Reaction::ReactantIndex) const;
+
+    // Entries with at most max_heavy_atoms heavy atoms, or all entries if the lists are not sorted
+    std::span<const MolIndex> get_within(ReactionLibrary::Index, Reaction::ReactantIndex,
+                                         size_t max_heavy_atoms) const;
+
+    // Replaces one list. Lists that hold heavy atom counts cannot be sorted again without their
+    // library, so this throws for them.
+    void set(ReactionLibrary::Index, Reaction::ReactantIndex, const std::vector<size_t> &);
+    // Keeps sorted lists sorted, with the heavy atom counts of the library the entries index
+    template <typename Library>
+    void set(ReactionLibrary::Index rxn, Reaction::ReactantIndex rnt,
+             const std::vector<size_t> &molecules, const Library &lib) {
+        bool sorted = is_sorted_by_heavy_atoms();
+        replace(rxn, rnt, molecules);
+        if (sorted) {
+            sort_by_heavy_atoms(lib);
+        }
+    }
 
+    size_t num_matches() const { return entries_.size(); }
+    size_t num_reactions() const { return slot_begin_.size() - 1; }
+    size_t num_reactants(ReactionLibrary::Index) const;
+    bool is_sorted_by_heavy_atoms() const { return heavy_atoms_.size() == entries_.size(); }
+
+    // Orders every list by the heavy atom count of its molecules in the library, then by index
+    template <typename Library> void sort_by_heavy_atoms(const Library &lib) {
+        auto &entries = entries_.values();
+        auto &heavy_atoms = heavy_atoms_.values();
+        heavy_atoms.resize(entries.size());
+        std::vector<std::pair<std::uint32_t, MolIndex>> list;
+        for (size_t s = 0; s + 1 < entry_begin_.size(); ++s) {
+            list.clear();
+            for (auto k = entry_begin_[s]; k < entry_begin_[s + 1]; ++k) {
+                auto molecule = lib.get(entries[k]).molecule.get();
+                list.emplace_back(molecule->num_heavy_atoms(), entries[k]);
+            }
+            std::ranges::sort(list);
+            for (size_t k = 0; k < list.size(); ++k) {
+                std::tie(heavy_atoms[entry_begin_[s] + k], entries[entry_begin_[s] + k]) = list[k];
+            }
+        }
+    }
+};
+
+// Collects entries slot by slot before they are flattened into ReactantLists
+class ReactantLists::Builder {
 private:
-    // reaction -> reactant -> [building block]
     std::vector<std::vector<std::vector<MolIndex>>> r2b_;
-    size_t num_matches_ = 0;
+
+public:
+    // Empty lists with one slot per reactant of every reaction
+    explicit Builder(const ReactionLibrary &);
+    // Starts from existing lists, e.g. to replace some of them
+    explicit Builder(const ReactantLists &);
+
+    void add(size_t molecule, ReactionLibrary::Index, Reaction::ReactantIndex);
+    void set(ReactionLibrary::Index, Reaction::ReactantIndex, const std::vector<size_t> &);
+
+    // The lists are not sorted by heavy atom count
+    ReactantLists build() const;
+};
+
+// Reactant template matches of every molecule of a library, including the ones that fail the
+// selectivity check, in CSR form: molecule -> [match]
+class ReactantMatchIndex {
+public:
+    using MolIndex = size_t;
+
+    struct Entry {
+        ReactionLibrary::Index reaction_index;
+        Reaction::ReactantIndex reactant_index;
+        // Capped at max_count()
+        size_t count;
+
+        template <typename Archive> void serialize(Archive &ar, const unsigned int /* version */) {
+            ar & reaction_index;
+            ar & reactant_index;
+            ar & count;
+        }
+    };
+
+private:
+    ArrayStorage<size_t> offsets_{0};
+    ArrayStorage<Entry> entries_;
+    size_t max_count_ = 0;
     friend class ChemicalSpace;
 
 public:
     template <typename Archive> void serialize(Archive &ar, const unsigned int /* version */) {
-        ar & r2b_;
-        ar & num_matches_;
+        offsets_.serialize(ar);
+        entries_.serialize(ar);
+        ar & max_count_;
     }
 
-    const auto &get(ReactionLibrary::Index i, Reaction::ReactantIndex j) const {
-        return r2b_.at(i).at(j);
-    }
+    // Number of molecules indexed, zero until the reactant lists are built
+    size_t size() const { return offsets_.size() - 1; }
+    size_t num_entries() const { return entries_.size(); }
+    // Counts below this are exact, counts equal to it stand for this many matches or more
+    size_t max_count() const { return max_count_; }
 
-    size_t num_matches() const { return num_matches_; }
+    std::span<const Entry> get(MolIndex index) const {
+        if (index >= size()) {
+            throw std::out_of_range("Molecule index out of range");
+        }
+        return entries_.view().subspan(offsets_[index], offsets_[index + 1] - offsets_[index]);
+    }
 
-    void init(const ReactionLibrary &);
-    void add(MolIndex, ReactionLibrary::Index, Reaction::ReactantIndex);
-    void set(ReactionLibrary::Index, Reaction::ReactantIndex, const std::vector<MolIndex> &);
+    void clear(size_t max_count) {
+        offsets_ = {0};
+        entries_ = {};
+        max_count_ = max_count;
+    }
+    // Adds the matches of the next molecule
+    void push_back(std::span<const Entry> matches) {
+        auto &entries = entries_.values();
+        entries.insert(entries.end(), matches.begin(), matches.end());
+        offsets_.values().push_back(entries.size());
+    }
 };
 
 class ChemicalSpace {
@@ -64,9 +241,34 @@ private:
 
     ReactantMatchingConfig reactant_matching_config_;
     ReactantLists rnt_bb_mapping_, rnt_int_mapping_;
+    // Matches of the building blocks, which start every enumerated synthesis
+    ReactantMatchIndex bb_match_index_;
+    // File that load_mapped() serves the reactant lists, the match index and the library pickles
+    // from. They hold a reference of their own, so copies of them may outlive this object.
+    std::shared_ptr<const MappedFile> mapped_file_;
+
+    // Swapped atomically, syntheses hold their own reference while they use it
+    std::atomic<std::shared_ptr<ReactionCache>> reaction_cache_;
+
+    // Serialized apart from the libraries
+    struct ReactantMappings {
+        ReactantMatchingConfig matching_config;
+        ReactantLists bb_lists, int_lists;
+        ReactantMatchIndex bb_match_index;
+    };
+    static ReactantMappings read_reactant_mappings(std::istream &, int version);
+    void write_reactant_mappings(std::ostream &) const;
 
 public:
-    static constexpr int kCurrentSerializationVersion = 1;
+    // Version 2 stores canonical SMILES with library molecules, which are then loaded as trusted
+    // Version 3 stores the reactant match index of both libraries
+    // Version 4 stores reactant lists in CSR form
+    // Version 5 stores the heavy atom counts of reactant list entries
+    // Version 6 stores size-prefixed sections, with the reactant mappings ahead of the libraries
+    // and library items in chunks, see utility/chunked_archive.hpp
+    // Version 7 drops the reactant match index of intermediates, which nothing read
+    static constexpr int kCurrentSerializationVersion = 7;
+    static constexpr int kMinSerializationVersion = 1;
 
     ChemicalSpace(std::unique_ptr<BuildingBlockLibrary> bb_lib,
                   std::unique_ptr<ReactionLibrary> rxn_lib,
@@ -83,19 +285,29 @@ public:
         if (int_lib_ == nullptr) {
             int_lib_ = std::make_unique<IntermediateLibrary>();
         }
-        rnt_bb_mapping_.init(*rxn_lib_);
-        rnt_int_mapping_.init(*rxn_lib_);
+        rnt_bb_mapping_ = ReactantLists::Builder(*rxn_lib_).build();
+        rnt_int_mapping_ = ReactantLists::Builder(*rxn_lib_).build();
     }
 
-    static std::unique_ptr<ChemicalSpace> deserialize(std::istream &);
+    // verify: re-sanitize every library molecule and check it against the stored SMILES, for
+    // files that do not come from a trusted source
+    static std::unique_ptr<ChemicalSpace> deserialize(std::istream &, bool verify = false);
     struct PeekStats {
         size_t num_reactions = 0;
         size_t num_building_blocks = 0;
         size_t num_intermediates = 0;
     };
+    // Reads the counts of both the serialize() and the mapped format
     static PeekStats peek(std::istream &);
     void serialize(std::ostream &) const;
 
+    // Memory-mapped format, see mapped_format.hpp. It is written to a path rather than a stream
+    // because the section table is filled in last.
+    static std::unique_ptr<ChemicalSpace> load_mapped(const std::filesystem::path &);
+    void save_mapped(const std::filesystem::path &) const;
+    // Converts a file written by serialize()
+    static void convert_to_mapped(std::istream &, const std::filesystem::path &);
+
     const BuildingBlockLibrary &bb_lib() const { return *bb_lib_; }
     BuildingBlockLibrary &bb_lib() { return *bb_lib_; }
 
@@ -116,6 +328,18 @@ public:
     const ReactantLists &intermediate_reactant_lists() const { return rnt_int_mapping_; }
     ReactantLists &intermediate_reactant_lists() { return rnt_int_mapping_; }
 
+    // Filled along with the reactant lists, so that the matches of library molecules are looked
+    // up instead of matched again
+    const ReactantMatchIndex &building_block_match_index() const { return bb_match_index_; }
+
+    // The cache is shared by all syntheses of this chemical space and does its own locking.
+    // Syntheses keep the cache they were pushed with alive, so it can be replaced or disabled
+    // while they are evaluated.
+    std::shared_ptr<ReactionCache>
+    enable_reaction_cache(size_t capacity, size_t num_shards = ReactionCache::kDefaultNumShards);
+    void disable_reaction_cache() { reaction_cache_.store(nullptr); }
+    std::shared_ptr<ReactionCache> reaction_cache() const { return reaction_cache_.load(); }
+
     void generate_intermediates();
 
     void build_reactant_lists_for_building_blocks();
@@ -126,3 +350,5 @@ public:
 };
 
 } // namespace prexsyn::chemspace
+
+BOOST_CLASS_VERSION(prexsyn::chemspace::ReactantLists, 2)
@@ -0,0 +1,323 @@
+#include "chemical_space.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <set>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "../chemistry/chemistry.hpp"
+#include "../utility/logging.hpp"
+#include "../utility/mmap_file.hpp"
+#include "bb_lib.hpp"
+#include "int_lib.hpp"
+#include "mapped_format.hpp"
+#include "postfix_notation.hpp"
+#include "rxn_lib.hpp"
+
+namespace prexsyn::chemspace {
+
+using mapped_format::BlobArrayView;
+using mapped_format::FormatError;
+using mapped_format::SectionId;
+
+template <typename Library, typename Fn>
+static void write_blobs(mapped_format::Writer &writer, SectionId id, const Library &lib,
+                        Fn &&blob_of) {
+    std::vector<std::string> blobs(lib.size());
+#pragma omp parallel for schedule(dynamic, 256)
+    for (size_t i = 0; i < lib.size(); ++i) {
+        blobs[i] = blob_of(lib.get(i));
+    }
+    writer.section(id, [&](std::ostream &os) { mapped_format::write_blob_array(os, blobs); });
+}
+
+static void write_match_index(mapped_format::Writer &writer, SectionId id,
+                              const ReactantMatchIndex &index) {
+    std::vector<std::uint64_t> entry_begin{0};
+    std::vector<mapped_format::MatchIndexView::Entry> entries;
+    entries.reserve(index.num_entries());
+    for (size_t i = 0; i < index.size(); ++i) {
+        for (const auto &entry : index.get(i)) {
+            entries.push_back({entry.reaction_index, entry.reactant_index, entry.count});
+        }
+        entry_begin.push_back(entries.size());
+    }
+    writer.section(id, [&](std::ostream &os) {
+        write_u64(os, index.size());
+        write_u64(os, index.max_count());
+        write_u64(os, entries.size());
+        write_array(os, std::span<const std::uint64_t>(entry_begin));
+        write_array(os, std::span<const mapped_format::MatchIndexView::Entry>(entries));
+    });
+}
+
+void ChemicalSpace::save_mapped(const std::filesystem::path &path) const {
+    std::ofstream os(path, std::ios::binary | std::ios::trunc);
+    if (!os) {
+        throw std::runtime_error("failed to open file for writing: " + path.string());
+    }
+    mapped_format::Writer writer(os);
+
+    writer.section(SectionId::ReactionLibrary, [&](std::ostream &s) { rxn_lib_->serialize(s); });
+    writer.section(SectionId::MatchingConfig, [&](std::ostream &s) {
+        write_u64(s, reactant_matching_config_.selectivity_cutoff);
+    });
+
+    write_blobs(writer, SectionId::BuildingBlockPickles, *bb_lib_,
+                [](const BuildingBlockItem &item) { return item.molecule.pickle(); });
+    write_blobs(writer, SectionId::BuildingBlockSmiles, *bb_lib_,
+                [](const BuildingBlockItem &item) { return item.molecule.smiles(); });
+    write_blobs(writer, SectionId::BuildingBlockIdentifiers, *bb_lib_,
+                [](const BuildingBlockItem &item) { return item.identifier; });
+    write_blobs(writer, SectionId::BuildingBlockLabels, *bb_lib_,
+                [](const BuildingBlockItem &item) {
+                    std::string joined;
+                    for (const auto &label : item.labels) {
+                        joined += joined.empty() ? label : "\n" + label;
+                    }
+                    return joined;
+                });
+
+    write_blobs(writer, SectionId::IntermediatePickles, *int_lib_,
+                [](const IntermediateItem &item) { return item.molecule.pickle(); });
+    write_blobs(writer, SectionId::IntermediateSmiles, *int_lib_,
+                [](const IntermediateItem &item) { return item.molecule.smiles(); });
+    write_blobs(writer, SectionId::IntermediateIdentifiers, *int_lib_,
+                [](const IntermediateItem &item) { return item.identifier; });
+    write_blobs(writer, SectionId::IntermediatePostfixNotations, *int_lib_,
+                [](const IntermediateItem &item) {
+                    std::vector<std::uint64_t> values;
+                    for (const auto &token : item.postfix_notation.tokens()) {
+                        values.push_back(token.index);
+                        values.push_back(static_cast<std::uint64_t>(token.type));
+                    }
+                    return std::string(reinterpret_cast<const char *>(values.data()),
+                                       values.size() * sizeof(std::uint64_t));
+                });
+
+    auto write_lists = [&writer](SectionId id, const ReactantLists &lists, const auto &lib) {
+        // Lists are stored sorted, so that the heavy atom counts can be used in place
+        std::optional<ReactantLists> sorted_copy;
+        if (!lists.is_sorted_by_heavy_atoms()) {
+            sorted_copy = lists;
+            sorted_copy->sort_by_heavy_atoms(lib);
+        }
+        const auto &src = sorted_copy.has_value() ? *sorted_copy : lists;
+
+        writer.section(id, [&](std::ostream &os) {
+            write_u64(os, src.num_reactions());
+            write_u64(os, src.entry_begin_.size() - 1);
+            write_u64(os, src.entries_.size());
+            write_array(os, src.entry_begin_.view());
+            write_array(os, src.slot_begin_.view());
+            write_array(os, src.entries_.view());
+            write_array(os, src.heavy_atoms_.view());
+        });
+    };
+    write_lists(SectionId::BuildingBlockReactantLists, rnt_bb_mapping_, *bb_lib_);
+    write_lists(SectionId::IntermediateReactantLists, rnt_int_mapping_, *int_lib_);
+
+    write_match_index(writer, SectionId::BuildingBlockMatchIndex, bb_match_index_);
+
+    writer.finish({
+        .num_building_blocks = bb_lib_->size(),
+        .num_reactions = rxn_lib_->size(),
+        .num_intermediates = int_lib_->size(),
+    });
+    if (!os) {
+        throw std::runtime_error("failed to write chemical space: " + path.string());
+    }
+}
+
+// Pickles are read in place and decoded on first access, SMILES are copied out of the mapping
+static std::pair<BlobArrayView, BlobArrayView> molecule_blobs(const mapped_format::Reader &reader,
+                                                              SectionId pickles_id,
+                                                              SectionId smiles_id,
+                                                              size_t expected_size) {
+    BlobArrayView pickles(reader.section(pickles_id));
+    BlobArrayView smiles(reader.section(smiles_id));
+    if (pickles.size() != expected_size || smiles.size() != expected_size) {
+        throw FormatError("library size does not match the header");
+    }
+    return {pickles, smiles};
+}
+
+static std::set<std::string> split_labels(std::string_view joined) {
+    std::set<std::string> labels;
+    while (!joined.empty()) {
+        auto end = joined.find('\n');
+        labels.emplace(joined.substr(0, end));
+        joined = end == std::string_view::npos ? std::string_view{} : joined.substr(end + 1);
+    }
+    return labels;
+}
+
+static PostfixNotation decode_postfix_notation(std::string_view blob) {
+    if (blob.size() % (2 * sizeof(std::uint64_t)) != 0) {
+        throw FormatError("corrupted postfix notation");
+    }
+    PostfixNotation pfn;
+    for (size_t offset = 0; offset < blob.size(); offset += 2 * sizeof(std::uint64_t)) {
+        std::uint64_t index = 0, type = 0;
+        std::memcpy(&index, blob.data() + offset, sizeof(index));
+        std::memcpy(&type, blob.data() + offset + sizeof(index), sizeof(type));
+        if (type != PostfixNotation::Token::BuildingBlock &&
+            type != PostfixNotation::Token::Reaction) {
+            throw FormatError("corrupted postfix notation");
+        }
+        pfn.append(index, static_cast<PostfixNotation::Token::Type>(type));
+    }
+    return pfn;
+}
+
+// Values read in place as a type with the same size and layout
+template <typename T, typename U> static std::span<const T> same_layout(std::span<const U> values) {
+    static_assert(sizeof(T) == sizeof(U) && std::is_trivially_copyable_v<T>);
+    return mapped_format::read_array<T>(std::as_bytes(values), 0, values.size());
+}
+
+using MappedMatchEntry = mapped_format::MatchIndexView::Entry;
+static_assert(offsetof(ReactantMatchIndex::Entry, reaction_index) ==
+                  offsetof(MappedMatchEntry, reaction_index) &&
+              offsetof(ReactantMatchIndex::Entry, reactant_index) ==
+                  offsetof(MappedMatchEntry, reactant_index) &&
+              offsetof(ReactantMatchIndex::Entry, count) == offsetof(MappedMatchEntry, count));
+
+std::unique_ptr<ChemicalSpace> ChemicalSpace::load_mapped(const std::filesystem::path &path) {
+    logger()->info("Loading mapped chemical space...");
+    auto file = std::make_shared<const MappedFile>(path);
+    mapped_format::Reader reader(file->bytes());
+    const auto &header = reader.header();
+    logger()->info(" - Sizes: {} building blocks, {} reactions, {} intermediates",
+                   header.num_building_blocks, header.num_reactions, header.num_intermediates);
+
+    std::unique_ptr<ReactionLibrary> rxn_lib;
+    {
+        auto section = reader.section(SectionId::ReactionLibrary);
+        std::istringstream is(
+            std::string(reinterpret_cast<const char *>(section.data()), section.size()));
+        rxn_lib = ReactionLibrary::deserialize(is);
+    }
+    if (rxn_lib->size() != header.num_reactions) {
+        throw FormatError("reaction library size does not match the header");
+    }
+
+    auto bb_lib = std::make_unique<BuildingBlockLibrary>();
+    {
+        auto [pickles, smiles] =
+            molecule_blobs(reader, SectionId::BuildingBlockPickles,
+                           SectionId::BuildingBlockSmiles, header.num_building_blocks);
+        BlobArrayView identifiers(reader.section(SectionId::BuildingBlockIdentifiers));
+        BlobArrayView labels(reader.section(SectionId::BuildingBlockLabels));
+        if (identifiers.size() != pickles.size() || labels.size() != pickles.size()) {
+            throw FormatError("building block library size does not match the header");
+        }
+        bb_lib->reserve(pickles.size());
+        for (size_t i = 0; i < pickles.size(); ++i) {
+            bb_lib->add_serialized(LazyMolecule(pickles[i], file, std::string(smiles[i])),
+                                   std::string(identifiers[i]), split_labels(labels[i]));
+        }
+    }
+    logger()->info(" - Building block library loaded. Size: {}", bb_lib->size());
+
+    auto int_lib = std::make_unique<IntermediateLibrary>();
+    {
+        auto [pickles, smiles] =
+            molecule_blobs(reader, SectionId::IntermediatePickles, SectionId::IntermediateSmiles,
+                           header.num_intermediates);
+        BlobArrayView identifiers(reader.section(SectionId::IntermediateIdentifiers));
+        BlobArrayView notations(reader.section(SectionId::IntermediatePostfixNotations));
+        if (identifiers.size() != pickles.size() || notations.size() != pickles.size()) {
+            throw FormatError("intermediate library size does not match the header");
+        }
+        int_lib->reserve(pickles.size());
+        for (size_t i = 0; i < pickles.size(); ++i) {
+            int_lib->add_serialized(decode_postfix_notation(notations[i]),
+                                    LazyMolecule(pickles[i], file, std::string(smiles[i])),
+                                    std::string(identifiers[i]));
+        }
+    }
+    logger()->info(" - Intermediate library loaded. Size: {}", int_lib->size());
+
+    ReactantMatchingConfig matching_config;
+    auto config_section = reader.section(SectionId::MatchingConfig);
+    matching_config.selectivity_cutoff =
+        mapped_format::read_array<std::uint64_t>(config_section, 0, 1)[0];
+
+    auto chemspace = std::make_unique<ChemicalSpace>(std::move(bb_lib), std::move(rxn_lib),
+                                                     std::move(int_lib), matching_config);
+    chemspace->mapped_file_ = file;
+
+    auto load_lists = [&](ReactantLists &lists, SectionId id, size_t library_size) {
+        mapped_format::ReactantListsView view(reader.section(id));
+        const auto &rxn = *chemspace->rxn_lib_;
+        if (view.list_begin.size() != rxn.size() + 1) {
+            throw FormatError("reactant lists do not match the reaction library");
+        }
+        for (size_t i = 0; i < rxn.size(); ++i) {
+            auto num_reactants = view.list_begin[i + 1] - view.list_begin[i];
+            if (num_reactants != rxn.get(i).reaction->num_reactants()) {
+                throw FormatError("reactant lists do not match the reaction library");
+            }
+        }
+        if (std::ranges::any_of(view.molecules, [&](auto m) { return m >= library_size; })) {
+            throw FormatError("reactant list entry out of library bounds");
+        }
+        lists.slot_begin_ = {view.list_begin, file};
+        lists.entry_begin_ = {view.entry_begin, file};
+        lists.entries_ = {view.molecules, file};
+        lists.heavy_atoms_ = {view.heavy_atoms, file};
+    };
+    load_lists(chemspace->rnt_bb_mapping_, SectionId::BuildingBlockReactantLists,
+               chemspace->bb_lib_->size());
+    load_lists(chemspace->rnt_int_mapping_, SectionId::IntermediateReactantLists,
+               chemspace->int_lib_->size());
+    logger()->info(" - Reactant lists loaded. Matches: {}",
+                   chemspace->rnt_bb_mapping_.num_matches() +
+                       chemspace->rnt_int_mapping_.num_matches());
+
+    {
+        mapped_format::MatchIndexView view(reader.section(SectionId::BuildingBlockMatchIndex));
+        const auto &rxn = *chemspace->rxn_lib_;
+        // An empty index is stored for libraries whose reactant lists were never built
+        if (view.entry_begin.size() - 1 != chemspace->bb_lib_->size() &&
+            view.entry_begin.size() != 1) {
+            throw FormatError("match index size does not match the library");
+        }
+        for (const auto &entry : view.entries) {
+            if (entry.reaction_index >= rxn.size() ||
+                entry.reactant_index >= rxn.get(entry.reaction_index).reaction->num_reactants()) {
+                throw FormatError("match index entry out of reaction library bounds");
+            }
+        }
+        auto &index = chemspace->bb_match_index_;
+        index.max_count_ = view.max_count;
+        index.offsets_ = {same_layout<size_t>(view.entry_begin), file};
+        index.entries_ = {same_layout<ReactantMatchIndex::Entry>(view.entries), file};
+    }
+
+    return chemspace;
+}
+
+void ChemicalSpace::convert_to_mapped(std::istream &is, const std::filesystem::path &path) {
+    auto chemspace = deserialize(is);
+    chemspace->save_mapped(path);
+    logger()->info("Chemical space converted to the mapped format: {}", path.string());
+}
+
+} // namespace prexsyn::chemspace
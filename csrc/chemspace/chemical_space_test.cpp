@@ -1,13 +1,27 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <iterator>
 #include <memory>
+#include <numeric>
+#include <optional>
+#include <set>
+#include <span>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <gtest/gtest.h>
+#include <omp.h>
 
+#include "../utility/borrow.hpp"
 #include "chemspace.hpp"
+#include "mapped_format.hpp"
 
 namespace {
 
@@ -37,6 +51,82 @@ std::unique_ptr<ChemicalSpace> make_test_chemical_space() {
                                            std::make_unique<IntermediateLibrary>());
 }
 
+std::vector<std::string> sorted_smiles(const IntermediateLibrary &lib, auto &&indices) {
+    std::vector<std::string> smiles;
+    for (auto i : indices) {
+        smiles.push_back(lib.get(i).molecule.get()->smiles());
+    }
+    std::ranges::sort(smiles);
+    return smiles;
+}
+
+std::vector<std::string> sorted_identifiers(const prexsyn::chemspace::BuildingBlockLibrary &lib,
+                                            auto &&indices) {
+    std::vector<std::string> identifiers;
+    for (auto i : indices) {
+        identifiers.push_back(lib.get(i).identifier);
+    }
+    std::ranges::sort(identifiers);
+    return identifiers;
+}
+
+// Compares what a chemical space holds, regardless of the order of intermediates and of list
+// entries, which changed between versions
+void expect_same_contents(const ChemicalSpace &actual, const ChemicalSpace &expected,
+                          bool has_match_index) {
+    ASSERT_EQ(actual.bb_lib().size(), expected.bb_lib().size());
+    for (size_t i = 0; i < expected.bb_lib().size(); ++i) {
+        EXPECT_EQ(actual.bb_lib().get(i).identifier, expected.bb_lib().get(i).identifier);
+        EXPECT_EQ(actual.bb_lib().get(i).molecule.get()->smiles(),
+                  expected.bb_lib().get(i).molecule.get()->smiles());
+    }
+    ASSERT_EQ(actual.rxn_lib().size(), expected.rxn_lib().size());
+    for (size_t i = 0; i < expected.rxn_lib().size(); ++i) {
+        EXPECT_EQ(actual.rxn_lib().get(i).name, expected.rxn_lib().get(i).name);
+    }
+    ASSERT_EQ(actual.int_lib().size(), expected.int_lib().size());
+    auto all = [](const IntermediateLibrary &lib) {
+        std::vector<size_t> indices(lib.size());
+        std::iota(indices.begin(), indices.end(), 0);
+        return indices;
+    };
+    EXPECT_EQ(sorted_smiles(actual.int_lib(), all(actual.int_lib())),
+              sorted_smiles(expected.int_lib(), all(expected.int_lib())));
+
+    const auto &bb_lists = actual.building_block_reactant_lists();
+    const auto &int_lists = actual.intermediate_reactant_lists();
+    EXPECT_EQ(bb_lists.num_matches(), expected.building_block_reactant_lists().num_matches());
+    for (size_t i = 0; i < expected.rxn_lib().size(); ++i) {
+        for (size_t j = 0; j < expected.rxn_lib().get(i).reaction->num_reactants(); ++j) {
+            EXPECT_EQ(sorted_identifiers(actual.bb_lib(), bb_lists.get(i, j)),
+                      sorted_identifiers(expected.bb_lib(),
+                                         expected.building_block_reactant_lists().get(i, j)));
+            EXPECT_EQ(sorted_smiles(actual.int_lib(), int_lists.get(i, j)),
+                      sorted_smiles(expected.int_lib(),
+                                    expected.intermediate_reactant_lists().get(i, j)));
+        }
+    }
+
+    if (!has_match_index) {
+        return;
+    }
+    const auto &index = actual.building_block_match_index();
+    const auto &expected_index = expected.building_block_match_index();
+    ASSERT_EQ(index.size(), expected_index.size());
+    EXPECT_GT(index.num_entries(), 0U);
+    auto matches = [](std::span<const prexsyn::chemspace::ReactantMatchIndex::Entry> entries) {
+        std::vector<std::pair<size_t, size_t>> pairs;
+        for (const auto &entry : entries) {
+            pairs.emplace_back(entry.reaction_index, entry.reactant_index);
+        }
+        std::ranges::sort(pairs);
+        return pairs;
+    };
+    for (size_t i = 0; i < index.size(); ++i) {
+        EXPECT_EQ(matches(index.get(i)), matches(expected_index.get(i)));
+    }
+}
+
 } // namespace
 
 TEST(ChemicalSpaceTest, EndToEndWorkflowMatchesMainExample) {
@@ -94,3 +184,501 @@ TEST(ChemicalSpaceTest, EndToEndWorkflowMatchesMainExample) {
     EXPECT_EQ(syn2.count_building_blocks(), syn->count_building_blocks());
     EXPECT_EQ(syn2.count_reactions(), syn->count_reactions());
 }
+
+TEST(ChemicalSpaceTest, TrustedLoadMatchesVerifiedLoad) {
+    auto chemspace = make_test_chemical_space();
+    chemspace->build_reactant_lists_for_building_blocks();
+    chemspace->generate_intermediates();
+
+    std::stringstream ss;
+    chemspace->serialize(ss);
+    const auto data = ss.str();
+
+    std::stringstream trusted_ss(data);
+    auto trusted = ChemicalSpace::deserialize(trusted_ss);
+    std::stringstream verified_ss(data);
+    auto verified = ChemicalSpace::deserialize(verified_ss, /*verify=*/true);
+
+    // A trusted load must not decode library molecules
+    EXPECT_EQ(trusted->bb_lib().molecule_cache().stats().misses, 0U);
+    EXPECT_EQ(trusted->int_lib().molecule_cache().stats().misses, 0U);
+
+    ASSERT_EQ(trusted->bb_lib().size(), chemspace->bb_lib().size());
+    for (size_t i = 0; i < chemspace->bb_lib().size(); ++i) {
+        const auto expected = chemspace->bb_lib().get(i).molecule.get();
+        EXPECT_EQ(trusted->bb_lib().get(i).molecule.get()->smiles(), expected->smiles());
+        EXPECT_EQ(verified->bb_lib().get(i).molecule.get()->smiles(), expected->smiles());
+        EXPECT_EQ(trusted->bb_lib().get(i).molecule.get()->num_heavy_atoms(),
+                  expected->num_heavy_atoms());
+    }
+    ASSERT_EQ(trusted->int_lib().size(), chemspace->int_lib().size());
+    for (size_t i = 0; i < chemspace->int_lib().size(); ++i) {
+        EXPECT_EQ(trusted->int_lib().get(i).molecule.get()->smiles(),
+                  chemspace->int_lib().get(i).molecule.get()->smiles());
+    }
+
+    // Trusted molecules must still be usable for matching
+    const auto trusted_bb = trusted->bb_lib().get(0).molecule.get();
+    const auto bb = chemspace->bb_lib().get(0).molecule.get();
+    EXPECT_EQ(trusted->rxn_lib().match_reactants(*trusted_bb).size(),
+              chemspace->rxn_lib().match_reactants(*bb).size());
+}
+
+TEST(ChemicalSpaceTest, ReactantListsAreOrderedByHeavyAtoms) {
+    auto chemspace = make_test_chemical_space();
+    chemspace->build_reactant_lists_for_building_blocks();
+
+    const auto &lists = chemspace->building_block_reactant_lists();
+    for (size_t rxn = 0; rxn < chemspace->rxn_lib().size(); ++rxn) {
+        for (size_t rnt = 0; rnt < chemspace->rxn_lib().get(rxn).reaction->num_reactants(); ++rnt) {
+            const auto list = lists.get(rxn, rnt);
+            if (list.empty()) {
+                continue;
+            }
+            auto heavy_atoms = [&](size_t k) {
+                return chemspace->bb_lib().get(list[k]).molecule.get()->num_heavy_atoms();
+            };
+            for (size_t k = 1; k < list.size(); ++k) {
+                EXPECT_LE(heavy_atoms(k - 1), heavy_atoms(k));
+            }
+
+            const auto limit = heavy_atoms(list.size() / 2);
+            const auto within = lists.get_within(rxn, rnt, limit);
+            ASSERT_GT(within.size(), list.size() / 2);
+            EXPECT_EQ(within.data(), list.data());
+            if (within.size() < list.size()) {
+                EXPECT_GT(heavy_atoms(within.size()), limit);
+            }
+        }
+    }
+}
+
+TEST(ChemicalSpaceTest, ReactantListsBuilderFlattensSlots) {
+    auto chemspace = make_test_chemical_space();
+    const auto &rxn_lib = chemspace->rxn_lib();
+    ASSERT_GT(rxn_lib.size(), 1U);
+
+    prexsyn::chemspace::ReactantLists::Builder builder(rxn_lib);
+    builder.add(3, 0, 0);
+    builder.add(1, 0, 0);
+    builder.set(1, 0, {5, 2, 7});
+    auto lists = builder.build();
+
+    ASSERT_EQ(lists.num_reactions(), rxn_lib.size());
+    EXPECT_EQ(lists.num_reactants(0), rxn_lib.get(0).reaction->num_reactants());
+    EXPECT_EQ(lists.num_matches(), 5U);
+    EXPECT_TRUE(std::ranges::equal(lists.get(0, 0), std::vector<std::uint32_t>{3, 1}));
+    EXPECT_TRUE(std::ranges::equal(lists.get(1, 0), std::vector<std::uint32_t>{5, 2, 7}));
+    // Unsorted lists are returned whole
+    EXPECT_EQ(lists.get_within(1, 0, 0).size(), 3U);
+    EXPECT_THROW(lists.get(rxn_lib.size(), 0), std::out_of_range);
+
+    prexsyn::chemspace::ReactantLists::Builder editor(lists);
+    editor.set(0, 0, {});
+    auto edited = editor.build();
+    EXPECT_TRUE(edited.get(0, 0).empty());
+    EXPECT_TRUE(std::ranges::equal(edited.get(1, 0), lists.get(1, 0)));
+}
+
+TEST(ChemicalSpaceTest, SettingSortedReactantListsSortsThemAgain) {
+    auto chemspace = make_test_chemical_space();
+    chemspace->build_reactant_lists_for_building_blocks();
+    const auto &bb_lib = chemspace->bb_lib();
+    ASSERT_GT(bb_lib.size(), 4U);
+    auto lists = chemspace->building_block_reactant_lists();
+    ASSERT_TRUE(lists.is_sorted_by_heavy_atoms());
+
+    // The heavy atom counts of the new entries are not known without the library
+    EXPECT_THROW(lists.set(0, 0, {3, 0, 2}), std::logic_error);
+
+    lists.set(0, 0, {3, 0, 2}, bb_lib);
+    EXPECT_TRUE(lists.is_sorted_by_heavy_atoms());
+    auto list = lists.get(0, 0);
+    ASSERT_EQ(list.size(), 3U);
+    EXPECT_TRUE(std::ranges::is_sorted(list, {}, [&bb_lib](auto index) {
+        return bb_lib.get(index).molecule.get()->num_heavy_atoms();
+    }));
+    const auto min_heavy_atoms = bb_lib.get(list[0]).molecule.get()->num_heavy_atoms();
+    EXPECT_FALSE(lists.get_within(0, 0, min_heavy_atoms).empty());
+    EXPECT_TRUE(lists.get_within(0, 0, min_heavy_atoms - 1).empty());
+}
+
+TEST(ChemicalSpaceTest, ReactantListsDoNotDependOnThreadCount) {
+    const int default_threads = omp_get_max_threads();
+    auto build = [](int num_threads) {
+        omp_set_num_threads(num_threads);
+        auto chemspace = make_test_chemical_space();
+        chemspace->build_reactant_lists_for_building_blocks();
+        chemspace->generate_intermediates();
+        chemspace->build_reactant_lists_for_intermediates();
+        return chemspace;
+    };
+    auto serial = build(1);
+    auto parallel = build(4);
+    omp_set_num_threads(default_threads);
+
+    EXPECT_EQ(parallel->building_block_reactant_lists().num_matches(),
+              serial->building_block_reactant_lists().num_matches());
+    for (size_t rxn = 0; rxn < serial->rxn_lib().size(); ++rxn) {
+        for (size_t rnt = 0; rnt < serial->rxn_lib().get(rxn).reaction->num_reactants(); ++rnt) {
+            EXPECT_TRUE(std::ranges::equal(parallel->building_block_reactant_lists().get(rxn, rnt),
+                                           serial->building_block_reactant_lists().get(rxn, rnt)));
+        }
+    }
+
+    ASSERT_EQ(parallel->int_lib().size(), serial->int_lib().size());
+    for (size_t i = 0; i < serial->int_lib().size(); ++i) {
+        EXPECT_EQ(parallel->int_lib().get(i).identifier, serial->int_lib().get(i).identifier);
+    }
+    for (size_t rxn = 0; rxn < serial->rxn_lib().size(); ++rxn) {
+        for (size_t rnt = 0; rnt < serial->rxn_lib().get(rxn).reaction->num_reactants(); ++rnt) {
+            EXPECT_TRUE(std::ranges::equal(parallel->intermediate_reactant_lists().get(rxn, rnt),
+                                           serial->intermediate_reactant_lists().get(rxn, rnt)));
+        }
+    }
+}
+
+TEST(ChemicalSpaceTest, IntermediatesAreOrderedAndUnique) {
+    auto chemspace = make_test_chemical_space();
+    chemspace->build_reactant_lists_for_building_blocks();
+    chemspace->generate_intermediates();
+
+    const auto &int_lib = chemspace->int_lib();
+    ASSERT_GT(int_lib.size(), 0U);
+    std::pair<size_t, size_t> prev_key{0, 0};
+    std::set<std::string> pair_smiles;
+    for (size_t i = 0; i < int_lib.size(); ++i) {
+        const auto &item = int_lib.get(i);
+        const auto key = std::pair(item.postfix_notation.tokens().at(0).index,
+                                   item.postfix_notation.tokens().at(1).index);
+        EXPECT_LE(prev_key, key);
+        if (key != prev_key) {
+            pair_smiles.clear();
+        }
+        EXPECT_TRUE(pair_smiles.insert(item.molecule.get()->smiles()).second) << item.identifier;
+        prev_key = key;
+    }
+}
+
+TEST(ChemicalSpaceTest, ScreenedMatchesEqualPerReactionMatches) {
+    auto chemspace = make_test_chemical_space();
+    const auto &rxn_lib = chemspace->rxn_lib();
+    for (size_t i = 0; i < chemspace->bb_lib().size(); ++i) {
+        const auto molecule_ptr = chemspace->bb_lib().get(i).molecule.get();
+        const auto &molecule = *molecule_ptr;
+        std::vector<std::pair<size_t, size_t>> expected;
+        for (size_t rxn = 0; rxn < rxn_lib.size(); ++rxn) {
+            for (const auto &match : rxn_lib.get(rxn).reaction->match_reactants(molecule)) {
+                expected.emplace_back(rxn, match.count);
+            }
+        }
+        std::vector<std::pair<size_t, size_t>> actual;
+        for (const auto &match : rxn_lib.match_reactants(molecule)) {
+            actual.emplace_back(match.reaction_index, match.count);
+        }
+        EXPECT_EQ(actual, expected) << molecule.smiles();
+    }
+}
+
+TEST(ChemicalSpaceTest, MatchIndexHoldsLibraryMatchesAndIsSerialized) {
+    auto chemspace = make_test_chemical_space();
+    chemspace->build_reactant_lists_for_building_blocks();
+
+    std::stringstream ss;
+    chemspace->serialize(ss);
+    auto deserialized = ChemicalSpace::deserialize(ss);
+
+    const auto max_count = chemspace->reactant_matching_config().max_count();
+    for (const auto *cs : {chemspace.get(), deserialized.get()}) {
+        const auto &index = cs->building_block_match_index();
+        ASSERT_EQ(index.size(), cs->bb_lib().size());
+        EXPECT_EQ(index.max_count(), max_count);
+        for (size_t i = 0; i < cs->bb_lib().size(); ++i) {
+            const auto expected = cs->rxn_lib().match_reactants(*cs->bb_lib().get(i).molecule.get(),
+                                                                max_count);
+            const auto entries = index.get(i);
+            ASSERT_EQ(entries.size(), expected.size());
+            for (size_t k = 0; k < entries.size(); ++k) {
+                EXPECT_EQ(entries[k].reaction_index, expected[k].reaction_index);
+                EXPECT_EQ(entries[k].reactant_index, expected[k].reactant_index);
+                EXPECT_EQ(entries[k].count, expected[k].count);
+            }
+        }
+    }
+}
+
+TEST(ChemicalSpaceTest, MappedFormatRoundTripsAndPeeks) {
+    auto chemspace = make_test_chemical_space();
+    chemspace->build_reactant_lists_for_building_blocks();
+    chemspace->generate_intermediates();
+    chemspace->build_reactant_lists_for_intermediates();
+
+    const auto path = std::filesystem::temp_directory_path() / "prexsyn_mapped_format_test.bin";
+    std::stringstream ss;
+    chemspace->serialize(ss);
+    ChemicalSpace::convert_to_mapped(ss, path);
+
+    {
+        std::ifstream ifs(path, std::ios::binary);
+        auto stats = ChemicalSpace::peek(ifs);
+        EXPECT_EQ(stats.num_building_blocks, chemspace->bb_lib().size());
+        EXPECT_EQ(stats.num_reactions, chemspace->rxn_lib().size());
+        EXPECT_EQ(stats.num_intermediates, chemspace->int_lib().size());
+    }
+
+    auto loaded = ChemicalSpace::load_mapped(path);
+    std::filesystem::remove(path);
+
+    ASSERT_EQ(loaded->bb_lib().size(), chemspace->bb_lib().size());
+    for (size_t i = 0; i < chemspace->bb_lib().size(); ++i) {
+        const auto &expected = chemspace->bb_lib().get(i);
+        const auto &actual = loaded->bb_lib().get(i);
+        EXPECT_EQ(actual.identifier, expected.identifier);
+        EXPECT_EQ(actual.labels, expected.labels);
+        EXPECT_EQ(actual.molecule.get()->smiles(), expected.molecule.get()->smiles());
+    }
+    ASSERT_EQ(loaded->int_lib().size(), chemspace->int_lib().size());
+    for (size_t i = 0; i < chemspace->int_lib().size(); ++i) {
+        const auto &expected = chemspace->int_lib().get(i);
+        const auto &actual = loaded->int_lib().get(i);
+        EXPECT_EQ(actual.identifier, expected.identifier);
+        EXPECT_EQ(actual.molecule.get()->smiles(), expected.molecule.get()->smiles());
+        ASSERT_EQ(actual.postfix_notation.size(), expected.postfix_notation.size());
+        for (size_t k = 0; k < expected.postfix_notation.size(); ++k) {
+            EXPECT_EQ(actual.postfix_notation.tokens()[k].index,
+                      expected.postfix_notation.tokens()[k].index);
+            EXPECT_EQ(actual.postfix_notation.tokens()[k].type,
+                      expected.postfix_notation.tokens()[k].type);
+        }
+    }
+
+    ASSERT_EQ(loaded->rxn_lib().size(), chemspace->rxn_lib().size());
+    EXPECT_EQ(loaded->reactant_matching_config().selectivity_cutoff,
+              chemspace->reactant_matching_config().selectivity_cutoff);
+    for (size_t i = 0; i < chemspace->rxn_lib().size(); ++i) {
+        EXPECT_EQ(loaded->rxn_lib().get(i).name, chemspace->rxn_lib().get(i).name);
+        for (size_t j = 0; j < chemspace->rxn_lib().get(i).reaction->num_reactants(); ++j) {
+            EXPECT_TRUE(std::ranges::equal(loaded->building_block_reactant_lists().get(i, j),
+                                           chemspace->building_block_reactant_lists().get(i, j)));
+            EXPECT_TRUE(std::ranges::equal(loaded->intermediate_reactant_lists().get(i, j),
+                                           chemspace->intermediate_reactant_lists().get(i, j)));
+            const auto within = loaded->building_block_reactant_lists().get_within(i, j, 10);
+            const auto expected_within =
+                chemspace->building_block_reactant_lists().get_within(i, j, 10);
+            EXPECT_EQ(within.size(), expected_within.size());
+        }
+    }
+    EXPECT_EQ(loaded->building_block_reactant_lists().num_matches(),
+              chemspace->building_block_reactant_lists().num_matches());
+
+    const auto &index = loaded->building_block_match_index();
+    const auto &expected_index = chemspace->building_block_match_index();
+    ASSERT_EQ(index.size(), expected_index.size());
+    EXPECT_EQ(index.max_count(), expected_index.max_count());
+    EXPECT_EQ(index.num_entries(), expected_index.num_entries());
+    for (size_t i = 0; i < index.size(); ++i) {
+        ASSERT_EQ(index.get(i).size(), expected_index.get(i).size());
+        for (size_t k = 0; k < index.get(i).size(); ++k) {
+            EXPECT_EQ(index.get(i)[k].reaction_index, expected_index.get(i)[k].reaction_index);
+            EXPECT_EQ(index.get(i)[k].count, expected_index.get(i)[k].count);
+        }
+    }
+}
+
+TEST(ChemicalSpaceTest, MappedListsOutliveTheirChemicalSpace) {
+    auto chemspace = make_test_chemical_space();
+    chemspace->build_reactant_lists_for_building_blocks();
+    const auto path = std::filesystem::temp_directory_path() / "prexsyn_mapped_lifetime_test.bin";
+    chemspace->save_mapped(path);
+
+    auto loaded = ChemicalSpace::load_mapped(path);
+    std::filesystem::remove(path);
+    auto lists = loaded->building_block_reactant_lists();
+    auto index = loaded->building_block_match_index();
+    loaded.reset();
+
+    EXPECT_EQ(lists.num_matches(), chemspace->building_block_reactant_lists().num_matches());
+    EXPECT_TRUE(std::ranges::equal(lists.get(0, 0),
+                                   chemspace->building_block_reactant_lists().get(0, 0)));
+    EXPECT_EQ(index.num_entries(), chemspace->building_block_match_index().num_entries());
+
+    // Modifying the lists copies them out of the mapping
+    lists.sort_by_heavy_atoms(chemspace->bb_lib());
+    EXPECT_TRUE(std::ranges::equal(lists.get(0, 0),
+                                   chemspace->building_block_reactant_lists().get(0, 0)));
+}
+
+TEST(ChemicalSpaceTest, MappedFormatRejectsCorruptedOffsets) {
+    namespace mapped_format = prexsyn::chemspace::mapped_format;
+    auto chemspace = make_test_chemical_space();
+    chemspace->build_reactant_lists_for_building_blocks();
+    const auto path = std::filesystem::temp_directory_path() / "prexsyn_mapped_corrupted_test.bin";
+    chemspace->save_mapped(path);
+
+    std::string bytes;
+    {
+        std::ifstream ifs(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(ifs), {});
+    }
+    size_t lists_offset = 0;
+    {
+        // Copied so that the sections are aligned like they are in a mapping
+        std::vector<std::uint64_t> aligned((bytes.size() + 7) / 8);
+        std::memcpy(aligned.data(), bytes.data(), bytes.size());
+        std::span<const std::byte> data(reinterpret_cast<const std::byte *>(aligned.data()),
+                                        bytes.size());
+        mapped_format::Reader reader(data);
+        lists_offset = static_cast<size_t>(
+            reader.section(mapped_format::SectionId::BuildingBlockReactantLists).data() -
+            data.data());
+    }
+    // Where the second list begins, after the three counts and the start of the first list
+    const std::uint64_t out_of_range = 1ULL << 40;
+    std::memcpy(bytes.data() + lists_offset + 4 * sizeof(std::uint64_t), &out_of_range,
+                sizeof(out_of_range));
+    {
+        std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+        ofs.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    }
+
+    EXPECT_THROW(ChemicalSpace::load_mapped(path), mapped_format::FormatError);
+    std::filesystem::remove(path);
+}
+
+TEST(ChemicalSpaceTest, DeserializedMoleculesAreDecodedOnAccess) {
+    auto chemspace = make_test_chemical_space();
+    chemspace->build_reactant_lists_for_building_blocks();
+    ASSERT_GT(chemspace->bb_lib().size(), 4U);
+    EXPECT_TRUE(chemspace->bb_lib().get(0).molecule.is_resident());
+
+    std::stringstream ss;
+    chemspace->serialize(ss);
+    auto loaded = ChemicalSpace::deserialize(ss);
+    const auto &bb_lib = loaded->bb_lib();
+    auto &cache = bb_lib.molecule_cache();
+    EXPECT_EQ(cache.stats().size, 0U);
+
+    cache.set_capacity(2);
+    for (size_t i = 0; i < bb_lib.size(); ++i) {
+        const auto &item = bb_lib.get(i);
+        EXPECT_FALSE(item.molecule.is_resident());
+        // Known without decoding the molecule
+        EXPECT_EQ(item.molecule.smiles(), chemspace->bb_lib().get(i).molecule.smiles());
+        EXPECT_EQ(item.molecule.get()->smiles(),
+                  chemspace->bb_lib().get(i).molecule.get()->smiles());
+    }
+    EXPECT_LE(cache.stats().size, cache.capacity());
+
+    bb_lib.pin(0);
+    for (size_t i = 1; i < bb_lib.size(); ++i) {
+        bb_lib.get(i).molecule.get();
+    }
+    const auto stats = cache.stats();
+    EXPECT_EQ(stats.pinned, 1U);
+    EXPECT_LE(stats.size, stats.capacity + stats.pinned);
+    EXPECT_EQ(bb_lib.get(0).molecule.get(), bb_lib.get(0).molecule.get());
+
+    // Pinned molecules are borrowed, the others may be evicted while they are used
+    EXPECT_TRUE(prexsyn::is_borrowed(bb_lib.get(0).molecule.borrow()));
+    EXPECT_FALSE(prexsyn::is_borrowed(bb_lib.get(1).molecule.borrow()));
+
+    // A molecule stays valid after it is evicted, and its derived data outlives it
+    const auto key = prexsyn::Molecule::new_derived_key();
+    auto held = bb_lib.get(1).molecule.get();
+    held->set_derived(key, std::make_shared<int>(42));
+    cache.clear();
+    EXPECT_EQ(cache.stats().size, 1U);
+    EXPECT_EQ(held->smiles(), chemspace->bb_lib().get(1).molecule.smiles());
+    auto decoded_again = bb_lib.get(1).molecule.get();
+    EXPECT_NE(decoded_again, held);
+    EXPECT_EQ(decoded_again->derived(key), held->derived(key));
+}
+
+TEST(ChemicalSpaceTest, ReactionCacheFilesAreTiedToTheirReactionLibrary) {
+    auto chemspace = make_test_chemical_space();
+    ASSERT_GT(chemspace->rxn_lib().size(), 1U);
+    chemspace->enable_reaction_cache(64);
+    auto syn = chemspace->new_synthesis();
+    ASSERT_TRUE(syn->add_building_block("EN300-250786"));
+    ASSERT_TRUE(syn->add_building_block("EN300-101318"));
+    ASSERT_TRUE(syn->add_reaction("ReactionA", std::nullopt));
+    ASSERT_GT(chemspace->reaction_cache()->size(), 0U);
+    std::stringstream ss;
+    chemspace->reaction_cache()->save(ss);
+    const auto saved = ss.str();
+
+    // The same reactions in another order, so that reaction indices refer to other reactions
+    auto reordered = std::make_unique<prexsyn::chemspace::ReactionLibrary>();
+    for (auto it = chemspace->rxn_lib().end(); it != chemspace->rxn_lib().begin();) {
+        --it;
+        reordered->add({.reaction = it->reaction, .name = it->name});
+    }
+    const auto bb_path = find_project_root() / "resources/test/chemspace_small_1/bb.sdf";
+    ChemicalSpace other(prexsyn::chemspace::bb_lib_from_sdf(bb_path), std::move(reordered));
+    other.enable_reaction_cache(64);
+    std::stringstream for_other(saved);
+    EXPECT_THROW(other.reaction_cache()->load(for_other), std::runtime_error);
+
+    auto rebuilt = make_test_chemical_space();
+    rebuilt->enable_reaction_cache(64);
+    std::stringstream for_rebuilt(saved);
+    rebuilt->reaction_cache()->load(for_rebuilt);
+    EXPECT_EQ(rebuilt->reaction_cache()->size(), chemspace->reaction_cache()->size());
+}
+
+TEST(ChemicalSpaceTest, OlderSerializationVersionsStillLoad) {
+    // Written by the serializers of versions 1 to 5, for an empty chemical space with a
+    // selectivity cutoff of 3
+    const auto fixtures = find_project_root() / "resources/test/chemspace_versions";
+    for (int version = 1; version <= 5; ++version) {
+        SCOPED_TRACE("version " + std::to_string(version));
+        std::ifstream ifs(fixtures / ("v" + std::to_string(version) + ".bin"), std::ios::binary);
+        ASSERT_TRUE(ifs.is_open());
+
+        const auto stats = ChemicalSpace::peek(ifs);
+        EXPECT_EQ(stats.num_building_blocks, 0U);
+        EXPECT_EQ(stats.num_reactions, 0U);
+        EXPECT_EQ(stats.num_intermediates, 0U);
+
+        ifs.seekg(0);
+        auto loaded = ChemicalSpace::deserialize(ifs);
+        EXPECT_EQ(loaded->reactant_matching_config().selectivity_cutoff, 3U);
+
+        std::stringstream ss;
+        loaded->serialize(ss);
+        auto reloaded = ChemicalSpace::deserialize(ss);
+        EXPECT_EQ(reloaded->bb_lib().size(), 0U);
+        EXPECT_EQ(reloaded->rxn_lib().size(), 0U);
+        EXPECT_EQ(reloaded->int_lib().size(), 0U);
+        EXPECT_EQ(reloaded->reactant_matching_config().selectivity_cutoff, 3U);
+        EXPECT_EQ(reloaded->building_block_reactant_lists().num_matches(), 0U);
+        EXPECT_EQ(reloaded->building_block_match_index().size(), 0U);
+    }
+}
+
+TEST(ChemicalSpaceTest, OlderSerializationVersionsKeepTheirContents) {
+    // Written by scripts/make_chemspace_fixture.py with the builds of versions 1 to 5, from
+    // resources/test/chemspace_small_1
+    const auto fixtures = find_project_root() / "resources/test/chemspace_versions";
+    auto expected = make_test_chemical_space();
+    expected->build_reactant_lists_for_building_blocks();
+    expected->generate_intermediates();
+    expected->build_reactant_lists_for_intermediates();
+
+    size_t num_checked = 0;
+    for (int version = 1; version <= 5; ++version) {
+        const auto path = fixtures / ("small_1_v" + std::to_string(version) + ".bin");
+        if (!std::filesystem::exists(path)) {
+            continue;
+        }
+        SCOPED_TRACE(path.string());
+        ++num_checked;
+        std::ifstream ifs(path, std::ios::binary);
+        // Verified, so that every molecule pickle is decoded
+        auto loaded = ChemicalSpace::deserialize(ifs, /*verify=*/true);
+        expect_same_contents(*loaded, *expected, /*has_match_index=*/version >= 3);
+    }
+    if (num_checked == 0) {
+        GTEST_SKIP() << "no chemical space fixtures with contents in " << fixtures;
+    }
+}
@@ -5,6 +5,7 @@
 #include "bb_lib_factory.hpp"
 #include "chemical_space.hpp"
 #include "int_lib.hpp"
+#include "molecule_cache.hpp"
 #include "postfix_notation.hpp"
 #include "rxn_lib.hpp"
 #include "rxn_lib_factory.hpp"
@@ -4,10 +4,13 @@
 #include <istream>
 #include <memory>
 #include <ostream>
+#include <span>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <utility>
 
+#include "../utility/chunked_archive.hpp"
 #include "../utility/serialization.hpp"
 
 namespace prexsyn::chemspace {
@@ -21,6 +24,8 @@ std::unique_ptr<IntermediateLibrary> IntermediateLibrary::deserialize(std::istre
     for (size_t i = 0; i < num_items; ++i) {
         IntermediateItem item;
         ia >> item;
+        // Molecules stay serialized until they are first accessed
+        item.molecule.attach(int_lib->molecule_cache_.get(), i);
         int_lib->intermediates_.push_back(std::move(item));
     }
     ia >> int_lib->identifier_to_index_;
@@ -36,6 +41,29 @@ void IntermediateLibrary::serialize(std::ostream &stream) const {
     oa << identifier_to_index_;
 }
 
+std::unique_ptr<IntermediateLibrary> IntermediateLibrary::deserialize_chunked(std::istream &data) {
+    auto int_lib = std::make_unique<IntermediateLibrary>();
+    int_lib->intermediates_ = read_chunked<IntermediateItem>(data);
+    for (size_t i = 0; i < int_lib->intermediates_.size(); ++i) {
+        // Molecules stay serialized until they are first accessed
+        int_lib->intermediates_[i].molecule.attach(int_lib->molecule_cache_.get(), i);
+    }
+    std::istringstream is(read_section(data));
+    boost::archive::binary_iarchive ia(is);
+    ia >> int_lib->identifier_to_index_;
+    return int_lib;
+}
+
+void IntermediateLibrary::serialize_chunked(std::ostream &stream) const {
+    write_chunked(stream, std::span<const IntermediateItem>(intermediates_));
+    std::ostringstream os;
+    {
+        boost::archive::binary_oarchive oa(os);
+        oa << identifier_to_index_;
+    }
+    write_section(stream, std::move(os).str());
+}
+
 const IntermediateItem &IntermediateLibrary::get(Index index) const {
     if (index >= intermediates_.size()) {
         throw std::out_of_range("Intermediate index out of range");
@@ -51,20 +79,43 @@ const IntermediateItem &IntermediateLibrary::get(const std::string &identifier)
     return intermediates_[it->second];
 }
 
-IntermediateLibrary::Index IntermediateLibrary::add(const IntermediateEntry &entry) {
-    if (identifier_to_index_.contains(entry.identifier)) {
+IntermediateLibrary::Index IntermediateLibrary::insert(IntermediateItem item) {
+    if (identifier_to_index_.contains(item.identifier)) {
         throw std::invalid_argument("Intermediate with the same identifier already exists: " +
-                                    entry.identifier);
+                                    item.identifier);
     }
-    auto new_index = intermediates_.size();
-    intermediates_.push_back(IntermediateItem{entry, new_index});
-    identifier_to_index_[entry.identifier] = new_index;
-    return new_index;
+    item.index = intermediates_.size();
+    item.molecule.attach(molecule_cache_.get(), item.index);
+    identifier_to_index_[item.identifier] = item.index;
+    intermediates_.push_back(std::move(item));
+    return intermediates_.back().index;
+}
+
+IntermediateLibrary::Index IntermediateLibrary::add(const IntermediateEntry &entry) {
+    // Library molecules are read concurrently by workers, canonicalize before publishing them
+    entry.molecule->smiles();
+    return insert({
+        .postfix_notation = entry.postfix_notation,
+        .molecule = entry.molecule,
+        .identifier = entry.identifier,
+    });
+}
+
+IntermediateLibrary::Index IntermediateLibrary::add_serialized(PostfixNotation postfix_notation,
+                                                               LazyMolecule molecule,
+                                                               std::string identifier) {
+    return insert({
+        .postfix_notation = std::move(postfix_notation),
+        .molecule = std::move(molecule),
+        .identifier = std::move(identifier),
+    });
 }
 
 void IntermediateLibrary::clear() {
     intermediates_.clear();
     identifier_to_index_.clear();
+    // Indices are reused, and copies of this library may still use the old cache
+    molecule_cache_ = std::make_shared<MoleculeCache>(molecule_cache_->capacity());
 }
 
 } // namespace prexsyn::chemspace
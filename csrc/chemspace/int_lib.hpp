@@ -6,9 +6,13 @@
 #include <memory>
 #include <ostream>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include <boost/serialization/version.hpp>
+
 #include "../chemistry/chemistry.hpp"
+#include "molecule_cache.hpp"
 #include "postfix_notation.hpp"
 
 namespace prexsyn::chemspace {
@@ -19,16 +23,28 @@ struct IntermediateEntry {
     std::string identifier;
 };
 
-struct IntermediateItem : IntermediateEntry {
+struct IntermediateItem {
+    PostfixNotation postfix_notation;
+    // Resident for generated intermediates, decoded on access for deserialized ones
+    LazyMolecule molecule;
+    std::string identifier;
     size_t index{};
 
-    template <typename Archive> void serialize(Archive &ar, const unsigned int /* version */) {
+    template <typename Archive> void serialize(Archive &ar, const unsigned int version) {
         if constexpr (Archive::is_saving::value) {
-            ar << molecule->serialize();
+            ar << molecule.pickle();
+            ar << molecule.smiles();
         } else {
             std::string mol_data;
             ar >> mol_data;
-            molecule = Molecule::deserialize(mol_data);
+            if (version >= 1) {
+                // Written from a sanitized molecule together with its canonical SMILES
+                std::string smiles;
+                ar >> smiles;
+                molecule = LazyMolecule(std::move(mol_data), std::move(smiles));
+            } else {
+                molecule = std::shared_ptr<Molecule>(Molecule::deserialize(mol_data));
+            }
         }
         ar & postfix_notation;
         ar & identifier;
@@ -43,21 +59,38 @@ public:
 private:
     std::vector<IntermediateItem> intermediates_;
     std::map<std::string, Index> identifier_to_index_;
+    std::shared_ptr<MoleculeCache> molecule_cache_ = std::make_shared<MoleculeCache>();
+
+    Index insert(IntermediateItem);
 
 public:
     IntermediateLibrary() = default;
 
     static std::unique_ptr<IntermediateLibrary> deserialize(std::istream &);
     void serialize(std::ostream &) const;
+    // Form used by ChemicalSpace, with items in chunks that are encoded and decoded in parallel
+    static std::unique_ptr<IntermediateLibrary> deserialize_chunked(std::istream &);
+    void serialize_chunked(std::ostream &) const;
 
     size_t size() const { return intermediates_.size(); }
     const IntermediateItem &get(Index) const;
     const IntermediateItem &get(const std::string &) const;
     Index add(const IntermediateEntry &);
+    // Adds an intermediate that is decoded on first access, see LazyMolecule
+    Index add_serialized(PostfixNotation postfix_notation, LazyMolecule molecule,
+                         std::string identifier);
+    void reserve(size_t capacity) { intermediates_.reserve(capacity); }
     void clear();
 
+    // Decoded intermediates, shared by copies of this library
+    MoleculeCache &molecule_cache() const { return *molecule_cache_; }
+    // Keeps a frequently used intermediate decoded for good
+    void pin(Index index) const { get(index).molecule.pin(); }
+
     auto begin() const noexcept { return intermediates_.begin(); }
     auto end() const noexcept { return intermediates_.end(); }
 };
 
 } // namespace prexsyn::chemspace
+
+BOOST_CLASS_VERSION(prexsyn::chemspace::IntermediateItem, 1)
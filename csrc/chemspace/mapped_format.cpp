@@ -0,0 +1,168 @@
+#include "mapped_format.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace prexsyn::chemspace::mapped_format {
+
+static constexpr size_t kTableOffset = sizeof(Header);
+static constexpr size_t kSectionsOffset = kTableOffset + kMaxSections * sizeof(SectionEntry);
+
+Writer::Writer(std::ostream &os) : os_(os), base_(os.tellp()) {
+    if (base_ < 0) {
+        throw FormatError("the mapped format requires a seekable output stream");
+    }
+    // Placeholders, see finish()
+    std::vector<char> zeros(kSectionsOffset, 0);
+    os_.write(zeros.data(), static_cast<std::streamsize>(zeros.size()));
+}
+
+std::uint64_t Writer::position() const {
+    return static_cast<std::uint64_t>(os_.tellp() - base_);
+}
+
+void Writer::align() {
+    static constexpr std::array<char, kSectionAlignment> zeros{};
+    auto padding = (kSectionAlignment - position() % kSectionAlignment) % kSectionAlignment;
+    os_.write(zeros.data(), static_cast<std::streamsize>(padding));
+}
+
+void Writer::finish(Header header) {
+    align();
+    auto end = os_.tellp();
+
+    header.magic = kMagic;
+    header.format_version = kFormatVersion;
+    header.num_sections = static_cast<std::uint32_t>(sections_.size());
+    os_.seekp(base_);
+    os_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    write_array(os_, std::span<const SectionEntry>(sections_));
+    os_.seekp(end);
+    if (!os_) {
+        throw FormatError("failed to write mapped chemical space");
+    }
+}
+
+void write_blob_array(std::ostream &os, std::span<const std::string> blobs) {
+    std::vector<std::uint64_t> offsets;
+    offsets.reserve(blobs.size() + 1);
+    offsets.push_back(0);
+    for (const auto &blob : blobs) {
+        offsets.push_back(offsets.back() + blob.size());
+    }
+    write_u64(os, blobs.size());
+    write_array(os, std::span<const std::uint64_t>(offsets));
+    for (const auto &blob : blobs) {
+        os.write(blob.data(), static_cast<std::streamsize>(blob.size()));
+    }
+}
+
+Reader::Reader(std::span<const std::byte> data) : data_(data) {
+    if (data_.size() < kSectionsOffset || !has_magic(data_)) {
+        throw FormatError("not a mapped chemical space file");
+    }
+    std::memcpy(&header_, data_.data(), sizeof(header_));
+    if (header_.format_version != kFormatVersion) {
+        throw FormatError("unsupported mapped chemical space version: " +
+                          std::to_string(header_.format_version));
+    }
+    if (header_.num_sections > kMaxSections) {
+        throw FormatError("corrupted section table");
+    }
+    sections_.resize(header_.num_sections);
+    std::memcpy(sections_.data(), data_.data() + kTableOffset,
+                sections_.size() * sizeof(SectionEntry));
+    for (const auto &entry : sections_) {
+        if (entry.offset % kSectionAlignment != 0 || entry.offset > data_.size() ||
+            entry.size > data_.size() - entry.offset) {
+            throw FormatError("section " + std::to_string(entry.id) + " out of file bounds");
+        }
+    }
+}
+
+bool Reader::has_section(SectionId id) const {
+    return std::ranges::any_of(sections_, [id](const SectionEntry &entry) {
+        return entry.id == static_cast<std::uint32_t>(id);
+    });
+}
+
+std::span<const std::byte> Reader::section(SectionId id) const {
+    for (const auto &entry : sections_) {
+        if (entry.id == static_cast<std::uint32_t>(id)) {
+            return data_.subspan(entry.offset, entry.size);
+        }
+    }
+    throw FormatError("missing section " + std::to_string(static_cast<std::uint32_t>(id)));
+}
+
+static std::uint64_t read_u64(std::span<const std::byte> bytes, size_t offset) {
+    return read_array<std::uint64_t>(bytes, offset, 1)[0];
+}
+
+// Offsets must start at zero, never decrease and end within the bounds of what they index
+template <typename T>
+static void check_offsets(std::span<const T> offsets, std::uint64_t limit) {
+    if (offsets.empty() || offsets.front() != 0 || offsets.back() > limit ||
+        !std::ranges::is_sorted(offsets)) {
+        throw FormatError("corrupted offsets");
+    }
+}
+
+BlobArrayView::BlobArrayView(std::span<const std::byte> section) {
+    auto count = read_u64(section, 0);
+    if (count >= section.size() / sizeof(std::uint64_t)) {
+        throw FormatError("blob array out of section bounds");
+    }
+    offsets_ = read_array<std::uint64_t>(section, sizeof(std::uint64_t), count + 1);
+    blobs_ = section.subspan((count + 2) * sizeof(std::uint64_t));
+    check_offsets(offsets_, blobs_.size());
+}
+
+ReactantListsView::ReactantListsView(std::span<const std::byte> section) {
+    auto num_reactions = read_u64(section, 0);
+    auto num_lists = read_u64(section, 8);
+    auto num_entries = read_u64(section, 16);
+    if (num_reactions >= section.size() || num_lists >= section.size() ||
+        num_entries > section.size()) {
+        throw FormatError("reactant lists out of section bounds");
+    }
+    size_t offset = 24;
+    entry_begin = read_array<std::uint64_t>(section, offset, num_lists + 1);
+    offset += entry_begin.size_bytes();
+    list_begin = read_array<std::uint32_t>(section, offset, num_reactions + 1);
+    offset += list_begin.size_bytes();
+    molecules = read_array<std::uint32_t>(section, offset, num_entries);
+    offset += molecules.size_bytes();
+    heavy_atoms = read_array<std::uint32_t>(section, offset, num_entries);
+    check_offsets(list_begin, num_lists);
+    check_offsets(entry_begin, num_entries);
+    // Every list and every entry belongs to one reaction
+    if (list_begin.back() != num_lists || entry_begin.back() != num_entries) {
+        throw FormatError("corrupted offsets");
+    }
+}
+
+MatchIndexView::MatchIndexView(std::span<const std::byte> section) {
+    auto num_molecules = read_u64(section, 0);
+    max_count = read_u64(section, 8);
+    auto num_entries = read_u64(section, 16);
+    if (num_molecules >= section.size() || num_entries > section.size()) {
+        throw FormatError("match index out of section bounds");
+    }
+    size_t offset = 24;
+    entry_begin = read_array<std::uint64_t>(section, offset, num_molecules + 1);
+    offset += entry_begin.size_bytes();
+    entries = read_array<Entry>(section, offset, num_entries);
+    check_offsets(entry_begin, num_entries);
+    if (entry_begin.back() != num_entries) {
+        throw FormatError("corrupted offsets");
+    }
+}
+
+} // namespace prexsyn::chemspace::mapped_format
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "../utility/binary_stream.hpp"
+
+namespace prexsyn::chemspace::mapped_format {
+
+// Chemical space files that are memory-mapped and read in place instead of being decoded into a
+// copy. The file starts with a fixed-size Header and a table of SectionEntry, followed by the
+// sections. Every integer is a little-endian fixed-width value, every section starts at a
+// multiple of kSectionAlignment, and readers skip sections they do not know.
+static_assert(std::endian::native == std::endian::little,
+              "the mapped chemical space format is only implemented for little-endian hosts");
+
+constexpr std::array<char, 8> kMagic = {'P', 'X', 'S', 'Y', 'N', 'M', 'A', 'P'};
+// Version 2 stores reactant lists with the 32-bit types they have in memory, so that they are read
+// in place
+constexpr std::uint32_t kFormatVersion = 2;
+constexpr size_t kSectionAlignment = 64;
+constexpr size_t kMaxSections = 32;
+
+// NOLINTNEXTLINE(performance-enum-size)
+enum class SectionId : std::uint32_t {
+    // Boost archive of the reaction library, which is small and always decoded
+    ReactionLibrary = 1,
+    // u64 selectivity cutoff
+    MatchingConfig = 2,
+    // Blob arrays, see BlobArrayView
+    BuildingBlockPickles = 3,
+    BuildingBlockSmiles = 4,
+    BuildingBlockIdentifiers = 5,
+    // Labels of a building block joined by '\n'
+    BuildingBlockLabels = 6,
+    IntermediatePickles = 7,
+    IntermediateSmiles = 8,
+    IntermediateIdentifiers = 9,
+    // Tokens of an intermediate as (u64 index, u64 type) pairs
+    IntermediatePostfixNotations = 10,
+    // See ReactantListsView
+    BuildingBlockReactantLists = 11,
+    IntermediateReactantLists = 12,
+    // See MatchIndexView. 14 held the match index of intermediates, older files still have it.
+    BuildingBlockMatchIndex = 13,
+};
+
+// The counts are at the same place in every version, so that files can be peeked without reading
+// the section table
+struct Header {
+    std::array<char, 8> magic = kMagic;
+    std::uint32_t format_version = kFormatVersion;
+    std::uint32_t num_sections = 0;
+    std::uint64_t num_building_blocks = 0;
+    std::uint64_t num_reactions = 0;
+    std::uint64_t num_intermediates = 0;
+    std::array<std::uint64_t, 3> reserved{};
+};
+static_assert(sizeof(Header) == 64 && std::is_trivially_copyable_v<Header>);
+
+struct SectionEntry {
+    std::uint32_t id = 0;
+    std::uint32_t reserved = 0;
+    std::uint64_t offset = 0;
+    std::uint64_t size = 0;
+};
+static_assert(sizeof(SectionEntry) == 24 && std::is_trivially_copyable_v<SectionEntry>);
+
+class FormatError : public std::runtime_error {
+public:
+    explicit FormatError(const std::string &message) : std::runtime_error(message) {}
+};
+
+// Writes sections to a seekable stream and fills in the header and the section table at the end
+class Writer {
+private:
+    std::ostream &os_;
+    std::streamoff base_;
+    std::vector<SectionEntry> sections_;
+
+    std::uint64_t position() const;
+    void align();
+
+public:
+    explicit Writer(std::ostream &);
+
+    template <typename Fn> void section(SectionId id, Fn &&write_content) {
+        if (sections_.size() >= kMaxSections) {
+            throw FormatError("too many sections");
+        }
+        align();
+        auto offset = position();
+        write_content(os_);
+        sections_.push_back({.id = static_cast<std::uint32_t>(id),
+                             .offset = offset,
+                             .size = position() - offset});
+    }
+
+    void finish(Header header);
+};
+
+// u64 count, u64 offsets[count + 1] relative to the first blob, then the blobs back to back
+void write_blob_array(std::ostream &, std::span<const std::string>);
+
+// Validated view of a mapped file
+class Reader {
+private:
+    std::span<const std::byte> data_;
+    Header header_;
+    std::vector<SectionEntry> sections_;
+
+public:
+    explicit Reader(std::span<const std::byte>);
+
+    const Header &header() const { return header_; }
+    bool has_section(SectionId) const;
+    std::span<const std::byte> section(SectionId) const;
+};
+
+// Values start at the given byte offset of a section, which must be aligned for T
+template <typename T>
+std::span<const T> read_array(std::span<const std::byte> bytes, size_t offset, size_t count) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    if (offset > bytes.size() || count > (bytes.size() - offset) / sizeof(T)) {
+        throw FormatError("array out of section bounds");
+    }
+    const auto *data = bytes.data() + offset;
+    if (reinterpret_cast<std::uintptr_t>(data) % alignof(T) != 0) {
+        throw FormatError("misaligned array");
+    }
+    return {reinterpret_cast<const T *>(data), count};
+}
+
+class BlobArrayView {
+private:
+    std::span<const std::uint64_t> offsets_;
+    std::span<const std::byte> blobs_;
+
+public:
+    explicit BlobArrayView(std::span<const std::byte> section);
+
+    size_t size() const { return offsets_.size() - 1; }
+    std::string_view operator[](size_t i) const {
+        return {reinterpret_cast<const char *>(blobs_.data()) + offsets_[i],
+                offsets_[i + 1] - offsets_[i]};
+    }
+};
+
+// u64 num_reactions, u64 num_lists, u64 num_entries,
+// u64 entry_begin[num_lists + 1]: first entry of each list,
+// u32 list_begin[num_reactions + 1]: first list of each reaction, one list per reactant,
+// u32 molecules[num_entries], ordered by heavy atom count within each list,
+// u32 heavy_atoms[num_entries]
+struct ReactantListsView {
+    std::span<const std::uint64_t> entry_begin;
+    std::span<const std::uint32_t> list_begin;
+    std::span<const std::uint32_t> molecules;
+    std::span<const std::uint32_t> heavy_atoms;
+
+    explicit ReactantListsView(std::span<const std::byte> section);
+};
+
+// u64 num_molecules, u64 max_count, u64 num_entries, u64 entry_begin[num_molecules + 1],
+// then (u64 reaction, u64 reactant, u64 count) for every entry
+struct MatchIndexView {
+    struct Entry {
+        std::uint64_t reaction_index;
+        std::uint64_t reactant_index;
+        std::uint64_t count;
+    };
+
+    std::uint64_t max_count;
+    std::span<const std::uint64_t> entry_begin;
+    std::span<const Entry> entries;
+
+    explicit MatchIndexView(std::span<const std::byte> section);
+};
+
+// True if the bytes start with the magic of this format
+inline bool has_magic(std::span<const std::byte> bytes) {
+    return bytes.size() >= kMagic.size() && std::memcmp(bytes.data(), kMagic.data(), 8) == 0;
+}
+
+} // namespace prexsyn::chemspace::mapped_format
@@ -0,0 +1,181 @@
+#include "molecule_cache.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "../chemistry/chemistry.hpp"
+#include "../utility/borrow.hpp"
+
+namespace prexsyn::chemspace {
+
+MoleculeCache::MoleculeCache(size_t capacity, size_t num_shards)
+    : shard_capacity_(0), shards_(std::max<size_t>(num_shards, 1)) {
+    set_capacity(capacity);
+}
+
+void MoleculeCache::set_capacity(size_t capacity) {
+    if (capacity == 0) {
+        throw std::invalid_argument("Molecule cache capacity must be positive");
+    }
+    shard_capacity_ = (capacity + shards_.size() - 1) / shards_.size();
+    for (auto &shard : shards_) {
+        std::unique_lock lock(shard.mutex);
+        evict(shard);
+    }
+}
+
+void MoleculeCache::evict(Shard &shard) {
+    while (shard.order.size() > shard_capacity_.load(std::memory_order_relaxed)) {
+        auto key = shard.order.back();
+        auto &entry = shard.entries.find(key)->second;
+        if (entry.referenced.exchange(false, std::memory_order_relaxed)) {
+            // Second chance, the entry goes back to the front
+            shard.order.splice(shard.order.begin(), shard.order, entry.position);
+        } else {
+            shard.entries.erase(key);
+            shard.order.pop_back();
+        }
+    }
+}
+
+MoleculeCache::Value MoleculeCache::find(Key key, bool pin) {
+    auto &shard = shard_for(key);
+    if (!pin) {
+        std::shared_lock lock(shard.mutex);
+        auto it = shard.entries.find(key);
+        if (it == shard.entries.end()) {
+            shard.misses.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        // Only written when it changes, so that hits on the same entry share its cache line
+        if (!it->second.referenced.load(std::memory_order_relaxed)) {
+            it->second.referenced.store(true, std::memory_order_relaxed);
+        }
+        shard.hits.fetch_add(1, std::memory_order_relaxed);
+        return it->second.value;
+    }
+
+    std::unique_lock lock(shard.mutex);
+    auto it = shard.entries.find(key);
+    if (it == shard.entries.end()) {
+        shard.misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    auto &entry = it->second;
+    if (!entry.pinned) {
+        shard.order.erase(entry.position);
+        entry.pinned = true;
+    }
+    shard.hits.fetch_add(1, std::memory_order_relaxed);
+    return entry.value;
+}
+
+MoleculeCache::Value MoleculeCache::put(Key key, Value value, bool pin) {
+    // Cached molecules are read concurrently, so canonicalize them before publishing
+    value->smiles();
+
+    auto &shard = shard_for(key);
+    std::unique_lock lock(shard.mutex);
+    auto [it, inserted] = shard.entries.try_emplace(key);
+    auto &entry = it->second;
+    if (inserted) {
+        entry.value = std::move(value);
+        if (pin) {
+            entry.pinned = true;
+        } else {
+            shard.order.push_front(key);
+            entry.position = shard.order.begin();
+            evict(shard);
+        }
+    } else if (pin && !entry.pinned) {
+        shard.order.erase(entry.position);
+        entry.pinned = true;
+    }
+    return entry.value;
+}
+
+MoleculeCache::Stats MoleculeCache::stats() const {
+    Stats stats{.capacity = capacity()};
+    for (const auto &shard : shards_) {
+        std::shared_lock lock(shard.mutex);
+        stats.hits += shard.hits.load(std::memory_order_relaxed);
+        stats.misses += shard.misses.load(std::memory_order_relaxed);
+        stats.size += shard.entries.size();
+        stats.pinned += shard.entries.size() - shard.order.size();
+    }
+    return stats;
+}
+
+void MoleculeCache::clear() {
+    for (auto &shard : shards_) {
+        std::unique_lock lock(shard.mutex);
+        for (auto key : shard.order) {
+            shard.entries.erase(key);
+        }
+        shard.order.clear();
+    }
+}
+
+std::shared_ptr<Molecule> LazyMolecule::decode() const {
+    auto derived = state_.derived.load();
+    if (derived == nullptr) {
+        auto created = std::make_shared<Molecule::DerivedData>();
+        // Another thread may have decoded the molecule in the meantime, use its storage then
+        derived = state_.derived.compare_exchange_strong(derived, created) ? created : derived;
+    }
+    std::shared_ptr<Molecule> molecule;
+    if (pickle_owner_ != nullptr) {
+        // RDKit only reads pickles from a string
+        molecule = Molecule::from_trusted_rdkit_pickle(std::string(mapped_pickle_), smiles_);
+    } else {
+        molecule = Molecule::from_trusted_rdkit_pickle(pickle_, smiles_);
+    }
+    molecule->share_derived(std::move(derived));
+    return molecule;
+}
+
+std::shared_ptr<Molecule> LazyMolecule::get() const {
+    if (resident_ != nullptr) {
+        return resident_;
+    }
+    if (pickle_bytes().empty()) {
+        return nullptr;
+    }
+    if (cache_ == nullptr) {
+        return decode();
+    }
+    return cache_->get(key_, [this] { return decode(); });
+}
+
+std::shared_ptr<Molecule> LazyMolecule::borrow() const {
+    if (resident_ != nullptr) {
+        return prexsyn::borrow(resident_);
+    }
+    if (auto *pinned = state_.pinned.load(std::memory_order_acquire)) {
+        return std::shared_ptr<Molecule>(std::shared_ptr<Molecule>(), pinned);
+    }
+    return get();
+}
+
+void LazyMolecule::pin() const {
+    if (resident_ == nullptr && cache_ != nullptr && !pickle_bytes().empty()) {
+        auto molecule = cache_->pin(key_, [this] { return decode(); });
+        state_.pinned.store(molecule.get(), std::memory_order_release);
+    }
+}
+
+std::string LazyMolecule::pickle() const {
+    return resident_ != nullptr ? resident_->rdkit_pickle() : std::string(pickle_bytes());
+}
+
+const std::string &LazyMolecule::smiles() const {
+    return resident_ != nullptr ? resident_->smiles() : smiles_;
+}
+
+} // namespace prexsyn::chemspace
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../chemistry/chemistry.hpp"
+
+namespace prexsyn::chemspace {
+
+// Bounded cache of decoded library molecules, safe to share between threads. Hits only take a
+// shared lock of their shard and mark the entry as referenced. Eviction gives referenced entries
+// a second chance, which approximates LRU. Pinned entries are never evicted, not even by clear(),
+// and do not count towards the capacity.
+class MoleculeCache {
+public:
+    static constexpr size_t kDefaultCapacity = 1 << 16;
+    static constexpr size_t kDefaultNumShards = 16;
+
+    using Key = std::uint64_t;
+    using Value = std::shared_ptr<Molecule>;
+
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t size = 0;
+        size_t pinned = 0;
+        size_t capacity = 0;
+    };
+
+private:
+    struct Entry {
+        Value value;
+        bool pinned = false;
+        // Set by hits since eviction last passed the entry
+        std::atomic<bool> referenced{false};
+        // Position in the eviction order of the shard, unused for pinned entries
+        std::list<Key>::iterator position;
+    };
+
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        // Unpinned entries, evicted from the back
+        std::list<Key> order;
+        std::unordered_map<Key, Entry> entries;
+        std::atomic<size_t> hits{0};
+        std::atomic<size_t> misses{0};
+    };
+
+    std::atomic<size_t> shard_capacity_;
+    std::vector<Shard> shards_;
+
+    Shard &shard_for(Key key) { return shards_[key % shards_.size()]; }
+    void evict(Shard &);
+
+public:
+    explicit MoleculeCache(size_t capacity = kDefaultCapacity,
+                           size_t num_shards = kDefaultNumShards);
+
+    // Decodes the molecule outside of the shard lock on a miss. Concurrent misses on the same key
+    // may decode it more than once, but they all return the first value that was stored.
+    template <typename Decode> Value get(Key key, const Decode &decode) {
+        if (auto value = find(key)) {
+            return value;
+        }
+        return put(key, decode(), false);
+    }
+
+    template <typename Decode> Value pin(Key key, const Decode &decode) {
+        if (auto value = find(key, true)) {
+            return value;
+        }
+        return put(key, decode(), true);
+    }
+
+    // Returns null on a miss. Marks the entry as pinned if pin is set.
+    Value find(Key, bool pin = false);
+    // Returns the stored value, which is the existing one if the key is already present
+    Value put(Key, Value, bool pin);
+
+    size_t capacity() const { return shard_capacity_.load() * shards_.size(); }
+    void set_capacity(size_t);
+    Stats stats() const;
+    // Drops every entry that is not pinned
+    void clear();
+};
+
+// Library molecule that is either resident or kept as its serialized form and decoded on access
+// through a MoleculeCache. Serialized molecules hold the pickle of a sanitized molecule together
+// with its canonical SMILES, and are decoded as trusted. The pickle is either owned or read in
+// place from memory kept alive by an owner, e.g. a MappedFile.
+//
+// Decoded molecules can be evicted at any time, so there is no operator->. Hold the result of
+// get() or borrow() for as long as the molecule is used.
+class LazyMolecule {
+private:
+    // State that is filled in on access, copied along with the molecule
+    struct DecodeState {
+        // Pinned molecules stay in the cache until it is destroyed, so they are read from here
+        // without looking them up
+        std::atomic<Molecule *> pinned{nullptr};
+        // Derived data of the decoded molecule, shared by every time it is decoded, so that it
+        // survives eviction
+        std::atomic<std::shared_ptr<Molecule::DerivedData>> derived;
+
+        DecodeState() = default;
+        DecodeState(const DecodeState &other)
+            : pinned(other.pinned.load()), derived(other.derived.load()) {}
+        DecodeState &operator=(const DecodeState &other) {
+            pinned = other.pinned.load();
+            derived = other.derived.load();
+            return *this;
+        }
+    };
+
+    std::shared_ptr<Molecule> resident_;
+    std::string pickle_;
+    std::string_view mapped_pickle_;
+    std::shared_ptr<const void> pickle_owner_;
+    std::string smiles_;
+    MoleculeCache *cache_ = nullptr;
+    MoleculeCache::Key key_ = 0;
+    mutable DecodeState state_;
+
+    std::string_view pickle_bytes() const {
+        return pickle_owner_ != nullptr ? mapped_pickle_ : std::string_view(pickle_);
+    }
+    std::shared_ptr<Molecule> decode() const;
+
+public:
+    LazyMolecule() = default;
+    LazyMolecule(std::shared_ptr<Molecule> molecule) // NOLINT(google-explicit-constructor)
+        : resident_(std::move(molecule)) {}
+    LazyMolecule(std::string pickle, std::string smiles)
+        : pickle_(std::move(pickle)), smiles_(std::move(smiles)) {}
+    LazyMolecule(std::string_view pickle, std::shared_ptr<const void> owner, std::string smiles)
+        : mapped_pickle_(pickle), pickle_owner_(std::move(owner)), smiles_(std::move(smiles)) {}
+
+    // Serialized molecules are decoded every time they are accessed until they are attached
+    void attach(MoleculeCache *cache, MoleculeCache::Key key) {
+        cache_ = cache;
+        key_ = key;
+    }
+
+    bool is_resident() const { return resident_ != nullptr; }
+
+    std::shared_ptr<Molecule> get() const;
+    // Resident and pinned molecules are borrowed, see borrow(), so the owner of this object must
+    // outlive the result. Other cached molecules are shared, since they may be evicted while the
+    // result is in use.
+    std::shared_ptr<Molecule> borrow() const;
+    // Keeps the molecule in the cache for good
+    void pin() const;
+
+    // Available without decoding the molecule
+    std::string pickle() const;
+    const std::string &smiles() const;
+};
+
+} // namespace prexsyn::chemspace
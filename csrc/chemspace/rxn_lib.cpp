@@ -1,19 +1,41 @@
 #include "rxn_lib.hpp"
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <istream>
 #include <memory>
+#include <optional>
 #include <ostream>
 #include <stdexcept>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <GraphMol/RWMol.h>
+#include <GraphMol/SmilesParse/SmilesWrite.h>
+#include <GraphMol/Substruct/SubstructMatch.h>
+
 #include "../chemistry/chemistry.hpp"
+#include "../utility/hash.hpp"
 #include "../utility/serialization.hpp"
 
 namespace prexsyn::chemspace {
 
+namespace {
+
+// Templates with the same key match the same atoms with the same query atom indices. Atom map
+// numbers only tie reactant atoms to product atoms, so they are replaced by the atom indices.
+std::string template_key(const RDKit::ROMol &tmpl) {
+    RDKit::RWMol mol(tmpl);
+    for (auto *atom : mol.atoms()) {
+        atom->setAtomMapNum(static_cast<int>(atom->getIdx()) + 1);
+    }
+    return RDKit::MolToSmarts(mol);
+}
+
+} // namespace
+
 std::unique_ptr<ReactionLibrary> ReactionLibrary::deserialize(std::istream &data) {
     boost::archive::binary_iarchive ia(data);
     size_t num_items = 0;
@@ -23,6 +45,7 @@ std::unique_ptr<ReactionLibrary> ReactionLibrary::deserialize(std::istream &data
     for (size_t i = 0; i < num_items; ++i) {
         ReactionItem item;
         ia >> item;
+        rxn_lib->add_templates(item);
         rxn_lib->reactions_.push_back(std::move(item));
     }
     ia >> rxn_lib->name_to_index_;
@@ -59,26 +82,77 @@ ReactionLibrary::Index ReactionLibrary::add(const ReactionEntry &entry) {
     }
     auto new_index = reactions_.size();
     reactions_.push_back(ReactionItem{entry, new_index});
+    add_templates(reactions_.back());
     name_to_index_[entry.name] = new_index;
     return new_index;
 }
 
+std::uint64_t ReactionLibrary::fingerprint() const {
+    std::uint64_t h = hash_mix(reactions_.size());
+    for (const auto &item : reactions_) {
+        const auto &rdkit_rxn = item.reaction->rdkit_rxn();
+        for (const auto *templates : {&rdkit_rxn.getReactants(), &rdkit_rxn.getProducts()}) {
+            h = hash_combine(h, templates->size());
+            for (const auto &tmpl : *templates) {
+                h = hash_combine(h, hash_string(RDKit::MolToSmarts(*tmpl)));
+            }
+        }
+        for (const auto &name : item.reaction->reactant_names()) {
+            h = hash_combine(h, hash_string(name));
+        }
+    }
+    return h;
+}
+
+void ReactionLibrary::add_templates(const ReactionItem &item) {
+    const auto &rdkit_templates = item.reaction->rdkit_rxn().getReactants();
+    for (size_t i = 0; i < rdkit_templates.size(); ++i) {
+        auto [it, inserted] = template_keys_.try_emplace(template_key(*rdkit_templates[i]),
+                                                         templates_.size());
+        if (inserted) {
+            templates_.push_back({
+                .query = rdkit_templates[i],
+                .fingerprint = std::make_shared<const PatternFingerprint>(*rdkit_templates[i]),
+                .uses = {},
+            });
+        }
+        templates_[it->second].uses.emplace_back(item.index, i);
+    }
+}
+
 std::vector<ReactionLibrary::Match>
-ReactionLibrary::match_reactants(const Molecule &molecule) const {
+ReactionLibrary::match_reactants(const Molecule &molecule, std::optional<size_t> max_count) const {
+    RDKit::SubstructMatchParameters params;
+    if (max_count.has_value()) {
+        params.maxMatches = static_cast<unsigned int>(std::max<size_t>(*max_count, 1));
+    }
+
+    auto fingerprint = PatternFingerprint::of(molecule);
     std::vector<ReactionLibrary::Match> matches;
-    for (size_t i = 0; i < reactions_.size(); ++i) {
-        const auto &rxn = reactions_[i];
-        auto rxn_matches = rxn.reaction->match_reactants(molecule);
-        for (const auto &match : rxn_matches) {
+    for (const auto &tmpl : templates_) {
+        if (!tmpl.fingerprint->is_subset_of(*fingerprint)) {
+            continue;
+        }
+        auto res = RDKit::SubstructMatch(molecule.rdkit_mol(), *tmpl.query, params);
+        if (res.empty()) {
+            continue;
+        }
+        for (const auto &[reaction_index, reactant_index] : tmpl.uses) {
+            const auto &rxn = reactions_[reaction_index];
             matches.push_back({
-                .reaction_index = i,
+                .reaction_index = reaction_index,
                 .reaction_name = rxn.name,
-                .reactant_index = match.index,
-                .reactant_name = match.name,
-                .count = match.count,
+                .reactant_index = reactant_index,
+                .reactant_name = rxn.reaction->reactant_names().at(reactant_index),
+                .count = res.size(),
             });
         }
     }
+    // Same order as matching reaction by reaction, so that enumeration stays reproducible
+    std::ranges::sort(matches, [](const Match &a, const Match &b) {
+        return std::pair(a.reaction_index, a.reactant_index) <
+               std::pair(b.reaction_index, b.reactant_index);
+    });
     return matches;
 }
 
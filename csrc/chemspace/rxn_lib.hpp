@@ -1,12 +1,16 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <istream>
 #include <map>
 #include <memory>
 #include <ostream>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "../chemistry/chemistry.hpp"
@@ -42,6 +46,20 @@ private:
     std::vector<ReactionItem> reactions_;
     std::map<std::string, Index> name_to_index_;
 
+    // Reactant templates that are identical apart from atom map numbers, e.g. the same functional
+    // group in several reactions, are matched once and the result is shared by all their uses.
+    // The table is derived from the reactions and rebuilt on deserialization.
+    struct ReactantTemplate {
+        RDKit::ROMOL_SPTR query;
+        // Screens out molecules before the query is matched
+        std::shared_ptr<const PatternFingerprint> fingerprint;
+        std::vector<std::pair<Index, Reaction::ReactantIndex>> uses;
+    };
+    std::vector<ReactantTemplate> templates_;
+    std::unordered_map<std::string, size_t> template_keys_;
+
+    void add_templates(const ReactionItem &);
+
 public:
     ReactionLibrary() = default;
 
@@ -53,6 +71,10 @@ public:
     const ReactionItem &get(const std::string &) const;
     Index add(const ReactionEntry &);
 
+    // Hash of the reaction SMARTS and reactant names in index order, which tells whether data keyed
+    // by reaction index, e.g. a saved ReactionCache, was built for this library
+    std::uint64_t fingerprint() const;
+
     auto begin() const noexcept { return reactions_.begin(); }
     auto end() const noexcept { return reactions_.end(); }
 
@@ -63,7 +85,11 @@ public:
         std::string_view reactant_name;
         size_t count;
     };
-    std::vector<Match> match_reactants(const Molecule &molecule) const;
+    // Matches of each template are counted up to max_count, which is enough to tell whether a
+    // reactant exceeds a selectivity cutoff without enumerating every match
+    std::vector<Match> match_reactants(const Molecule &molecule,
+                                       std::optional<size_t> max_count = std::nullopt) const;
+    size_t num_reactant_templates() const { return templates_.size(); }
 };
 
 } // namespace prexsyn::chemspace
@@ -6,11 +6,13 @@
 #include <memory>
 #include <optional>
 #include <ostream>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
 #include "../chemistry/chemistry.hpp"
+#include "../utility/borrow.hpp"
 #include "../utility/serialization.hpp"
 #include "bb_lib.hpp"
 #include "chemical_space.hpp"
@@ -24,6 +26,8 @@ void ChemicalSpaceSynthesis::serialize(std::ostream &os) const {
     boost::archive::binary_oarchive oa(os);
     oa << postfix_notation_;
     oa << max_outcomes_history_;
+    oa << settings_history_;
+    oa << settings_;
 }
 
 std::unique_ptr<ChemicalSpaceSynthesis>
@@ -33,10 +37,21 @@ ChemicalSpaceSynthesis::deserialize(std::istream &is, const ChemicalSpace &cs) {
     PostfixNotation pfn;
     std::vector<std::optional<size_t>> max_outcomes_history;
     ia >> pfn >> max_outcomes_history;
+    // Archives written before the settings were stored end here, and their syntheses were built
+    // with the default settings
+    std::vector<SynthesisSettings> settings_history(pfn.size());
+    SynthesisSettings settings;
+    if (is.peek() != std::char_traits<char>::eof()) {
+        ia >> settings_history >> settings;
+    }
+    if (settings_history.size() != pfn.size() || max_outcomes_history.size() != pfn.size()) {
+        throw std::runtime_error("failed to deserialize synthesis, corrupted history");
+    }
 
     auto result = Result::ok();
     for (size_t i = 0; i < pfn.size(); ++i) {
         const auto &token = pfn.tokens()[i];
+        instance->settings_ = settings_history[i];
         if (token.type == PostfixNotation::Token::Type::BuildingBlock) {
             result = instance->add_building_block(token.index);
             if (!result) {
@@ -55,6 +70,7 @@ ChemicalSpaceSynthesis::deserialize(std::istream &is, const ChemicalSpace &cs) {
             "failed to deserialize synthesis, did you provide the same chemical space? " +
             result.message);
     }
+    instance->settings_ = settings;
 
     return instance;
 }
@@ -79,15 +95,15 @@ size_t ChemicalSpaceSynthesis::count_reactions() const {
     return count;
 }
 
-std::vector<std::shared_ptr<Molecule>> ChemicalSpaceSynthesis::products() const {
+std::vector<std::shared_ptr<Molecule>>
+ChemicalSpaceSynthesis::products(std::optional<size_t> limit) const {
     const static std::vector<std::shared_ptr<Molecule>> empty_result{};
-    if (synthesis_->stack_size() == 0) {
+    if (synthesis_.stack_size() == 0) {
         return empty_result;
     }
-    const auto &top = synthesis_->stack_top();
+    const auto &top = synthesis_.stack_top();
     std::vector<std::shared_ptr<Molecule>> result;
-    result.reserve(top->size());
-    for (size_t i = 0; i < top->size(); ++i) {
+    for (size_t i = 0; (!limit.has_value() || i < limit.value()) && top->ensure(i + 1); ++i) {
         result.push_back(top->at(i));
     }
     return result;
@@ -98,9 +114,12 @@ using Result = ChemicalSpaceSynthesis::Result;
 Result ChemicalSpaceSynthesis::add_building_block(BuildingBlockLibrary::Index index) noexcept {
     try {
         const auto &bb_item = cs_.bb_lib().get(index);
-        synthesis_->push(bb_item.molecule);
+        // The chemical space outlives this synthesis, so resident molecules are borrowed rather
+        // than shared. This keeps threads off the reference count of popular building blocks.
+        synthesis_.push(bb_item.molecule.borrow());
         postfix_notation_.append(bb_item.index, PostfixNotation::Token::Type::BuildingBlock);
         max_outcomes_history_.emplace_back(std::nullopt);
+        settings_history_.push_back(settings_);
         return Result::ok();
     } catch (const std::exception &e) {
         return Result::error(e.what());
@@ -110,10 +129,7 @@ Result ChemicalSpaceSynthesis::add_building_block(BuildingBlockLibrary::Index in
 Result ChemicalSpaceSynthesis::add_building_block(const std::string &index) noexcept {
     try {
         const auto &bb_item = cs_.bb_lib().get(index);
-        synthesis_->push(bb_item.molecule);
-        postfix_notation_.append(bb_item.index, PostfixNotation::Token::Type::BuildingBlock);
-        max_outcomes_history_.emplace_back(std::nullopt);
-        return Result::ok();
+        return add_building_block(bb_item.index);
     } catch (const std::exception &e) {
         return Result::error(e.what());
     }
@@ -121,11 +137,31 @@ Result ChemicalSpaceSynthesis::add_building_block(const std::string &index) noex
 
 Result ChemicalSpaceSynthesis::add_reaction(ReactionLibrary::Index index,
                                             std::optional<size_t> max_outcomes) noexcept {
+    return add_reaction(index, max_outcomes, {});
+}
+
+Result ChemicalSpaceSynthesis::add_reaction(
+    ReactionLibrary::Index index, std::optional<size_t> max_outcomes,
+    std::span<const Reaction::KnownMatches> known_matches) noexcept {
     try {
         const auto &rxn_item = cs_.rxn_lib().get(index);
-        synthesis_->push(rxn_item.reaction, max_outcomes);
+        // Reactions fail routinely while enumerating, so this path does not throw
+        auto status = synthesis_.try_push(borrow(rxn_item.reaction),
+                                          {.max_outcomes = max_outcomes,
+                                           .max_outcomes_per_call = settings_.max_outcomes_per_call,
+                                           .cache = cs_.reaction_cache(),
+                                           .cache_key = rxn_item.index,
+                                           .known_matches = known_matches,
+                                           .lazy = settings_.lazy_evaluation,
+                                           .main_product_only = settings_.main_product_only,
+                                           .max_heavy_atoms = settings_.max_heavy_atoms,
+                                           .num_threads = num_threads_});
+        if (!status) {
+            return status;
+        }
         postfix_notation_.append(rxn_item.index, PostfixNotation::Token::Type::Reaction);
         max_outcomes_history_.emplace_back(max_outcomes);
+        settings_history_.push_back(settings_);
         return Result::ok();
     } catch (const std::exception &e) {
         return Result::error(e.what());
@@ -136,10 +172,7 @@ Result ChemicalSpaceSynthesis::add_reaction(const std::string &index,
                                             std::optional<size_t> max_outcomes) noexcept {
     try {
         const auto &rxn_item = cs_.rxn_lib().get(index);
-        synthesis_->push(rxn_item.reaction, max_outcomes);
-        postfix_notation_.append(rxn_item.index, PostfixNotation::Token::Type::Reaction);
-        max_outcomes_history_.emplace_back(max_outcomes);
-        return Result::ok();
+        return add_reaction(rxn_item.index, max_outcomes);
     } catch (const std::exception &e) {
         return Result::error(e.what());
     }
@@ -198,8 +231,9 @@ Result ChemicalSpaceSynthesis::add_intermediate(const std::string &identifier,
 Result ChemicalSpaceSynthesis::undo() noexcept {
     try {
         max_outcomes_history_.pop_back();
+        settings_history_.pop_back();
         postfix_notation_.pop_back();
-        synthesis_->undo();
+        synthesis_.undo();
         return Result::ok();
     } catch (const std::exception &e) {
         return Result::error(e.what());
@@ -5,10 +5,12 @@
 #include <memory>
 #include <optional>
 #include <ostream>
+#include <span>
 #include <string>
 #include <vector>
 
 #include "../chemistry/chemistry.hpp"
+#include "../utility/status.hpp"
 #include "bb_lib.hpp"
 #include "int_lib.hpp"
 #include "postfix_notation.hpp"
@@ -18,16 +20,36 @@ namespace prexsyn::chemspace {
 
 class ChemicalSpace;
 
+// Settings that change which items the reactions added afterwards hold, recorded for every token
+// so that a deserialized synthesis has the same items
+struct SynthesisSettings {
+    bool lazy_evaluation = false;
+    bool main_product_only = false;
+    std::optional<size_t> max_outcomes_per_call;
+    std::optional<unsigned int> max_heavy_atoms;
+
+    template <typename Archive> void serialize(Archive &ar, const unsigned int /* version */) {
+        ar & lazy_evaluation;
+        ar & main_product_only;
+        ar & max_outcomes_per_call;
+        ar & max_heavy_atoms;
+    }
+};
+
+// Copies are cheap snapshots: the underlying synthesis is persistent, so a copy shares its nodes
+// with the original and is unaffected by later changes to it.
 class ChemicalSpaceSynthesis {
 private:
     const ChemicalSpace &cs_;
     PostfixNotation postfix_notation_;
-    std::shared_ptr<Synthesis> synthesis_;
+    Synthesis synthesis_;
 
     std::vector<std::optional<size_t>> max_outcomes_history_;
+    std::vector<SynthesisSettings> settings_history_;
+    SynthesisSettings settings_;
+    size_t num_threads_ = 1;
 
-    ChemicalSpaceSynthesis(const ChemicalSpace &cs)
-        : cs_(cs), postfix_notation_(), synthesis_(std::make_shared<Synthesis>()) {}
+    ChemicalSpaceSynthesis(const ChemicalSpace &cs) : cs_(cs) {}
 
     friend class ChemicalSpace;
 
@@ -38,26 +60,49 @@ public:
 
     const ChemicalSpace &chemical_space() const { return cs_; }
     const PostfixNotation &postfix_notation() const { return postfix_notation_; }
-    const Synthesis &synthesis() const { return *synthesis_; }
-    std::shared_ptr<Synthesis> &get_synthesis() { return synthesis_; }
-
-    struct Result {
-        bool is_ok;
-        std::string message;
-
-        static Result ok() { return {.is_ok = true, .message = {}}; }
-        static Result error(const std::string &msg) { return {.is_ok = false, .message = msg}; }
+    const Synthesis &synthesis() const { return synthesis_; }
 
-        operator bool() const { return is_ok; }
-    };
+    using Result = Status;
 
     size_t count_building_blocks() const;
     size_t count_reactions() const;
-    std::vector<std::shared_ptr<Molecule>> products() const;
+    // Products of the top node, at most limit of them so lazy nodes are only evaluated as needed.
+    // Building blocks are borrowed from the chemical space, see Molecule::owning().
+    std::vector<std::shared_ptr<Molecule>>
+    products(std::optional<size_t> limit = std::nullopt) const;
+
+    // Reactions added afterwards evaluate their products on demand. Lazy reactions combine the
+    // first items of all their reactants before later ones, so products of reactions with
+    // several reactants may come in a different order.
+    bool lazy_evaluation() const { return settings_.lazy_evaluation; }
+    void set_lazy_evaluation(bool lazy) { settings_.lazy_evaluation = lazy; }
+    // Reactions added afterwards drop by-products before sanitizing them, see
+    // ReactionApplyOptions::main_product_only
+    bool main_product_only() const { return settings_.main_product_only; }
+    void set_main_product_only(bool main_product_only) {
+        settings_.main_product_only = main_product_only;
+    }
+    // Caps the outcomes RDKit builds for one reactant combination, see ReactionPushOptions
+    std::optional<size_t> max_outcomes_per_call() const { return settings_.max_outcomes_per_call; }
+    void set_max_outcomes_per_call(std::optional<size_t> limit) {
+        settings_.max_outcomes_per_call = limit;
+    }
+    // Reactions added afterwards drop outcomes whose main product has more heavy atoms, before
+    // sanitizing them
+    std::optional<unsigned int> max_heavy_atoms() const { return settings_.max_heavy_atoms; }
+    void set_max_heavy_atoms(std::optional<unsigned int> limit) {
+        settings_.max_heavy_atoms = limit;
+    }
+    // Threads used to expand the reactant combinations of each added reaction
+    size_t num_threads() const { return num_threads_; }
+    void set_num_threads(size_t num_threads) { num_threads_ = num_threads; }
 
     Result add_building_block(BuildingBlockLibrary::Index) noexcept;
     Result add_building_block(const std::string &) noexcept;
     Result add_reaction(ReactionLibrary::Index, std::optional<size_t> max_outcomes) noexcept;
+    // known_matches: template matches of molecules on the stack, e.g. from match_reactants
+    Result add_reaction(ReactionLibrary::Index, std::optional<size_t> max_outcomes,
+                        std::span<const Reaction::KnownMatches> known_matches) noexcept;
     Result add_reaction(const std::string &, std::optional<size_t> max_outcomes) noexcept;
     Result add_postfix_notation(const PostfixNotation &,
                                 std::optional<size_t> max_outcomes) noexcept;
@@ -3,6 +3,7 @@
 #include <cstddef>
 #include <map>
 #include <memory>
+#include <optional>
 #include <span>
 #include <stop_token>
 #include <string>
@@ -104,6 +105,16 @@ DataPipeline::Batch DataPipeline::get(size_t batch_size) {
     return batch;
 }
 
+// Index of the product among the evaluated items of the node it was taken from
+static std::optional<size_t> top_node_index(const SynthesisNode &node, const Molecule &product) {
+    for (size_t i = 0; i < node.num_evaluated(); ++i) {
+        if (node.at(i).get() == &product) {
+            return i;
+        }
+    }
+    return std::nullopt;
+}
+
 Worker::Worker(const DataPipeline &owner, size_t seed)
     : owner_(owner), seed_(seed),
       enumerator_(owner_.chemical_space_, owner_.enumerator_config_, seed),
@@ -114,6 +125,8 @@ Worker::Worker(const DataPipeline &owner, size_t seed)
 void Worker::run() {
     while (!thread_.get_stop_token().stop_requested()) {
         auto [synthesis, product] = enumerator_.next_with_product();
+        const auto &top = synthesis->synthesis().stack_top();
+        auto product_index = top_node_index(*top, *product);
         auto data_row = owner_.buffer_->new_write_row();
         for (const auto &[name, fn] : owner_.synthesis_descriptors_) {
             auto dest_span = data_row->data(name);
@@ -121,7 +134,13 @@ void Worker::run() {
         }
         for (const auto &[name, fn] : owner_.molecule_descriptors_) {
             auto dest_span = data_row->data(name);
-            (*fn)(*product, dest_span);
+            const auto *product_fn = dynamic_cast<const descriptor::ProductDescriptor *>(fn.get());
+            if (product_fn != nullptr && product_index.has_value()) {
+                // Lets the descriptor reuse what it computed for the precursors
+                (*product_fn)(*top, *product_index, dest_span);
+            } else {
+                (*fn)(*product, dest_span);
+            }
         }
         owner_.buffer_->put(*data_row);
     }
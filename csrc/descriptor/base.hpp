@@ -61,4 +61,18 @@ using MoleculeDescriptor = Descriptor<Molecule>;
 template class Descriptor<chemspace::Synthesis>;
 using SynthesisDescriptor = Descriptor<chemspace::Synthesis>;
 
+// Implemented by molecule descriptors that can reuse work done for the precursors of a product.
+// Describes the molecule at the given index of the node, the same way as for the molecule alone.
+class ProductDescriptor {
+public:
+    ProductDescriptor() = default;
+    ProductDescriptor(const ProductDescriptor &) = default;
+    ProductDescriptor(ProductDescriptor &&) = default;
+    ProductDescriptor &operator=(const ProductDescriptor &) = default;
+    ProductDescriptor &operator=(ProductDescriptor &&) = default;
+
+    virtual ~ProductDescriptor() = default;
+    virtual void operator()(const SynthesisNode &, size_t index, std::span<std::byte> &) const = 0;
+};
+
 } // namespace prexsyn::descriptor
@@ -1,39 +1,356 @@
 #include "morgan.hpp"
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
+#include <limits>
 #include <memory>
 #include <span>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include <DataStructs/ExplicitBitVect.h>
 #include <GraphMol/Fingerprints/MorganFingerprints.h>
 #include <GraphMol/Fingerprints/MorganGenerator.h>
 #include <GraphMol/Fingerprints/RDKitFPGenerator.h>
+#include <RDGeneral/hash/hash.hpp>
 
 #include "../chemistry/chemistry.hpp"
 
 namespace prexsyn::descriptor {
 
-std::unique_ptr<MorganFingerprint> MorganFingerprint::ecfp4() {
-    std::unique_ptr<Generator> generator{
-        RDKit::MorganFingerprint::getMorganGenerator<std::uint64_t>(2, false, false, true, false,
-                                                                    true, nullptr, nullptr)};
-    return std::make_unique<MorganFingerprint>(std::move(generator));
+namespace {
+
+using Environments = MorganAtomEnvironments;
+constexpr auto kRadius = Environments::kRadius;
+// Codes of an atom's environments depend on nothing more than this many bonds away, so atoms
+// farther from any change keep the state they had in their precursor
+constexpr unsigned int kAffectedDistance = kRadius;
+
+using NeighborInvariants = std::vector<std::pair<std::int32_t, std::uint32_t>>;
+
+// Identifier of the environment of radius layer + 1 around the atom, hashed like RDKit's
+// MorganEnvGenerator without chirality
+std::uint32_t next_code(const RDKit::ROMol &mol, const Environments &env, unsigned int layer,
+                        unsigned int idx, NeighborInvariants &nbrs) {
+    nbrs.clear();
+    for (const auto *bond : mol.atomBonds(mol.getAtomWithIdx(idx))) {
+        auto other = bond->getOtherAtomIdx(idx);
+        nbrs.emplace_back(static_cast<std::int32_t>(env.bond_invariants[bond->getIdx()]),
+                          env.codes[other][layer]);
+    }
+    std::ranges::sort(nbrs);
+    std::uint32_t code = layer;
+    // RDKit keeps the current invariants as the 64-bit output type of the generator
+    gboost::hash_combine(code, static_cast<std::uint64_t>(env.codes[idx][layer]));
+    for (const auto &nbr : nbrs) {
+        gboost::hash_combine(code, nbr);
+    }
+    return code;
+}
+
+// RDKit's generator is built with includeRedundantEnvironments, so every environment sets a bit,
+// except that an atom without bonds has none beyond radius 0
+std::uint8_t emitted_radii(const RDKit::ROMol &mol, unsigned int idx) {
+    constexpr std::uint8_t kAllRadii = (1 << (kRadius + 1)) - 1;
+    return mol.getAtomWithIdx(idx)->getDegree() == 0 ? 1 : kAllRadii;
+}
+
+// Fills codes of radius 1 and up and the emitted radii for the selected atoms. Codes of radius 0
+// and bond invariants must be set for all atoms, the rest for atoms that are not selected.
+void compute_atoms(const RDKit::ROMol &mol, Environments &env, const std::vector<bool> &selected) {
+    NeighborInvariants nbrs;
+    for (unsigned int layer = 0; layer < kRadius; ++layer) {
+        for (unsigned int idx = 0; idx < mol.getNumAtoms(); ++idx) {
+            if (selected[idx] && mol.getAtomWithIdx(idx)->getDegree() > 0) {
+                env.codes[idx][layer + 1] = next_code(mol, env, layer, idx, nbrs);
+            }
+        }
+    }
+    for (unsigned int idx = 0; idx < mol.getNumAtoms(); ++idx) {
+        if (selected[idx]) {
+            env.emitted[idx] = emitted_radii(mol, idx);
+        }
+    }
+}
+
+struct Precursor {
+    const RDKit::ROMol *mol;
+    const Environments *env;
+};
+
+struct Origin {
+    static constexpr size_t kNone = std::numeric_limits<size_t>::max();
+    size_t precursor = kNone;
+    unsigned int atom = 0;
+};
+
+// Traces product atoms back to reactant atoms through the properties RDKit sets on reaction
+// products. Origins name the precursor by the index of the reactant template it matched.
+std::vector<Origin> trace_origins(const RDKit::ROMol &product,
+                                  const RDKit::ChemicalReaction &rxn) {
+    const auto num_atoms = product.getNumAtoms();
+    std::vector<Origin> origins(num_atoms);
+
+    std::unordered_map<int, size_t> map_number_to_template;
+    for (size_t t = 0; t < rxn.getReactants().size(); ++t) {
+        for (const auto *atom : rxn.getReactants()[t]->atoms()) {
+            if (atom->getAtomMapNum() != 0) {
+                map_number_to_template.emplace(atom->getAtomMapNum(), t);
+            }
+        }
+    }
+
+    // Mapped atoms name their template, atoms carried over unmapped belong to the same reactant
+    // as the mapped atoms they are bonded to
+    std::vector<bool> from_reactant(num_atoms);
+    std::deque<unsigned int> queue;
+    for (const auto *atom : product.atoms()) {
+        unsigned int reactant_atom = 0;
+        if (!atom->getPropIfPresent(RDKit::common_properties::reactantAtomIdx, reactant_atom)) {
+            continue;
+        }
+        auto idx = atom->getIdx();
+        from_reactant[idx] = true;
+        origins[idx].atom = reactant_atom;
+        int map_number = 0;
+        if (atom->getPropIfPresent(RDKit::common_properties::reactionMapNum, map_number)) {
+            auto it = map_number_to_template.find(map_number);
+            if (it != map_number_to_template.end()) {
+                origins[idx].precursor = it->second;
+                queue.push_back(idx);
+            }
+        }
+    }
+    while (!queue.empty()) {
+        auto idx = queue.front();
+        queue.pop_front();
+        for (const auto *nbr : product.atomNeighbors(product.getAtomWithIdx(idx))) {
+            auto &origin = origins[nbr->getIdx()];
+            if (from_reactant[nbr->getIdx()] && origin.precursor == Origin::kNone) {
+                origin.precursor = origins[idx].precursor;
+                queue.push_back(nbr->getIdx());
+            }
+        }
+    }
+    return origins;
+}
+
+// Atoms whose surroundings differ from those of their origin, or that have none
+std::vector<bool> find_changed_atoms(const RDKit::ROMol &product, const Environments &env,
+                                     const std::vector<Origin> &origins,
+                                     std::span<const Precursor> precursors) {
+    const auto num_atoms = product.getNumAtoms();
+    std::vector<bool> changed(num_atoms);
+    std::vector<std::vector<unsigned int>> claimed(precursors.size());
+    for (size_t p = 0; p < precursors.size(); ++p) {
+        if (precursors[p].mol != nullptr) {
+            claimed[p].assign(precursors[p].mol->getNumAtoms(), num_atoms);
+        }
+    }
+
+    for (unsigned int idx = 0; idx < num_atoms; ++idx) {
+        const auto &origin = origins[idx];
+        if (origin.precursor >= precursors.size() || precursors[origin.precursor].mol == nullptr ||
+            origin.atom >= precursors[origin.precursor].mol->getNumAtoms()) {
+            changed[idx] = true;
+            continue;
+        }
+        const auto &pre = precursors[origin.precursor];
+        // Two product atoms traced to the same precursor atom
+        auto &owner = claimed[origin.precursor][origin.atom];
+        if (owner != num_atoms) {
+            changed[idx] = changed[owner] = true;
+            continue;
+        }
+        owner = idx;
+
+        const auto *atom = product.getAtomWithIdx(idx);
+        if (env.codes[idx][0] != pre.env->codes[origin.atom][0] ||
+            atom->getDegree() != pre.mol->getAtomWithIdx(origin.atom)->getDegree()) {
+            changed[idx] = true;
+            continue;
+        }
+        for (const auto *bond : product.atomBonds(atom)) {
+            const auto &other = origins[bond->getOtherAtomIdx(idx)];
+            const auto *pre_bond =
+                other.precursor == origin.precursor && other.atom < pre.mol->getNumAtoms()
+                    ? pre.mol->getBondBetweenAtoms(origin.atom, other.atom)
+                    : nullptr;
+            if (pre_bond == nullptr || env.bond_invariants[bond->getIdx()] !=
+                                           pre.env->bond_invariants[pre_bond->getIdx()]) {
+                changed[idx] = true;
+                break;
+            }
+        }
+    }
+    return changed;
+}
+
+// Atoms at most kAffectedDistance bonds away from a changed atom
+std::vector<bool> find_affected_atoms(const RDKit::ROMol &product,
+                                      const std::vector<bool> &changed) {
+    std::vector<unsigned int> distance(product.getNumAtoms(),
+                                       std::numeric_limits<unsigned int>::max());
+    std::deque<unsigned int> queue;
+    for (unsigned int idx = 0; idx < changed.size(); ++idx) {
+        if (changed[idx]) {
+            distance[idx] = 0;
+            queue.push_back(idx);
+        }
+    }
+    std::vector<bool> affected(changed.size());
+    while (!queue.empty()) {
+        auto idx = queue.front();
+        queue.pop_front();
+        affected[idx] = true;
+        if (distance[idx] == kAffectedDistance) {
+            continue;
+        }
+        for (const auto *nbr : product.atomNeighbors(product.getAtomWithIdx(idx))) {
+            if (distance[nbr->getIdx()] > distance[idx] + 1) {
+                distance[nbr->getIdx()] = distance[idx] + 1;
+                queue.push_back(nbr->getIdx());
+            }
+        }
+    }
+    return affected;
+}
+
+Environments initial_environments(const RDKit::ROMol &mol,
+                                  const RDKit::AtomInvariantsGenerator &atom_invariants_generator,
+                                  const RDKit::BondInvariantsGenerator &bond_invariants_generator) {
+    // Invariant generators return raw pointers with released ownership
+    std::unique_ptr<std::vector<std::uint32_t>> atom_invariants{
+        atom_invariants_generator.getAtomInvariants(mol)};
+    std::unique_ptr<std::vector<std::uint32_t>> bond_invariants{
+        bond_invariants_generator.getBondInvariants(mol)};
+
+    Environments env;
+    env.codes.resize(mol.getNumAtoms());
+    env.emitted.resize(mol.getNumAtoms());
+    for (size_t idx = 0; idx < env.codes.size(); ++idx) {
+        env.codes[idx][0] = (*atom_invariants)[idx];
+    }
+    env.bond_invariants = std::move(*bond_invariants);
+    return env;
+}
+
+// Same flags as the baseline generator: radius 2, no count simulation, no chirality, bond types,
+// zero invariants included and redundant environments included. emitted_radii() relies on the last.
+std::unique_ptr<RDKit::FingerprintGenerator<std::uint64_t>>
+make_generator(RDKit::AtomInvariantsGenerator *atom_inv, RDKit::BondInvariantsGenerator *bond_inv) {
+    constexpr bool kCountSimulation = false;
+    constexpr bool kIncludeChirality = false;
+    constexpr bool kUseBondTypes = true;
+    constexpr bool kOnlyNonzeroInvariants = false;
+    constexpr bool kIncludeRedundantEnvironments = true;
+    return std::unique_ptr<RDKit::FingerprintGenerator<std::uint64_t>>{
+        RDKit::MorganFingerprint::getMorganGenerator<std::uint64_t>(
+            kRadius, kCountSimulation, kIncludeChirality, kUseBondTypes, kOnlyNonzeroInvariants,
+            kIncludeRedundantEnvironments, atom_inv, bond_inv)};
+}
+
+} // namespace
+
+std::unique_ptr<MorganFingerprint> MorganFingerprint::ecfp4(bool incremental) {
+    // Environments depend on the configuration only, so all instances of it share the key
+    static const auto derived_key = Molecule::new_derived_key();
+    auto atom_inv = std::make_unique<RDKit::MorganFingerprint::MorganAtomInvGenerator>(true);
+    auto bond_inv = std::make_unique<RDKit::MorganFingerprint::MorganBondInvGenerator>(true, false);
+    auto instance =
+        std::make_unique<MorganFingerprint>(make_generator(atom_inv.get(), bond_inv.get()));
+    instance->atom_invariants_generator_ = std::move(atom_inv);
+    instance->bond_invariants_generator_ = std::move(bond_inv);
+    instance->incremental_ = incremental;
+    instance->derived_key_ = derived_key;
+    return instance;
 }
 
-std::unique_ptr<MorganFingerprint> MorganFingerprint::fcfp4() {
+std::unique_ptr<MorganFingerprint> MorganFingerprint::fcfp4(bool incremental) {
+    static const auto derived_key = Molecule::new_derived_key();
     auto atom_inv = std::make_unique<RDKit::MorganFingerprint::MorganFeatureAtomInvGenerator>();
-    std::unique_ptr<Generator> generator{
-        RDKit::MorganFingerprint::getMorganGenerator<std::uint64_t>(2, false, false, true, false,
-                                                                    true, atom_inv.get(), nullptr)};
-    auto instance = std::make_unique<MorganFingerprint>(std::move(generator));
+    auto bond_inv = std::make_unique<RDKit::MorganFingerprint::MorganBondInvGenerator>(true, false);
+    auto instance =
+        std::make_unique<MorganFingerprint>(make_generator(atom_inv.get(), bond_inv.get()));
     instance->atom_invariants_generator_ = std::move(atom_inv);
+    instance->bond_invariants_generator_ = std::move(bond_inv);
+    instance->incremental_ = incremental;
+    instance->derived_key_ = derived_key;
     return instance;
 }
 
+std::shared_ptr<const MorganAtomEnvironments>
+MorganFingerprint::environments(const Molecule &mol) const {
+    if (auto cached = mol.derived(derived_key_)) {
+        return std::static_pointer_cast<const Environments>(cached);
+    }
+    const auto &rdkit_mol = mol.rdkit_mol();
+    auto env = std::make_shared<Environments>(initial_environments(
+        rdkit_mol, *atom_invariants_generator_, *bond_invariants_generator_));
+    compute_atoms(rdkit_mol, *env, std::vector<bool>(rdkit_mol.getNumAtoms(), true));
+    return std::static_pointer_cast<const Environments>(mol.set_derived(derived_key_, env));
+}
+
+std::shared_ptr<const MorganAtomEnvironments>
+MorganFingerprint::environments(const SynthesisNode &node, size_t index) const {
+    const auto &mol = node.at(index);
+    if (auto cached = mol->derived(derived_key_)) {
+        return std::static_pointer_cast<const Environments>(cached);
+    }
+    if (node.reaction() == nullptr) {
+        return environments(*mol);
+    }
+
+    const auto &rxn = *node.reaction();
+    const auto &product = mol->rdkit_mol();
+    auto env = std::make_shared<Environments>(
+        initial_environments(product, *atom_invariants_generator_, *bond_invariants_generator_));
+
+    // Precursors in reactant template order, their environments are computed the same way
+    std::vector<std::shared_ptr<const Environments>> precursor_envs(rxn.num_reactants());
+    std::vector<Precursor> precursors(rxn.num_reactants(), {.mol = nullptr, .env = nullptr});
+    for (const auto &precursor : node.precursors(index)) {
+        auto t = rxn.reactant_name_to_index().at(precursor.reactant_name);
+        precursor_envs[t] = environments(*precursor.precursor_node, precursor.item_index);
+        precursors[t] = {.mol = &precursor.molecule->rdkit_mol(), .env = precursor_envs[t].get()};
+    }
+
+    auto origins = trace_origins(product, rxn.rdkit_rxn());
+    auto affected = find_affected_atoms(product, find_changed_atoms(product, *env, origins,
+                                                                    precursors));
+    for (unsigned int idx = 0; idx < product.getNumAtoms(); ++idx) {
+        if (!affected[idx]) {
+            const auto &origin = origins[idx];
+            env->codes[idx] = precursors[origin.precursor].env->codes[origin.atom];
+            env->emitted[idx] = precursors[origin.precursor].env->emitted[origin.atom];
+        }
+    }
+    compute_atoms(product, *env, affected);
+    return std::static_pointer_cast<const Environments>(mol->set_derived(derived_key_, env));
+}
+
+void MorganFingerprint::write_bits(const MorganAtomEnvironments &env,
+                                   std::span<std::byte> &out) const {
+    auto out_t = cast<bool>(out);
+    std::ranges::fill(out_t, false);
+    for (size_t idx = 0; idx < env.codes.size(); ++idx) {
+        for (unsigned int radius = 0; radius <= kRadius; ++radius) {
+            if (env.emitted[idx] & (1 << radius)) {
+                out_t[env.codes[idx][radius] % out_t.size()] = true;
+            }
+        }
+    }
+}
+
 void MorganFingerprint::operator()(const Molecule &mol, std::span<std::byte> &out) const {
     check_size(out);
+    if (incremental_) {
+        write_bits(*environments(mol), out);
+        return;
+    }
     auto out_t = cast<bool>(out);
 
     // getFingerprint returns a raw pointer with released ownership
@@ -43,4 +360,14 @@ void MorganFingerprint::operator()(const Molecule &mol, std::span<std::byte> &ou
     }
 }
 
+void MorganFingerprint::operator()(const SynthesisNode &node, size_t index,
+                                   std::span<std::byte> &out) const {
+    check_size(out);
+    if (!incremental_) {
+        (*this)(*node.at(index), out);
+        return;
+    }
+    write_bits(*environments(node, index), out);
+}
+
 } // namespace prexsyn::descriptor
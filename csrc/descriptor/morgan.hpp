@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
@@ -14,7 +15,19 @@
 
 namespace prexsyn::descriptor {
 
-class MorganFingerprint : public MoleculeDescriptor {
+// State of the Morgan algorithm for every atom of a molecule, enough to fingerprint it and to
+// derive the state of reaction products without starting over
+struct MorganAtomEnvironments {
+    static constexpr unsigned int kRadius = 2;
+
+    // codes[a][r] is the identifier of the environment of radius r around atom a
+    std::vector<std::array<std::uint32_t, kRadius + 1>> codes;
+    // Bit r is set if the atom has an environment of radius r, which sets a fingerprint bit
+    std::vector<std::uint8_t> emitted;
+    std::vector<std::uint32_t> bond_invariants;
+};
+
+class MorganFingerprint : public MoleculeDescriptor, public ProductDescriptor {
 private:
     using Generator = RDKit::FingerprintGenerator<std::uint64_t>;
     std::unique_ptr<Generator> generator_;
@@ -22,16 +35,32 @@ private:
     std::unique_ptr<RDKit::AtomInvariantsGenerator> atom_invariants_generator_ = nullptr;
     std::unique_ptr<RDKit::BondInvariantsGenerator> bond_invariants_generator_ = nullptr;
 
+    // Products are fingerprinted from the environments of their precursors, which are kept on
+    // the molecules under this key. This trades memory on every building block and
+    // intermediate for recomputing only the atoms near each reaction center. The key is shared
+    // by all instances of a configuration, see ecfp4().
+    bool incremental_ = false;
+    std::uint64_t derived_key_ = 0;
+
+    std::shared_ptr<const MorganAtomEnvironments> environments(const Molecule &) const;
+    std::shared_ptr<const MorganAtomEnvironments> environments(const SynthesisNode &,
+                                                               size_t index) const;
+    void write_bits(const MorganAtomEnvironments &, std::span<std::byte> &out) const;
+
 public:
     MorganFingerprint(std::unique_ptr<Generator> generator) : generator_(std::move(generator)) {};
 
-    static std::unique_ptr<MorganFingerprint> ecfp4();
-    static std::unique_ptr<MorganFingerprint> fcfp4();
+    static std::unique_ptr<MorganFingerprint> ecfp4(bool incremental = false);
+    static std::unique_ptr<MorganFingerprint> fcfp4(bool incremental = false);
+
+    bool incremental() const { return incremental_; }
 
     std::vector<size_t> size() const override { return {generator_->getOptions()->d_fpSize}; }
     DataType::T dtype() const override { return DataType::bool8; }
 
     void operator()(const Molecule &mol, std::span<std::byte> &out) const override;
+    void operator()(const SynthesisNode &node, size_t index,
+                    std::span<std::byte> &out) const override;
 };
 
 } // namespace prexsyn::descriptor
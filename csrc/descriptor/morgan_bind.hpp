@@ -11,8 +11,9 @@ namespace py = pybind11;
 
 inline void def_submodule_morgan(py::module &m) {
     py::class_<MorganFingerprint, MoleculeDescriptor, py::smart_holder>(m, "MorganFingerprint")
-        .def_static("ecfp4", &MorganFingerprint::ecfp4)
-        .def_static("fcfp4", &MorganFingerprint::fcfp4);
+        .def_static("ecfp4", &MorganFingerprint::ecfp4, py::arg("incremental") = false)
+        .def_static("fcfp4", &MorganFingerprint::fcfp4, py::arg("incremental") = false)
+        .def("incremental", &MorganFingerprint::incremental);
 }
 
 } // namespace prexsyn::descriptor
@@ -2,6 +2,8 @@
 #include <cstddef>
 #include <filesystem>
 #include <fstream>
+#include <memory>
+#include <optional>
 #include <span>
 #include <sstream>
 #include <stdexcept>
@@ -17,6 +19,9 @@
 namespace {
 
 using prexsyn::Molecule;
+using prexsyn::Reaction;
+using prexsyn::Synthesis;
+using prexsyn::SynthesisNode;
 using prexsyn::descriptor::MorganFingerprint;
 
 struct FingerprintReference {
@@ -89,12 +94,7 @@ std::vector<FingerprintReference> load_reference_rows() {
     return rows;
 }
 
-std::vector<size_t> compute_nonzero_indices(const MorganFingerprint &descriptor,
-                                            const Molecule &molecule) {
-    std::vector<std::byte> output(descriptor.size_in_bytes());
-    std::span<std::byte> out_span(output.data(), output.size());
-    descriptor(molecule, out_span);
-
+std::vector<size_t> nonzero_indices(const std::vector<std::byte> &output) {
     std::vector<size_t> indices;
     indices.reserve(output.size());
     for (size_t i = 0; i < output.size(); ++i) {
@@ -105,6 +105,36 @@ std::vector<size_t> compute_nonzero_indices(const MorganFingerprint &descriptor,
     return indices;
 }
 
+std::vector<size_t> compute_nonzero_indices(const MorganFingerprint &descriptor,
+                                            const Molecule &molecule) {
+    std::vector<std::byte> output(descriptor.size_in_bytes());
+    std::span<std::byte> out_span(output.data(), output.size());
+    descriptor(molecule, out_span);
+    return nonzero_indices(output);
+}
+
+std::vector<size_t> compute_nonzero_indices(const MorganFingerprint &descriptor,
+                                            const SynthesisNode &node, size_t index) {
+    std::vector<std::byte> output(descriptor.size_in_bytes());
+    std::span<std::byte> out_span(output.data(), output.size());
+    descriptor(node, index, out_span);
+    return nonzero_indices(output);
+}
+
+// Products of the node fingerprinted from their precursors match the plain fingerprints
+void expect_incremental_matches_full(const SynthesisNode &node) {
+    ASSERT_GT(node.size(), 0U);
+    const auto check = [&](const MorganFingerprint &full, const MorganFingerprint &incremental) {
+        for (size_t i = 0; i < node.size(); ++i) {
+            SCOPED_TRACE("Product: " + node.at(i)->smiles());
+            EXPECT_EQ(compute_nonzero_indices(incremental, node, i),
+                      compute_nonzero_indices(full, *node.at(i)));
+        }
+    };
+    check(*MorganFingerprint::ecfp4(), *MorganFingerprint::ecfp4(true));
+    check(*MorganFingerprint::fcfp4(), *MorganFingerprint::fcfp4(true));
+}
+
 } // namespace
 
 TEST(MorganFingerprintTest, ECFP4MatchesReferenceBitsFromCsv) {
@@ -142,3 +172,71 @@ TEST(MorganFingerprintTest, FCFP4MatchesReferenceBitsFromCsv) {
         EXPECT_EQ(actual, row.fcfp4_nonzero_indices);
     }
 }
+
+TEST(MorganFingerprintTest, IncrementalMatchesReferenceBitsFromCsv) {
+    const auto references = load_reference_rows();
+    ASSERT_FALSE(references.empty());
+
+    auto ecfp4 = MorganFingerprint::ecfp4(true);
+    auto fcfp4 = MorganFingerprint::fcfp4(true);
+    for (const auto &row : references) {
+        SCOPED_TRACE("SMILES: " + row.smiles);
+
+        const auto molecule = Molecule::from_smiles(row.smiles);
+        EXPECT_EQ(compute_nonzero_indices(*ecfp4, *molecule), row.ecfp4_nonzero_indices);
+        EXPECT_EQ(compute_nonzero_indices(*fcfp4, *molecule), row.fcfp4_nonzero_indices);
+    }
+}
+
+TEST(MorganFingerprintTest, IncrementalMatchesFullAlongSynthesis) {
+    const std::shared_ptr<Reaction> amide_coupling =
+        Reaction::from_smarts("[C:1](=[O:2])[OH].[N;!H0;!$(NC=O):3]>>[C:1](=[O:2])[N:3]",
+                              {"acid", "amine"});
+    const std::shared_ptr<Reaction> alkylation =
+        Reaction::from_smarts("[CH2:1]Cl.[N;!H0;!$(NC=O):2]>>[CH2:1][N:2]", {"halide", "amine"});
+
+    Synthesis synthesis;
+    synthesis.push(Molecule::from_smiles("OC(=O)c1ccc(CCl)cc1"));
+    synthesis.push(Molecule::from_smiles("NCc1ccc(F)cc1"));
+    synthesis.push(amide_coupling, std::nullopt);
+    expect_incremental_matches_full(*synthesis.stack_top());
+
+    synthesis.push(Molecule::from_smiles("C1CNCCN1C(=O)C1CC1"));
+    synthesis.push(alkylation, std::nullopt);
+    expect_incremental_matches_full(*synthesis.stack_top());
+}
+
+TEST(MorganFingerprintTest, IncrementalMatchesFullForRingFormation) {
+    // Oxazoline formation changes ring membership of every atom in the new ring
+    const std::shared_ptr<Reaction> cyclization = Reaction::from_smarts(
+        "[C:1](=[O:2])[OH].[NH2:3][CH2:4][CH2:5][OH:6]>>[C:1]1=[N:3][C:4][C:5][O:6]1",
+        {"acid", "amino_alcohol"});
+
+    Synthesis synthesis;
+    synthesis.push(Molecule::from_smiles("OC(=O)c1ccc(OC)cc1"));
+    synthesis.push(Molecule::from_smiles("NCCO"));
+    synthesis.push(cyclization, std::nullopt);
+    expect_incremental_matches_full(*synthesis.stack_top());
+}
+
+TEST(MorganFingerprintTest, IncrementalProductsMatchReferenceBitsFromCsv) {
+    // Products of a reaction that keeps its reactant as is are fingerprinted from its environments
+    const std::shared_ptr<Reaction> identity =
+        Reaction::from_smarts("[#6:1]>>[#6:1]", {"molecule"});
+    const auto references = load_reference_rows();
+    ASSERT_FALSE(references.empty());
+
+    auto ecfp4 = MorganFingerprint::ecfp4(true);
+    auto fcfp4 = MorganFingerprint::fcfp4(true);
+    for (const auto &row : references) {
+        SCOPED_TRACE("SMILES: " + row.smiles);
+
+        Synthesis synthesis;
+        synthesis.push(Molecule::from_smiles(row.smiles));
+        synthesis.push(identity, 1);
+        const auto &node = *synthesis.stack_top();
+        ASSERT_GT(node.size(), 0U);
+        EXPECT_EQ(compute_nonzero_indices(*ecfp4, node, 0), row.ecfp4_nonzero_indices);
+        EXPECT_EQ(compute_nonzero_indices(*fcfp4, node, 0), row.fcfp4_nonzero_indices);
+    }
+}
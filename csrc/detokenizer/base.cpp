@@ -15,13 +15,16 @@ namespace prexsyn::detokenizer {
 std::unique_ptr<chemspace::Synthesis>
 detokenize(const std::span<const std::int64_t> &tokens,
            const std::shared_ptr<chemspace::ChemicalSpace> &cs,
-           const descriptor::TokenDef &token_def, std::optional<size_t> max_outcomes_per_reaction) {
+           const descriptor::TokenDef &token_def, std::optional<size_t> max_outcomes_per_reaction,
+           size_t reaction_threads, std::optional<size_t> max_outcomes_per_call) {
     auto length = tokens.size() / 3;
     if (tokens.size() != length * 3) {
         throw std::invalid_argument("Token size must be a multiple of 3");
     }
 
     auto syn = cs->new_synthesis();
+    syn->set_num_threads(reaction_threads);
+    syn->set_max_outcomes_per_call(max_outcomes_per_call);
     for (size_t i = 0; i < length; ++i) {
         auto token_type = tokens[i * 3];
         auto bb_idx = tokens[(i * 3) + 1];
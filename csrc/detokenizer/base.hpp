@@ -11,9 +11,11 @@
 
 namespace prexsyn::detokenizer {
 
-std::unique_ptr<chemspace::Synthesis> detokenize(const std::span<const std::int64_t> &,
-                                                 const std::shared_ptr<chemspace::ChemicalSpace> &,
-                                                 const descriptor::TokenDef &,
-                                                 std::optional<size_t> max_outcomes_per_reaction);
+// reaction_threads: threads used to expand each reaction, see ReactionPushOptions::num_threads
+// max_outcomes_per_call: see ReactionPushOptions::max_outcomes_per_call
+std::unique_ptr<chemspace::Synthesis>
+detokenize(const std::span<const std::int64_t> &, const std::shared_ptr<chemspace::ChemicalSpace> &,
+           const descriptor::TokenDef &, std::optional<size_t> max_outcomes_per_reaction,
+           size_t reaction_threads = 1, std::optional<size_t> max_outcomes_per_call = std::nullopt);
 
 }
@@ -43,23 +43,38 @@ void def_module_detokenizer(pybind11::module &m) {
     m.def(
         "detokenize",
         [](const TokenNumPyArray &tokens, const std::shared_ptr<chemspace::ChemicalSpace> &cs,
-           const descriptor::TokenDef &token_def, std::optional<size_t> max_outcomes_per_reaction) {
-            return detokenize(single_as_span(tokens), cs, token_def, max_outcomes_per_reaction);
+           const descriptor::TokenDef &token_def, std::optional<size_t> max_outcomes_per_reaction,
+           size_t reaction_threads, std::optional<size_t> max_outcomes_per_call) {
+            return detokenize(single_as_span(tokens), cs, token_def, max_outcomes_per_reaction,
+                              reaction_threads, max_outcomes_per_call);
         },
         py::arg("tokens"), py::arg("chemical_space"),
         py::arg("token_def") = descriptor::kDefaultTokenDef,
-        py::arg("max_outcomes_per_reaction") = std::nullopt);
+        py::arg("max_outcomes_per_reaction") = std::nullopt, py::arg("reaction_threads") = 1,
+        py::arg("max_outcomes_per_call") = std::nullopt, py::keep_alive<0, 2>());
 
     py::class_<MultiThreadedDetokenizer, py::smart_holder>(m, "MultiThreadedDetokenizer")
         .def(py::init<const std::shared_ptr<chemspace::ChemicalSpace> &,
-                      const descriptor::TokenDef &, std::optional<size_t>>(),
+                      const descriptor::TokenDef &, std::optional<size_t>, size_t,
+                      std::optional<size_t>>(),
              py::arg("chemical_space"), py::arg("token_def") = descriptor::kDefaultTokenDef,
-             py::arg("max_outcomes_per_reaction") = std::nullopt)
+             py::arg("max_outcomes_per_reaction") = std::nullopt, py::arg("reaction_threads") = 1,
+             py::arg("max_outcomes_per_call") = std::nullopt)
         .def(
             "__call__",
-            [](const MultiThreadedDetokenizer &detok, const TokenNumPyArray &tokens) {
+            [](const py::object &self, const TokenNumPyArray &tokens) {
                 auto batch_size = static_cast<size_t>(tokens.shape(0));
-                return detok(batch_size, batch_as_span(tokens));
+                const auto &detok = self.cast<const MultiThreadedDetokenizer &>();
+                auto syntheses = detok(batch_size, batch_as_span(tokens));
+                // The syntheses refer to the chemical space that the detokenizer holds, and a list
+                // cannot keep it alive
+                py::list result;
+                for (auto &synthesis : syntheses) {
+                    auto py_synthesis = py::cast(std::move(synthesis));
+                    py::detail::keep_alive_impl(py_synthesis, self);
+                    result.append(py_synthesis);
+                }
+                return result;
             },
             py::arg("tokens"));
 }
@@ -29,7 +29,7 @@ MultiThreadedDetokenizer::operator()(size_t batch_size,
 #pragma omp parallel for schedule(dynamic)
     for (size_t i = 0; i < batch_size; ++i) {
         out[i] = detokenize(tokens.subspan(i * seqlen * 3, seqlen * 3), cs_, token_def_,
-                            max_outcomes_per_reaction_);
+                            max_outcomes_per_reaction_, reaction_threads_, max_outcomes_per_call_);
     }
 
     return out;
@@ -17,12 +17,19 @@ private:
     std::shared_ptr<chemspace::ChemicalSpace> cs_;
     descriptor::TokenDef token_def_;
     std::optional<size_t> max_outcomes_per_reaction_;
+    size_t reaction_threads_;
+    std::optional<size_t> max_outcomes_per_call_;
 
 public:
+    // With reaction_threads > 1, threads that finished their sequences help expanding the
+    // reactions of the remaining ones
     MultiThreadedDetokenizer(const std::shared_ptr<chemspace::ChemicalSpace> &cs,
                              const descriptor::TokenDef &token_def,
-                             std::optional<size_t> max_outcomes_per_reaction = std::nullopt)
-        : cs_(cs), token_def_(token_def), max_outcomes_per_reaction_(max_outcomes_per_reaction) {}
+                             std::optional<size_t> max_outcomes_per_reaction = std::nullopt,
+                             size_t reaction_threads = 1,
+                             std::optional<size_t> max_outcomes_per_call = std::nullopt)
+        : cs_(cs), token_def_(token_def), max_outcomes_per_reaction_(max_outcomes_per_reaction),
+          reaction_threads_(reaction_threads), max_outcomes_per_call_(max_outcomes_per_call) {}
 
     std::vector<std::unique_ptr<chemspace::Synthesis>>
     operator()(size_t batch_size, const std::span<const std::int64_t> &) const;
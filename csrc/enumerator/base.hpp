@@ -1,5 +1,7 @@
 #pragma once
 
+#include <optional>
+
 namespace prexsyn::enumerator {
 
 struct EnumeratorConfig {
@@ -7,6 +9,15 @@ struct EnumeratorConfig {
     unsigned int heavy_atom_limit = 50;
     unsigned int selectivity_cutoff = 2;
     unsigned int max_outcomes_per_reaction = 8;
+    // Hard cap on the outcomes built for one reactant combination, bounds the cost of a single
+    // reaction step when max_outcomes_per_reaction is large. Unset by default, since it can
+    // change which products are drawn, see ReactionPushOptions::max_outcomes_per_call.
+    std::optional<unsigned int> max_outcomes_per_call = std::nullopt;
+    // Evaluate reaction products on demand, only up to the product drawn at each step, which
+    // saves most reaction runs when the product lists are not needed
+    bool lazy_evaluation = false;
+    // Drop reaction by-products unprocessed, see ReactionApplyOptions::main_product_only
+    bool main_product_only = false;
 };
 
 constexpr const static EnumeratorConfig kDefaultEnumeratorConfig{};
@@ -3,6 +3,7 @@
 #include <cstddef>
 #include <memory>
 #include <optional>
+#include <utility>
 
 #include <pybind11/cast.h>
 #include <pybind11/numpy.h>
@@ -23,13 +24,22 @@ void def_module_enumerator(pybind11::module &m) {
         .def_readwrite("max_building_blocks", &EnumeratorConfig::max_building_blocks)
         .def_readwrite("heavy_atom_limit", &EnumeratorConfig::heavy_atom_limit)
         .def_readwrite("selectivity_cutoff", &EnumeratorConfig::selectivity_cutoff)
-        .def_readwrite("max_outcomes_per_reaction", &EnumeratorConfig::max_outcomes_per_reaction);
+        .def_readwrite("max_outcomes_per_reaction", &EnumeratorConfig::max_outcomes_per_reaction)
+        .def_readwrite("max_outcomes_per_call", &EnumeratorConfig::max_outcomes_per_call)
+        .def_readwrite("lazy_evaluation", &EnumeratorConfig::lazy_evaluation)
+        .def_readwrite("main_product_only", &EnumeratorConfig::main_product_only);
 
     py::class_<RandomEnumerator, py::smart_holder>(m, "RandomEnumerator")
         .def(py::init<std::shared_ptr<chemspace::ChemicalSpace>, const RandomEnumerator::Config &,
                       std::optional<size_t>>(),
              py::arg("chemical_space"), py::arg("config") = kDefaultEnumeratorConfig,
              py::arg("random_seed") = std::nullopt)
-        .def("next", &RandomEnumerator::next)
-        .def("next_with_product", &RandomEnumerator::next_with_product);
+        // Syntheses refer to the chemical space that the enumerator holds
+        .def("next", &RandomEnumerator::next, py::keep_alive<0, 1>())
+        .def("next_with_product", [](const py::object &self) {
+            auto [synthesis, product] = self.cast<RandomEnumerator &>().next_with_product();
+            auto py_synthesis = py::cast(std::move(synthesis));
+            py::detail::keep_alive_impl(py_synthesis, self);
+            return py::make_tuple(py_synthesis, Molecule::owning(product));
+        });
 }
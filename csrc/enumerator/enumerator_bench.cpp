@@ -0,0 +1,66 @@
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../chemspace/chemspace.hpp"
+#include "enumerator.hpp"
+
+using namespace prexsyn;
+
+// Runs one enumerator per thread on a shared chemical space and reports the throughput for
+// increasing thread counts. Anything shared between the threads that does not scale, e.g. atomic
+// reference counts of library molecules, shows up as a flattening curve.
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 4) {
+        std::cerr << "Usage: " << argv[0] << " <chemical_space_file> [max_threads] [seconds]\n";
+        return 1;
+    }
+    std::string cs_path = argv[1];
+    size_t max_threads = argc > 2 ? std::stoul(argv[2]) : std::thread::hardware_concurrency();
+    double seconds = argc > 3 ? std::stod(argv[3]) : 5.0;
+
+    std::ifstream ifs(cs_path, std::ios::binary);
+    if (!ifs) {
+        std::cerr << "Failed to open chemical space file: " << cs_path << "\n";
+        return 1;
+    }
+    std::shared_ptr<chemspace::ChemicalSpace> cs = chemspace::ChemicalSpace::deserialize(ifs);
+
+    for (size_t num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        std::atomic<bool> stop{false};
+        std::atomic<size_t> count{0};
+        std::vector<std::thread> threads;
+        threads.reserve(num_threads);
+        for (size_t t = 0; t < num_threads; ++t) {
+            threads.emplace_back([&, t]() {
+                enumerator::RandomEnumerator enumerator(cs, enumerator::kDefaultEnumeratorConfig,
+                                                        t);
+                size_t local_count = 0;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    enumerator.next();
+                    ++local_count;
+                }
+                count.fetch_add(local_count, std::memory_order_relaxed);
+            });
+        }
+
+        auto start_time = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        stop.store(true, std::memory_order_relaxed);
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time);
+
+        auto throughput = static_cast<double>(count.load()) / elapsed.count();
+        std::cout << "Threads " << num_threads << ": " << throughput << " syntheses/s ("
+                  << throughput / static_cast<double>(num_threads) << " per thread)\n";
+    }
+    return 0;
+}
@@ -1,7 +1,11 @@
 #include "random.hpp"
 
+#include <algorithm>
+#include <array>
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <limits>
 #include <memory>
 #include <optional>
 #include <random>
@@ -30,11 +34,56 @@ RandomEnumerator::RandomEnumerator(std::shared_ptr<chemspace::ChemicalSpace> cs,
     }
 }
 
+std::shared_ptr<Molecule> RandomEnumerator::sample_product(const chemspace::Synthesis &synthesis) {
+    if (!config_.lazy_evaluation) {
+        auto products = synthesis.products();
+        return products.empty() ? nullptr : random_choice(products, rng_);
+    }
+    // Reaction steps hold at most max_outcomes_per_reaction products. Drawing an index below that
+    // bound, and drawing again among all products when there are fewer, picks every product with
+    // the same probability while only evaluating the products up to the drawn one.
+    auto bound = std::max<size_t>(config_.max_outcomes_per_reaction, 1);
+    auto index = std::uniform_int_distribution<size_t>(0, bound - 1)(rng_);
+    auto products = synthesis.products(index + 1);
+    if (products.empty()) {
+        return nullptr;
+    }
+    return index < products.size() ? products[index] : random_choice(products, rng_);
+}
+
+std::vector<chemspace::ReactionLibrary::Match>
+RandomEnumerator::match_reactants(const Molecule &product) const {
+    size_t max_count = config_.selectivity_cutoff + 1;
+
+    // Before the first reaction the product is the initial building block, whose matches were
+    // indexed when the chemical space was built. The index can be used as long as its counts are
+    // exact up to the selectivity cutoff.
+    const auto &tokens = synthesis_->postfix_notation().tokens();
+    const auto &index = cs_->building_block_match_index();
+    if (tokens.size() == 1 &&
+        tokens.front().type == chemspace::PostfixNotation::Token::BuildingBlock &&
+        tokens.front().index < index.size() && max_count <= index.max_count()) {
+        std::vector<chemspace::ReactionLibrary::Match> matches;
+        for (const auto &entry : index.get(tokens.front().index)) {
+            const auto &rxn = cs_->rxn_lib().get(entry.reaction_index);
+            matches.push_back({
+                .reaction_index = entry.reaction_index,
+                .reaction_name = rxn.name,
+                .reactant_index = entry.reactant_index,
+                .reactant_name = rxn.reaction->reactant_names().at(entry.reactant_index),
+                .count = entry.count,
+            });
+        }
+        return matches;
+    }
+    return cs_->rxn_lib().match_reactants(product, max_count);
+}
+
 bool RandomEnumerator::not_growable() const {
     if (synthesis_ == nullptr) {
         return false;
     }
-    auto products = synthesis_->products();
+    auto products = synthesis_->products(1);
     if (products.empty()) {
         return false;
     }
@@ -47,6 +96,11 @@ void RandomEnumerator::clear_synthesis() { synthesis_.reset(); }
 
 void RandomEnumerator::init_synthesis() {
     synthesis_ = cs_->new_synthesis();
+    synthesis_->set_lazy_evaluation(config_.lazy_evaluation);
+    synthesis_->set_main_product_only(config_.main_product_only);
+    synthesis_->set_max_outcomes_per_call(config_.max_outcomes_per_call);
+    // Products over the limit are dropped before they are sanitized
+    synthesis_->set_max_heavy_atoms(config_.heavy_atom_limit);
 
     auto num_bb = cs_->bb_lib().size();
     std::uniform_int_distribution<size_t> dist(0, num_bb - 1);
@@ -55,33 +109,66 @@ void RandomEnumerator::init_synthesis() {
 }
 
 void RandomEnumerator::grow_synthesis() {
-    auto products = synthesis_->products();
-    if (products.empty()) {
+    auto product = sample_product(*synthesis_);
+    if (product == nullptr) {
         clear_synthesis();
         return;
     }
-    auto product = random_choice(products, rng_);
 
-    auto matches = cs_->rxn_lib().match_reactants(*product);
+    auto matches = match_reactants(*product);
 
-    // Remove when there are too many same functional groups for the reaction (poor selectivity)
-    std::erase_if(matches,
-                  [&](const auto &match) { return match.count > config_.selectivity_cutoff; });
+    // Skip when there are too many same functional groups for the reaction (poor selectivity)
+    std::vector<size_t> candidates;
+    for (size_t i = 0; i < matches.size(); ++i) {
+        if (matches[i].count <= config_.selectivity_cutoff) {
+            candidates.push_back(i);
+        }
+    }
 
-    if (matches.empty()) {
+    if (candidates.empty()) {
         clear_synthesis();
         return;
     }
-    auto match = random_choice(matches, rng_);
+    const auto &match = matches[random_choice(candidates, rng_)];
+
+    // Hand all template matches of the product for the chosen reaction over to the reaction
+    // step, so that the product is not matched against the templates again
+    std::vector<Reaction::ReactantMatch> product_matches;
+    for (const auto &m : matches) {
+        if (m.reaction_index == match.reaction_index) {
+            product_matches.push_back(
+                {.index = m.reactant_index, .name = m.reactant_name, .count = m.count});
+        }
+    }
+    const std::array<Reaction::KnownMatches, 1> known_matches{{{product.get(), product_matches}}};
+
+    const auto &rxn = cs_->rxn_lib().get(match.reaction_index);
+    // Heavy atoms left for the other reactants, so that partners which would take the product
+    // over the limit are not drawn in the first place. Only reactions that delete no atoms
+    // predict the product size exactly, the others may lose more atoms than their templates
+    // delete, so their products are checked against the limit once built.
+    std::optional<std::int64_t> budget;
+    if (rxn.reaction->heavy_atom_delta_is_exact()) {
+        budget = std::int64_t{config_.heavy_atom_limit} - product->num_heavy_atoms() -
+                 *rxn.reaction->heavy_atom_delta();
+    }
 
-    auto rxn = cs_->rxn_lib().get(match.reaction_index);
     chemspace::Synthesis::Result result;
     for (size_t i = 0; i < rxn.reaction->num_reactants(); ++i) {
         if (i == match.reactant_index) {
             continue;
         }
-        const auto &rlist_bb = cs_->building_block_reactant_lists().get(match.reaction_index, i);
-        const auto &rlist_int = cs_->intermediate_reactant_lists().get(match.reaction_index, i);
+        if (budget.has_value() && *budget < 0) {
+            // Even the smallest partner would not fit
+            clear_synthesis();
+            return;
+        }
+        auto max_heavy_atoms = budget.has_value() ? static_cast<size_t>(*budget)
+                                                  : std::numeric_limits<size_t>::max();
+        auto rlist_bb = cs_->building_block_reactant_lists().get_within(match.reaction_index, i,
+                                                                        max_heavy_atoms);
+        auto rlist_int = cs_->intermediate_reactant_lists().get_within(match.reaction_index, i,
+                                                                       max_heavy_atoms);
         if (rlist_bb.empty() && rlist_int.empty()) {
             // No possible reactants for this slot, so this reaction can't be applied
             clear_synthesis();
@@ -89,19 +176,26 @@ void RandomEnumerator::grow_synthesis() {
         }
 
         const auto &[choice, index] = random_choice(rlist_bb, rlist_int, rng_);
+        unsigned int partner_heavy_atoms = 0;
         if (choice == which_vector::first) {
             result = synthesis_->add_building_block(index);
+            partner_heavy_atoms = cs_->bb_lib().get(index).molecule.get()->num_heavy_atoms();
         } else {
             result = synthesis_->add_intermediate(index, config_.max_outcomes_per_reaction);
+            partner_heavy_atoms = cs_->int_lib().get(index).molecule.get()->num_heavy_atoms();
         }
         if (!result) {
             clear_synthesis();
             return;
         }
+        if (budget.has_value()) {
+            *budget -= partner_heavy_atoms;
+        }
     }
 
     // add_reaction returns failure if there's no products produced
-    result = synthesis_->add_reaction(match.reaction_index, config_.max_outcomes_per_reaction);
+    result = synthesis_->add_reaction(match.reaction_index, config_.max_outcomes_per_reaction,
+                                      known_matches);
     if (!result) {
         clear_synthesis();
         return;
@@ -136,7 +230,7 @@ std::shared_ptr<chemspace::Synthesis> RandomEnumerator::next() {
 std::pair<std::shared_ptr<chemspace::Synthesis>, std::shared_ptr<Molecule>>
 RandomEnumerator::next_with_product() {
     auto syn = next();
-    auto product = random_choice(syn->products(), rng_);
+    auto product = sample_product(*syn);
     return {syn, product};
 }
 
@@ -5,6 +5,7 @@
 #include <optional>
 #include <random>
 #include <utility>
+#include <vector>
 
 #include "../chemistry/chemistry.hpp"
 #include "../chemspace/chemspace.hpp"
@@ -24,6 +25,8 @@ private:
     std::mt19937 rng_;
 
     bool not_growable() const;
+    std::shared_ptr<Molecule> sample_product(const chemspace::Synthesis &);
+    std::vector<chemspace::ReactionLibrary::Match> match_reactants(const Molecule &product) const;
 
     void clear_synthesis();
     void init_synthesis();
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <initializer_list>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace prexsyn {
+
+// Array that either owns its values or reads them in place from memory kept alive by an owner,
+// e.g. a MappedFile. Mapped values are copied out on the first call to values(), so that they can
+// be modified.
+template <typename T> class ArrayStorage {
+private:
+    std::vector<T> owned_;
+    std::span<const T> mapped_;
+    std::shared_ptr<const void> owner_;
+
+public:
+    ArrayStorage() = default;
+    ArrayStorage(std::initializer_list<T> values) : owned_(values) {}
+    ArrayStorage(std::vector<T> values) // NOLINT(google-explicit-constructor)
+        : owned_(std::move(values)) {}
+    ArrayStorage(std::span<const T> mapped, std::shared_ptr<const void> owner)
+        : mapped_(mapped), owner_(std::move(owner)) {}
+
+    bool is_mapped() const { return owner_ != nullptr; }
+    std::span<const T> view() const { return is_mapped() ? mapped_ : std::span<const T>(owned_); }
+
+    size_t size() const { return view().size(); }
+    bool empty() const { return view().empty(); }
+    const T &operator[](size_t i) const { return view()[i]; }
+    const T &back() const { return view().back(); }
+    auto begin() const { return view().begin(); }
+    auto end() const { return view().end(); }
+
+    std::vector<T> &values() {
+        if (is_mapped()) {
+            owned_.assign(mapped_.begin(), mapped_.end());
+            mapped_ = {};
+            owner_.reset();
+        }
+        return owned_;
+    }
+
+    // Same archive form as std::vector<T>. Called as a member rather than through the archive, so
+    // that no class information is written for it.
+    template <typename Archive> void serialize(Archive &ar) {
+        if constexpr (Archive::is_saving::value) {
+            if (is_mapped()) {
+                std::vector<T> copy(mapped_.begin(), mapped_.end());
+                ar & copy;
+                return;
+            }
+        } else {
+            *this = ArrayStorage();
+        }
+        ar & owned_;
+    }
+};
+
+} // namespace prexsyn
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+
+namespace prexsyn {
+
+// Raw values in host byte order, for the framing around binary archives and for the mapped
+// chemical space format
+template <typename T> void write_array(std::ostream &os, std::span<const T> values) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    os.write(reinterpret_cast<const char *>(values.data()),
+             static_cast<std::streamsize>(values.size_bytes()));
+}
+
+inline void write_u64(std::ostream &os, std::uint64_t value) {
+    write_array(os, std::span<const std::uint64_t>(&value, 1));
+}
+
+inline std::uint64_t read_u64(std::istream &is) {
+    std::uint64_t value = 0;
+    if (!is.read(reinterpret_cast<char *>(&value), sizeof(value))) {
+        throw std::runtime_error("unexpected end of stream");
+    }
+    return value;
+}
+
+// Bytes left to read, or nullopt if the stream cannot seek
+inline std::optional<std::uint64_t> remaining_bytes(std::istream &is) {
+    auto position = is.tellg();
+    if (position < 0) {
+        return std::nullopt;
+    }
+    is.seekg(0, std::ios::end);
+    auto end = is.tellg();
+    is.seekg(position);
+    if (end < 0 || !is) {
+        is.clear();
+        is.seekg(position);
+        return std::nullopt;
+    }
+    return static_cast<std::uint64_t>(end - position);
+}
+
+} // namespace prexsyn
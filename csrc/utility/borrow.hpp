@@ -0,0 +1,18 @@
+#pragma once
+
+#include <memory>
+
+namespace prexsyn {
+
+// Non-owning shared_ptr to an object owned elsewhere, e.g. by a library of the chemical space.
+// It has no control block, so copying it does not touch a reference count that other threads
+// share. The owner must outlive every copy.
+template <typename T> std::shared_ptr<T> borrow(const std::shared_ptr<T> &owner) {
+    return std::shared_ptr<T>(std::shared_ptr<T>(), owner.get());
+}
+
+template <typename T> bool is_borrowed(const std::shared_ptr<T> &ptr) {
+    return ptr != nullptr && ptr.use_count() == 0;
+}
+
+} // namespace prexsyn
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <omp.h>
+
+#include "binary_stream.hpp"
+#include "serialization.hpp"
+
+namespace prexsyn {
+
+// Sections are prefixed with their size in bytes, so that a reader can hand them over to another
+// thread without decoding them. Sizes are raw u64 in host byte order, like the binary archives.
+inline void write_section(std::ostream &os, const std::string &bytes) {
+    write_u64(os, bytes.size());
+    os.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+// Streams that cannot seek are read in steps of this size, so that a corrupted size runs into the
+// end of the stream before it is allocated
+constexpr std::uint64_t kSectionReadStep = std::uint64_t{1} << 24;
+
+inline std::string read_section(std::istream &is) {
+    auto size = read_u64(is);
+    auto remaining = remaining_bytes(is);
+    if (remaining.has_value() && size > *remaining) {
+        throw std::runtime_error("section size exceeds the end of the stream");
+    }
+    std::string bytes;
+    while (bytes.size() < size) {
+        auto offset = bytes.size();
+        auto step = size - offset;
+        if (!remaining.has_value()) {
+            step = std::min(step, kSectionReadStep);
+        }
+        bytes.resize(offset + step);
+        if (!is.read(bytes.data() + offset, static_cast<std::streamsize>(step))) {
+            throw std::runtime_error("unexpected end of stream");
+        }
+    }
+    return bytes;
+}
+
+// Items are written in chunks, each an independent binary archive in its own section, so that
+// chunks are encoded and decoded on all OpenMP threads. Only a window of chunks is held in memory
+// at a time, and the next window is read while the current one is decoded.
+constexpr size_t kArchiveChunkSize = 4096;
+
+inline size_t archive_window_size() { return 2 * static_cast<size_t>(omp_get_max_threads()); }
+
+namespace detail {
+
+template <typename Fn> void parallel_for_rethrow(size_t n, const Fn &fn) {
+    std::vector<std::exception_ptr> errors(n);
+#pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < n; ++i) {
+        try {
+            fn(i);
+        } catch (...) {
+            errors[i] = std::current_exception();
+        }
+    }
+    for (const auto &error : errors) {
+        if (error != nullptr) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+} // namespace detail
+
+template <typename Item>
+void write_chunked(std::ostream &os, std::span<const Item> items,
+                   size_t chunk_size = kArchiveChunkSize) {
+    auto num_chunks = (items.size() + chunk_size - 1) / chunk_size;
+    write_u64(os, items.size());
+    write_u64(os, num_chunks);
+
+    auto window = archive_window_size();
+    std::vector<std::string> encoded;
+    for (size_t first = 0; first < num_chunks; first += window) {
+        encoded.assign(std::min(window, num_chunks - first), {});
+        detail::parallel_for_rethrow(encoded.size(), [&](size_t i) {
+            auto begin = (first + i) * chunk_size;
+            auto end = std::min(begin + chunk_size, items.size());
+            std::ostringstream ss;
+            {
+                boost::archive::binary_oarchive oa(ss);
+                oa << (end - begin);
+                for (auto k = begin; k < end; ++k) {
+                    oa << items[k];
+                }
+            }
+            encoded[i] = std::move(ss).str();
+        });
+        for (const auto &chunk : encoded) {
+            write_section(os, chunk);
+        }
+    }
+}
+
+template <typename Item> std::vector<Item> read_chunked(std::istream &is) {
+    auto num_items = read_u64(is);
+    auto num_chunks = read_u64(is);
+
+    auto window = archive_window_size();
+    auto read_window = [&is, window, remaining = num_chunks]() mutable {
+        std::vector<std::string> chunks;
+        for (; remaining > 0 && chunks.size() < window; --remaining) {
+            chunks.push_back(read_section(is));
+        }
+        return chunks;
+    };
+
+    // Every item takes at least one byte, so a corrupted count is not reserved beyond the stream
+    std::vector<Item> items;
+    items.reserve(std::min(num_items, remaining_bytes(is).value_or(0)));
+    auto chunks = read_window();
+    while (!chunks.empty()) {
+        // By reference, so that the count of remaining chunks carries over to the next window
+        auto next_chunks = std::async(std::launch::async, std::ref(read_window));
+
+        std::vector<std::vector<Item>> decoded(chunks.size());
+        const auto items_left = num_items - items.size();
+        detail::parallel_for_rethrow(chunks.size(), [&](size_t i) {
+            const auto chunk_bytes = chunks[i].size();
+            std::istringstream ss(std::move(chunks[i]));
+            boost::archive::binary_iarchive ia(ss);
+            size_t count = 0;
+            ia >> count;
+            // Checked before the items are allocated, like the header count
+            if (count > chunk_bytes || count > items_left) {
+                throw std::runtime_error("chunked archive chunk claims more items than it holds");
+            }
+            decoded[i].resize(count);
+            for (auto &item : decoded[i]) {
+                ia >> item;
+            }
+        });
+        for (auto &chunk : decoded) {
+            if (chunk.size() > num_items - items.size()) {
+                throw std::runtime_error("chunked archive holds more items than its header");
+            }
+            std::ranges::move(chunk, std::back_inserter(items));
+        }
+        chunks = next_chunks.get();
+    }
+    if (items.size() != num_items) {
+        throw std::runtime_error("chunked archive holds fewer items than its header");
+    }
+    return items;
+}
+
+} // namespace prexsyn
@@ -0,0 +1,90 @@
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <omp.h>
+
+#include "chunked_archive.hpp"
+
+namespace {
+
+std::vector<std::string> make_items(size_t n) {
+    std::vector<std::string> items;
+    for (size_t i = 0; i < n; ++i) {
+        items.push_back("item-" + std::to_string(i));
+    }
+    return items;
+}
+
+} // namespace
+
+TEST(ChunkedArchiveTest, RoundTripsAcrossWindowsInOrder) {
+    // Several windows of chunks, and a last chunk that is not full
+    const auto items = make_items(prexsyn::archive_window_size() * 3 * 7 + 5);
+    std::stringstream ss;
+    prexsyn::write_chunked(ss, std::span<const std::string>(items), 7);
+    prexsyn::write_section(ss, "trailer");
+
+    EXPECT_EQ(prexsyn::read_chunked<std::string>(ss), items);
+    EXPECT_EQ(prexsyn::read_section(ss), "trailer");
+}
+
+TEST(ChunkedArchiveTest, DoesNotDependOnThreadCount) {
+    const int default_threads = omp_get_max_threads();
+    const auto items = make_items(1000);
+    auto write = [&items](int num_threads) {
+        omp_set_num_threads(num_threads);
+        std::ostringstream ss;
+        prexsyn::write_chunked(ss, std::span<const std::string>(items), 16);
+        return ss.str();
+    };
+    auto serial = write(1);
+    auto parallel = write(4);
+    omp_set_num_threads(default_threads);
+    EXPECT_EQ(parallel, serial);
+}
+
+TEST(ChunkedArchiveTest, EmptyAndTruncatedStreams) {
+    std::stringstream empty;
+    prexsyn::write_chunked(empty, std::span<const std::string>());
+    EXPECT_TRUE(prexsyn::read_chunked<std::string>(empty).empty());
+
+    const auto items = make_items(100);
+    std::ostringstream os;
+    prexsyn::write_chunked(os, std::span<const std::string>(items), 10);
+    auto bytes = os.str();
+    std::istringstream truncated(bytes.substr(0, bytes.size() / 2));
+    EXPECT_THROW(prexsyn::read_chunked<std::string>(truncated), std::runtime_error);
+}
+
+TEST(ChunkedArchiveTest, CorruptedSizesAreNotAllocated) {
+    // A section that claims more bytes than are left in the stream
+    std::stringstream section;
+    prexsyn::write_u64(section, std::uint64_t{1} << 60);
+    section.write("abc", 3);
+    EXPECT_THROW(prexsyn::read_section(section), std::runtime_error);
+
+    // A header that claims more items than any stream holds
+    std::stringstream chunked;
+    prexsyn::write_u64(chunked, std::numeric_limits<std::uint64_t>::max());
+    prexsyn::write_u64(chunked, 0);
+    EXPECT_THROW(prexsyn::read_chunked<std::string>(chunked), std::runtime_error);
+
+    // A chunk that claims more items than its bytes could hold
+    std::ostringstream chunk;
+    {
+        boost::archive::binary_oarchive oa(chunk);
+        oa << (size_t{1} << 60);
+    }
+    std::stringstream oversized_chunk;
+    prexsyn::write_u64(oversized_chunk, 1);
+    prexsyn::write_u64(oversized_chunk, 1);
+    prexsyn::write_section(oversized_chunk, chunk.str());
+    EXPECT_THROW(prexsyn::read_chunked<std::string>(oversized_chunk), std::runtime_error);
+}
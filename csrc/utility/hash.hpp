@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace prexsyn {
+
+inline std::uint64_t hash_mix(std::uint64_t x) {
+    // splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+inline std::uint64_t hash_string(std::string_view str) {
+    // FNV-1a, mixed so that the low bits are usable as a table index
+    std::uint64_t h = 0xcbf29ce484222325ULL;
+    for (auto c : str) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 0x100000001b3ULL;
+    }
+    return hash_mix(h);
+}
+
+inline std::uint64_t hash_combine(std::uint64_t seed, std::uint64_t value) {
+    return hash_mix(seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2)));
+}
+
+// Open addressing table from 64-bit hashes to values. Entries are never removed, and several
+// entries may share a hash, so lookups take a predicate that verifies a candidate value.
+class HashIndex {
+public:
+    using Value = size_t;
+
+private:
+    static constexpr Value kEmpty = std::numeric_limits<Value>::max();
+    static constexpr size_t kInitialCapacity = 16;
+
+    struct Slot {
+        std::uint64_t hash;
+        Value value;
+    };
+    std::vector<Slot> slots_;
+    size_t size_ = 0;
+
+    size_t mask() const { return slots_.size() - 1; }
+
+    void grow() {
+        std::vector<Slot> old(slots_.empty() ? kInitialCapacity : slots_.size() * 2,
+                              Slot{0, kEmpty});
+        old.swap(slots_);
+        for (const auto &slot : old) {
+            if (slot.value != kEmpty) {
+                place(slot);
+            }
+        }
+    }
+
+    void place(const Slot &slot) {
+        size_t i = slot.hash & mask();
+        while (slots_[i].value != kEmpty) {
+            i = (i + 1) & mask();
+        }
+        slots_[i] = slot;
+    }
+
+public:
+    size_t size() const { return size_; }
+
+    template <typename Pred> std::optional<Value> find(std::uint64_t hash, Pred &&pred) const {
+        if (slots_.empty()) {
+            return std::nullopt;
+        }
+        for (size_t i = hash & mask(); slots_[i].value != kEmpty; i = (i + 1) & mask()) {
+            if (slots_[i].hash == hash && pred(slots_[i].value)) {
+                return slots_[i].value;
+            }
+        }
+        return std::nullopt;
+    }
+
+    void insert(std::uint64_t hash, Value value) {
+        // Keep the load factor at most 1/2
+        if ((size_ + 1) * 2 > slots_.size()) {
+            grow();
+        }
+        place({hash, value});
+        ++size_;
+    }
+};
+
+} // namespace prexsyn
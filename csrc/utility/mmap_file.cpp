@@ -0,0 +1,50 @@
+#include "mmap_file.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace prexsyn {
+
+MappedFile::MappedFile(const std::filesystem::path &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("failed to open file for mapping: " + path.string() + ": " +
+                                 std::strerror(errno));
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        auto error = errno;
+        ::close(fd);
+        throw std::runtime_error("failed to stat file: " + path.string() + ": " +
+                                 std::strerror(error));
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ > 0) {
+        data_ = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        if (data_ == MAP_FAILED) {
+            auto error = errno;
+            ::close(fd);
+            data_ = nullptr;
+            throw std::runtime_error("failed to map file: " + path.string() + ": " +
+                                     std::strerror(error));
+        }
+    }
+    // The mapping stays valid after the descriptor is closed
+    ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+        ::munmap(data_, size_);
+    }
+}
+
+} // namespace prexsyn
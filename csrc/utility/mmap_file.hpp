@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+
+namespace prexsyn {
+
+// Read-only mapping of a whole file. Pages are read on first access and shared through the page
+// cache with every other process that maps the same file.
+class MappedFile {
+private:
+    void *data_ = nullptr;
+    size_t size_ = 0;
+
+public:
+    explicit MappedFile(const std::filesystem::path &);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    size_t size() const { return size_; }
+    std::span<const std::byte> bytes() const {
+        return {static_cast<const std::byte *>(data_), size_};
+    }
+};
+
+} // namespace prexsyn
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace prexsyn {
+
+// Immutable singly linked stack. Copies are O(1) and share their cells, push and pop return a
+// new stack and leave the original untouched, so copies never observe each other's changes.
+template <typename T> class PersistentStack {
+private:
+    struct Cell {
+        T value;
+        std::shared_ptr<const Cell> next;
+        size_t size;
+    };
+    std::shared_ptr<const Cell> head_;
+
+    explicit PersistentStack(std::shared_ptr<const Cell> head) : head_(std::move(head)) {}
+
+public:
+    PersistentStack() = default;
+
+    bool empty() const { return head_ == nullptr; }
+    size_t size() const { return head_ == nullptr ? 0 : head_->size; }
+
+    // i-th element counting from the top
+    const T &at(size_t i) const {
+        if (i >= size()) {
+            throw std::out_of_range("PersistentStack index out of range");
+        }
+        const auto *cell = head_.get();
+        for (; i > 0; --i) {
+            cell = cell->next.get();
+        }
+        return cell->value;
+    }
+    const T &top() const { return at(0); }
+
+    PersistentStack push(T value) const {
+        return PersistentStack(std::make_shared<const Cell>(
+            Cell{.value = std::move(value), .next = head_, .size = size() + 1}));
+    }
+
+    PersistentStack pop(size_t n = 1) const {
+        if (n > size()) {
+            throw std::out_of_range("Cannot pop from an empty PersistentStack");
+        }
+        auto head = head_;
+        for (; n > 0; --n) {
+            head = head->next;
+        }
+        return PersistentStack(std::move(head));
+    }
+
+    // Elements from the bottom to the top
+    std::vector<T> to_vector() const {
+        std::vector<T> result(size());
+        auto it = result.rbegin();
+        for (const auto *cell = head_.get(); cell != nullptr; cell = cell->next.get()) {
+            *it++ = cell->value;
+        }
+        return result;
+    }
+};
+
+} // namespace prexsyn
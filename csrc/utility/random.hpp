@@ -3,24 +3,29 @@
 #include <cstddef>
 #include <cstdint>
 #include <random>
+#include <span>
 #include <stdexcept>
 #include <utility>
 #include <vector>
 
 namespace prexsyn {
 
-template <typename T, typename RNG> const T &random_choice(const std::vector<T> &vec, RNG &rng) {
-    if (vec.empty()) {
+template <typename T, typename RNG> const T &random_choice(std::span<const T> items, RNG &rng) {
+    if (items.empty()) {
         throw std::out_of_range("Cannot choose from an empty vector");
     }
-    std::uniform_int_distribution<size_t> dist(0, vec.size() - 1);
-    return vec[dist(rng)];
+    std::uniform_int_distribution<size_t> dist(0, items.size() - 1);
+    return items[dist(rng)];
+}
+
+template <typename T, typename RNG> const T &random_choice(const std::vector<T> &vec, RNG &rng) {
+    return random_choice(std::span<const T>(vec), rng);
 }
 
 enum class which_vector : std::uint8_t { first, second };
 
 template <typename T, typename RNG>
-std::pair<which_vector, const T &> random_choice(const std::vector<T> &v1, const std::vector<T> &v2,
+std::pair<which_vector, const T &> random_choice(std::span<const T> v1, std::span<const T> v2,
                                                  RNG &rng) {
     if (v1.empty() && v2.empty()) {
         throw std::out_of_range("Cannot choose from two empty vectors");
@@ -36,4 +41,10 @@ std::pair<which_vector, const T &> random_choice(const std::vector<T> &v1, const
     }
 }
 
+template <typename T, typename RNG>
+std::pair<which_vector, const T &> random_choice(const std::vector<T> &v1, const std::vector<T> &v2,
+                                                 RNG &rng) {
+    return random_choice(std::span<const T>(v1), std::span<const T>(v2), rng);
+}
+
 } // namespace prexsyn
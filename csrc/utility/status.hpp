@@ -0,0 +1,43 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <utility>
+
+namespace prexsyn {
+
+// Outcome of an operation that is expected to fail routinely, e.g. a reaction that does not
+// produce anything. Hot paths return it instead of throwing, since unwinding is slow and does not
+// scale across threads. Throwing APIs are thin wrappers over the status-returning ones.
+struct Status {
+    bool is_ok;
+    std::string message;
+
+    static Status ok() { return {.is_ok = true, .message = {}}; }
+    static Status error(const std::string &msg) { return {.is_ok = false, .message = msg}; }
+
+    explicit operator bool() const { return is_ok; }
+};
+
+// Either a value or the error that prevented producing it
+template <typename T> class StatusOr {
+private:
+    std::optional<T> value_;
+    std::string message_;
+
+public:
+    StatusOr(T value) : value_(std::move(value)) {}
+    // status must be an error
+    StatusOr(Status status) : message_(std::move(status.message)) {}
+
+    bool is_ok() const { return value_.has_value(); }
+    explicit operator bool() const { return is_ok(); }
+    const std::string &message() const { return message_; }
+    Status status() const { return is_ok() ? Status::ok() : Status::error(message_); }
+
+    T &value() & { return value_.value(); }
+    const T &value() const & { return value_.value(); }
+    T &&value() && { return std::move(value_).value(); }
+};
+
+} // namespace prexsyn
@@ -1,4 +1,5 @@
 import collections.abc
+import os
 import typing
 from typing import overload
 
@@ -33,17 +34,43 @@ class Reaction:
     @overload
     def apply(self, reactants: collections.abc.Mapping[str, Molecule], ignore_errors: bool = ...) -> list[ReactionOutcome]: ...
     @overload
-    def apply(self, reactants: collections.abc.Sequence[Molecule], ignore_errors: bool = ...) -> list[ReactionOutcomeWithReactantAssignment]: ...
+    def apply(self, reactants: collections.abc.Sequence[Molecule], ignore_errors: bool = ..., main_product_only: bool = ..., max_outcomes: typing.SupportsInt | typing.SupportsIndex | None = ...) -> list[ReactionOutcomeWithReactantAssignment]: ...
     @overload
     @staticmethod
     def from_smarts(smarts: str, reactant_names: collections.abc.Sequence[str]) -> Reaction: ...
     @overload
     @staticmethod
     def from_smarts(arg0: str) -> Reaction: ...
+    def heavy_atom_delta(self) -> int | None: ...
+    def heavy_atom_delta_is_exact(self) -> bool: ...
     def match_reactants(self, arg0: Molecule) -> list: ...
     def num_reactants(self) -> int: ...
     def reactant_names(self) -> list[str]: ...
 
+class ReactionCache:
+    def __init__(self, capacity: typing.SupportsInt | typing.SupportsIndex, num_shards: typing.SupportsInt | typing.SupportsIndex = ..., reactions_fingerprint: typing.SupportsInt | typing.SupportsIndex = ...) -> None: ...
+    def capacity(self) -> int: ...
+    def clear(self) -> None: ...
+    def load(self, path: os.PathLike | str | bytes) -> None: ...
+    def reactions_fingerprint(self) -> int: ...
+    def reset_stats(self) -> None: ...
+    def save(self, path: os.PathLike | str | bytes) -> None: ...
+    def size(self) -> int: ...
+    def stats(self) -> ReactionCacheStats: ...
+
+class ReactionCacheStats:
+    def __init__(self, *args, **kwargs) -> None: ...
+    @property
+    def capacity(self) -> int: ...
+    @property
+    def hit_rate(self) -> float: ...
+    @property
+    def hits(self) -> int: ...
+    @property
+    def misses(self) -> int: ...
+    @property
+    def size(self) -> int: ...
+
 class ReactionError(RuntimeError): ...
 
 class ReactionOutcome:
@@ -62,8 +89,9 @@ class ReactionOutcomeWithReactantAssignment(ReactionOutcome):
 class Synthesis:
     def __init__(self) -> None: ...
     def nodes(self) -> list[SynthesisNode]: ...
+    def num_nodes(self) -> int: ...
     def push_molecule(self, molecule: Molecule) -> None: ...
-    def push_reaction(self, reaction: Reaction, max_outcomes: typing.SupportsInt | typing.SupportsIndex | None) -> None: ...
+    def push_reaction(self, reaction: Reaction, max_outcomes: typing.SupportsInt | typing.SupportsIndex | None, lazy: bool = ..., main_product_only: bool = ..., num_threads: typing.SupportsInt | typing.SupportsIndex = ...) -> None: ...
     def stack_size(self) -> int: ...
     def stack_top(self, i: typing.SupportsInt | typing.SupportsIndex = ...) -> SynthesisNode: ...
     def undo(self) -> None: ...
@@ -73,7 +101,10 @@ class SynthesisError(RuntimeError): ...
 class SynthesisNode:
     def __init__(self, *args, **kwargs) -> None: ...
     def at(self, i: typing.SupportsInt | typing.SupportsIndex) -> Molecule: ...
+    def ensure(self, n: typing.SupportsInt | typing.SupportsIndex) -> bool: ...
     def index(self) -> int: ...
+    def is_fully_evaluated(self) -> bool: ...
+    def num_evaluated(self) -> int: ...
     def precursor_nodes(self) -> list[SynthesisNode]: ...
     def precursors(self, index: typing.SupportsInt | typing.SupportsIndex) -> list[PrecursorMolecule]: ...
     def size(self) -> int: ...
@@ -19,10 +19,16 @@ class BuildingBlockEntry:
     molecule: prexsyn_engine.chemistry.Molecule
     def __init__(self) -> None: ...
 
-class BuildingBlockItem(BuildingBlockEntry):
+class BuildingBlockItem:
     def __init__(self) -> None: ...
     @property
+    def identifier(self) -> str: ...
+    @property
     def index(self) -> int: ...
+    @property
+    def labels(self) -> set[str]: ...
+    @property
+    def molecule(self) -> prexsyn_engine.chemistry.Molecule | None: ...
 
 class BuildingBlockLibrary:
     def __init__(self) -> None: ...
@@ -33,6 +39,8 @@ class BuildingBlockLibrary:
     def get(self, index: typing.SupportsInt | typing.SupportsIndex) -> BuildingBlockItem: ...
     @overload
     def get(self, identifier: str) -> BuildingBlockItem: ...
+    def molecule_cache(self) -> MoleculeCache: ...
+    def pin(self, index: typing.SupportsInt | typing.SupportsIndex) -> None: ...
     def serialize(self, path: os.PathLike | str | bytes) -> None: ...
     def size(self) -> int: ...
     def __getitem__(self, arg0: typing.SupportsInt | typing.SupportsIndex) -> BuildingBlockItem: ...
@@ -51,10 +59,16 @@ class ChemicalSpace:
     def build_reactant_lists_for_intermediates(self) -> None: ...
     def building_block_reactant_lists(self) -> ReactantLists: ...
     @staticmethod
-    def deserialize(path: os.PathLike | str | bytes) -> ChemicalSpace: ...
+    def convert_to_mapped(src: os.PathLike | str | bytes, dst: os.PathLike | str | bytes) -> None: ...
+    @staticmethod
+    def deserialize(path: os.PathLike | str | bytes, verify: bool = ...) -> ChemicalSpace: ...
+    def disable_reaction_cache(self) -> None: ...
+    def enable_reaction_cache(self, capacity: typing.SupportsInt | typing.SupportsIndex, num_shards: typing.SupportsInt | typing.SupportsIndex = ...) -> prexsyn_engine.chemistry.ReactionCache: ...
     def generate_intermediates(self) -> None: ...
     def int_lib(self) -> IntermediateLibrary: ...
     def intermediate_reactant_lists(self) -> ReactantLists: ...
+    @staticmethod
+    def load_mapped(path: os.PathLike | str | bytes) -> ChemicalSpace: ...
     def new_synthesis(self, *args, **kwargs): ...
     @overload
     @staticmethod
@@ -64,7 +78,9 @@ class ChemicalSpace:
     def peek(arg0: os.PathLike | str | bytes) -> ChemicalSpacePeekStats: ...
     def print_reactant_lists(self) -> str: ...
     def reactant_matching_config(self) -> ReactantMatchingConfig: ...
+    def reaction_cache(self) -> prexsyn_engine.chemistry.ReactionCache | None: ...
     def rxn_lib(self) -> ReactionLibrary: ...
+    def save_mapped(self, path: os.PathLike | str | bytes) -> None: ...
     def serialize(self, path: os.PathLike | str | bytes) -> None: ...
 
 class ChemicalSpacePeekStats:
@@ -82,10 +98,16 @@ class IntermediateEntry:
     postfix_notation: PostfixNotation
     def __init__(self) -> None: ...
 
-class IntermediateItem(IntermediateEntry):
+class IntermediateItem:
     def __init__(self) -> None: ...
     @property
+    def identifier(self) -> str: ...
+    @property
     def index(self) -> int: ...
+    @property
+    def molecule(self) -> prexsyn_engine.chemistry.Molecule | None: ...
+    @property
+    def postfix_notation(self) -> PostfixNotation: ...
 
 class IntermediateLibrary:
     def __init__(self) -> None: ...
@@ -97,11 +119,33 @@ class IntermediateLibrary:
     def get(self, index: typing.SupportsInt | typing.SupportsIndex) -> IntermediateItem: ...
     @overload
     def get(self, identifier: str) -> IntermediateItem: ...
+    def molecule_cache(self) -> MoleculeCache: ...
+    def pin(self, index: typing.SupportsInt | typing.SupportsIndex) -> None: ...
     def serialize(self, path: os.PathLike | str | bytes) -> None: ...
     def size(self) -> int: ...
     def __getitem__(self, arg0: typing.SupportsInt | typing.SupportsIndex) -> IntermediateItem: ...
     def __len__(self) -> int: ...
 
+class MoleculeCache:
+    def __init__(self, *args, **kwargs) -> None: ...
+    def capacity(self) -> int: ...
+    def clear(self) -> None: ...
+    def set_capacity(self, capacity: typing.SupportsInt | typing.SupportsIndex) -> None: ...
+    def stats(self) -> MoleculeCacheStats: ...
+
+class MoleculeCacheStats:
+    def __init__(self, *args, **kwargs) -> None: ...
+    @property
+    def capacity(self) -> int: ...
+    @property
+    def hits(self) -> int: ...
+    @property
+    def misses(self) -> int: ...
+    @property
+    def pinned(self) -> int: ...
+    @property
+    def size(self) -> int: ...
+
 class PostfixNotation:
     def __init__(self) -> None: ...
     def append(self, index: typing.SupportsInt | typing.SupportsIndex, type: PostfixNotationTokenType) -> None: ...
@@ -133,8 +177,14 @@ class PostfixNotationTokenType(enum.Enum):
 class ReactantLists:
     def __init__(self) -> None: ...
     def get(self, reaction_index: typing.SupportsInt | typing.SupportsIndex, reactant_index: typing.SupportsInt | typing.SupportsIndex) -> list[int]: ...
+    def get_within(self, reaction_index: typing.SupportsInt | typing.SupportsIndex, reactant_index: typing.SupportsInt | typing.SupportsIndex, max_heavy_atoms: typing.SupportsInt | typing.SupportsIndex) -> list[int]: ...
     def num_matches(self) -> int: ...
+    @overload
     def set(self, reaction_index: typing.SupportsInt | typing.SupportsIndex, reactant_index: typing.SupportsInt | typing.SupportsIndex, building_block_indices: collections.abc.Sequence[typing.SupportsInt | typing.SupportsIndex]) -> None: ...
+    @overload
+    def set(self, reaction_index: typing.SupportsInt | typing.SupportsIndex, reactant_index: typing.SupportsInt | typing.SupportsIndex, building_block_indices: collections.abc.Sequence[typing.SupportsInt | typing.SupportsIndex], library: BuildingBlockLibrary) -> None: ...
+    @overload
+    def set(self, reaction_index: typing.SupportsInt | typing.SupportsIndex, reactant_index: typing.SupportsInt | typing.SupportsIndex, building_block_indices: collections.abc.Sequence[typing.SupportsInt | typing.SupportsIndex], library: IntermediateLibrary) -> None: ...
 
 class ReactantMatchingConfig:
     selectivity_cutoff: int
@@ -163,11 +213,13 @@ class ReactionLibrary:
     def add(self, entry: ReactionEntry) -> int: ...
     @staticmethod
     def deserialize(path: os.PathLike | str | bytes) -> ReactionLibrary: ...
+    def fingerprint(self) -> int: ...
     @overload
     def get(self, index: typing.SupportsInt | typing.SupportsIndex) -> ReactionItem: ...
     @overload
     def get(self, name: str) -> ReactionItem: ...
-    def match_reactants(self, molecule: prexsyn_engine.chemistry.Molecule) -> list[ReactionMatch]: ...
+    def match_reactants(self, molecule: prexsyn_engine.chemistry.Molecule, max_count: typing.SupportsInt | typing.SupportsIndex | None = ...) -> list[ReactionMatch]: ...
+    def num_reactant_templates(self) -> int: ...
     def serialize(self, path: os.PathLike | str | bytes) -> None: ...
     def size(self) -> int: ...
     def __getitem__(self, arg0: typing.SupportsInt | typing.SupportsIndex) -> ReactionItem: ...
@@ -206,9 +258,19 @@ class Synthesis:
     def count_reactions(self) -> int: ...
     @staticmethod
     def deserialize(data: bytes, chemspace: ChemicalSpace) -> Synthesis: ...
+    def lazy_evaluation(self) -> bool: ...
+    def main_product_only(self) -> bool: ...
+    def max_heavy_atoms(self) -> int | None: ...
+    def max_outcomes_per_call(self) -> int | None: ...
+    def num_threads(self) -> int: ...
     def postfix_notation(self) -> PostfixNotation: ...
-    def products(self) -> list[prexsyn_engine.chemistry.Molecule]: ...
+    def products(self, limit: typing.SupportsInt | typing.SupportsIndex | None = ...) -> list[prexsyn_engine.chemistry.Molecule]: ...
     def serialize(self) -> bytes: ...
+    def set_lazy_evaluation(self, lazy: bool) -> None: ...
+    def set_main_product_only(self, main_product_only: bool) -> None: ...
+    def set_max_heavy_atoms(self, limit: typing.SupportsInt | typing.SupportsIndex | None) -> None: ...
+    def set_max_outcomes_per_call(self, limit: typing.SupportsInt | typing.SupportsIndex | None) -> None: ...
+    def set_num_threads(self, num_threads: typing.SupportsInt | typing.SupportsIndex) -> None: ...
     def synthesis(self) -> prexsyn_engine.chemistry.Synthesis: ...
     def undo(self) -> SynthesisResult: ...
 
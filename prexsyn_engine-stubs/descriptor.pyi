@@ -8,9 +8,10 @@ from typing import overload
 class MorganFingerprint(_MoleculeDescriptor):
     def __init__(self, *args, **kwargs) -> None: ...
     @staticmethod
-    def ecfp4() -> MorganFingerprint: ...
+    def ecfp4(incremental: bool = ...) -> MorganFingerprint: ...
     @staticmethod
-    def fcfp4() -> MorganFingerprint: ...
+    def fcfp4(incremental: bool = ...) -> MorganFingerprint: ...
+    def incremental(self) -> bool: ...
 
 class SynthesisPostfixNotation(_SynthesisDescriptor):
     def __init__(self, *args, **kwargs) -> None: ...
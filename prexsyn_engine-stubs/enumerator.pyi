@@ -4,7 +4,10 @@ import typing
 
 class EnumeratorConfig:
     heavy_atom_limit: int
+    lazy_evaluation: bool
+    main_product_only: bool
     max_building_blocks: int
+    max_outcomes_per_call: int | None
     max_outcomes_per_reaction: int
     selectivity_cutoff: int
     def __init__(self) -> None: ...
@@ -0,0 +1,47 @@
+"""Writes a chemical space test fixture with the installed build of prexsyn_engine.
+
+Run it once with the build of each older serialization version, e.g.
+
+    python scripts/make_chemspace_fixture.py --version 3
+
+to add resources/test/chemspace_versions/small_1_v3.bin, which the chemical space tests load and
+compare against a chemical space built by the current code from the same inputs.
+"""
+
+from pathlib import Path
+
+import click
+
+import prexsyn_engine
+
+_root = Path(__file__).resolve().parents[1]
+_inputs = _root / "resources" / "test" / "chemspace_small_1"
+_fixtures = _root / "resources" / "test" / "chemspace_versions"
+
+
+@click.command()
+@click.option(
+    "--version",
+    type=int,
+    required=True,
+    help="Serialization version of the installed build, used in the file name",
+)
+def main(version):
+    bb_lib = prexsyn_engine.chemspace.bb_lib_from_sdf(str(_inputs / "bb.sdf"))
+    rxn_lib = prexsyn_engine.chemspace.rxn_lib_from_plain_text(str(_inputs / "rxn.txt"))
+    int_lib = prexsyn_engine.chemspace.IntermediateLibrary()
+
+    cs = prexsyn_engine.chemspace.ChemicalSpace(
+        bb_lib=bb_lib, rxn_lib=rxn_lib, int_lib=int_lib
+    )
+    cs.build_reactant_lists_for_building_blocks()
+    cs.generate_intermediates()
+    cs.build_reactant_lists_for_intermediates()
+
+    output_path = _fixtures / f"small_1_v{version}.bin"
+    cs.serialize(str(output_path))
+    print(f"Wrote {output_path}")
+
+
+if __name__ == "__main__":
+    main()
@@ -154,3 +154,16 @@ def test_apply_list_can_return_multiple_outcomes_from_assignments():
     assert len(outcomes) > 1
     assert ["A", "B"] in [outcome.reactant_names for outcome in outcomes]
     assert ["B", "A"] in [outcome.reactant_names for outcome in outcomes]
+
+
+def test_apply_list_main_product_only_drops_by_products():
+    # Ester hydrolysis releases the alcohol as a by-product
+    rxn = Reaction.from_smarts("[C:1](=[O:2])[O][C:3]>>[C:1](=[O:2])O.[C:3]O", ["A"])
+    reactants = [Molecule.from_smiles("CCCCC(=O)OC")]
+
+    full = rxn.apply(reactants)
+    main_only = rxn.apply(reactants, main_product_only=True)
+
+    assert [outcome.num_products() for outcome in full] == [2]
+    assert [outcome.num_products() for outcome in main_only] == [1]
+    assert main_only[0].main_product().smiles() == full[0].main_product().smiles()
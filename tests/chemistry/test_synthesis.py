@@ -69,6 +69,16 @@ def test_push_reaction_raises_when_stack_has_too_few_reactants():
         synthesis.push_reaction(make_test_reaction(), None)
 
 
+def test_push_reaction_with_zero_max_outcomes_keeps_first_product():
+    synthesis = Synthesis()
+    synthesis.push_molecule(make_reactant_a())
+    synthesis.push_molecule(make_reactant_b())
+    synthesis.push_reaction(make_test_reaction(), 0)
+
+    assert synthesis.stack_top().size() == 1
+    assert synthesis.stack_top().at(0).smiles() == EXPECTED_PRODUCT_SMILES
+
+
 def test_push_reaction_raises_when_no_products_are_produced():
     synthesis = Synthesis()
     synthesis.push_molecule(make_non_matching_reactant())
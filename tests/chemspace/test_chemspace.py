@@ -1,3 +1,5 @@
+import gc
+import gzip
 import tempfile
 import pickle
 from pathlib import Path
@@ -81,6 +83,61 @@ def test_building_block_library_add_get_and_serde_roundtrip():
     assert cloned.get(0).identifier == "bb1"
 
 
+def test_deserialized_library_molecules_go_through_the_cache(tmp_path: Path):
+    bb_lib = chemspace.bb_lib_from_sdf(resource_path("bb.sdf"))
+    path = tmp_path / "bb.bin"
+    bb_lib.serialize(path)
+    loaded = chemspace.BuildingBlockLibrary.deserialize(path)
+
+    cache = loaded.molecule_cache()
+    assert cache.stats().size == 0
+    cache.set_capacity(2)
+    for i in range(loaded.size()):
+        assert loaded.get(i).molecule.smiles() == bb_lib.get(i).molecule.smiles()
+    stats = cache.stats()
+    assert stats.misses >= loaded.size()
+    assert stats.size <= stats.capacity
+
+    # Pinned molecules stay when the cache is cleared
+    loaded.pin(0)
+    cache.clear()
+    assert cache.stats().pinned == 1
+    assert cache.stats().size == 1
+    hits = cache.stats().hits
+    assert loaded.get(0).molecule.smiles() == bb_lib.get(0).molecule.smiles()
+    assert cache.stats().hits == hits + 1
+
+
+def test_library_items_are_read_only():
+    bb_lib = chemspace.bb_lib_from_sdf(resource_path("bb.sdf"))
+    rxn_lib = chemspace.rxn_lib_from_plain_text(resource_path("rxn.txt"))
+    cs = chemspace.ChemicalSpace(bb_lib, rxn_lib, chemspace.IntermediateLibrary())
+    cs.build_reactant_lists_for_building_blocks()
+    cs.generate_intermediates()
+    assert cs.int_lib().size() > 0
+
+    bb_item = cs.bb_lib().get(0)
+    for name, value in [
+        ("molecule", Molecule.from_smiles("CC")),
+        ("identifier", "changed"),
+        ("labels", set()),
+        ("index", 1),
+    ]:
+        with pytest.raises(AttributeError):
+            setattr(bb_item, name, value)
+
+    int_item = cs.int_lib().get(0)
+    for name, value in [
+        ("molecule", Molecule.from_smiles("CC")),
+        ("identifier", "changed"),
+        ("postfix_notation", chemspace.PostfixNotation()),
+        ("index", 1),
+    ]:
+        with pytest.raises(AttributeError):
+            setattr(int_item, name, value)
+    assert cs.int_lib().get(0).identifier == int_item.identifier
+
+
 def test_building_block_library_duplicate_identifier_raises_specific_error():
     bb_lib = chemspace.BuildingBlockLibrary()
 
@@ -127,6 +184,31 @@ def test_factory_loaders_from_test_resources():
     assert rxn_lib.get("ReactionA").name == "ReactionA"
 
 
+def test_bb_lib_loaders_accept_gzip_and_keep_order(tmp_path: Path):
+    def entries_of(lib: chemspace.BuildingBlockLibrary) -> list[tuple[str, str]]:
+        return [(lib[i].identifier, lib[i].molecule.smiles()) for i in range(len(lib))]
+
+    entries = entries_of(chemspace.bb_lib_from_sdf(resource_path("bb.sdf")))
+
+    sdf_gz = tmp_path / "bb.sdf.gz"
+    sdf_gz.write_bytes(gzip.compress(resource_path("bb.sdf").read_bytes()))
+    try:
+        from_sdf = chemspace.bb_lib_from_sdf(sdf_gz)
+    except RuntimeError as e:
+        if "without gzip support" in str(e):
+            pytest.skip("built without gzip support")
+        raise
+    assert entries_of(from_sdf) == entries
+
+    rows = ["id,smiles"] + [f"dup,{smiles}" for _, smiles in entries] + ["bad,not_a_smiles"]
+    csv_gz = tmp_path / "bb.csv.gz"
+    csv_gz.write_bytes(gzip.compress("\n".join(rows).encode()))
+    from_csv = chemspace.bb_lib_from_csv(csv_gz)
+    assert entries_of(from_csv) == [
+        ("dup" if i == 0 else f"dup-{i}", smiles) for i, (_, smiles) in enumerate(entries)
+    ]
+
+
 def test_chemical_space_end_to_end_and_serde():
     bb_lib = chemspace.bb_lib_from_sdf(resource_path("bb.sdf"))
     rxn_lib = chemspace.rxn_lib_from_plain_text(resource_path("rxn.txt"))
@@ -157,6 +239,54 @@ def test_chemical_space_end_to_end_and_serde():
         assert cloned.rxn_lib().size() == cs.rxn_lib().size()
         assert cloned.int_lib().size() == cs.int_lib().size()
 
+        verified = chemspace.ChemicalSpace.deserialize(tmp.name, verify=True)
+        assert verified.bb_lib().size() == cs.bb_lib().size()
+        assert verified.bb_lib().get(0).molecule.smiles() == cs.bb_lib().get(0).molecule.smiles()
+
+
+def test_reactant_lists_set_keeps_sorted_lists_sorted():
+    bb_lib = chemspace.bb_lib_from_sdf(resource_path("bb.sdf"))
+    rxn_lib = chemspace.rxn_lib_from_plain_text(resource_path("rxn.txt"))
+    cs = chemspace.ChemicalSpace(bb_lib, rxn_lib, chemspace.IntermediateLibrary())
+    cs.build_reactant_lists_for_building_blocks()
+    lists = cs.building_block_reactant_lists()
+
+    with pytest.raises(RuntimeError):
+        lists.set(0, 0, [3, 0, 2])
+
+    lists.set(0, 0, [3, 0, 2], cs.bb_lib())
+    entries = lists.get(0, 0)
+    assert sorted(entries) == [0, 2, 3]
+    heavy_atoms = [cs.bb_lib().get(i).molecule.num_heavy_atoms() for i in entries]
+    assert heavy_atoms == sorted(heavy_atoms)
+    assert lists.get_within(0, 0, heavy_atoms[0] - 1) == []
+
+
+def test_chemical_space_mapped_format(tmp_path: Path):
+    bb_lib = chemspace.bb_lib_from_sdf(resource_path("bb.sdf"))
+    rxn_lib = chemspace.rxn_lib_from_plain_text(resource_path("rxn.txt"))
+    cs = chemspace.ChemicalSpace(bb_lib, rxn_lib, chemspace.IntermediateLibrary())
+    cs.build_reactant_lists_for_building_blocks()
+    cs.generate_intermediates()
+    cs.build_reactant_lists_for_intermediates()
+
+    serialized = tmp_path / "chemspace.bin"
+    cs.serialize(serialized)
+    mapped = tmp_path / "chemspace.map"
+    chemspace.ChemicalSpace.convert_to_mapped(serialized, mapped)
+
+    stats = chemspace.ChemicalSpace.peek(mapped)
+    assert stats.num_building_blocks == cs.bb_lib().size()
+    assert stats.num_intermediates == cs.int_lib().size()
+
+    loaded = chemspace.ChemicalSpace.load_mapped(mapped)
+    assert loaded.bb_lib().size() == cs.bb_lib().size()
+    assert loaded.int_lib().get(0).identifier == cs.int_lib().get(0).identifier
+    assert (
+        loaded.building_block_reactant_lists().num_matches()
+        == cs.building_block_reactant_lists().num_matches()
+    )
+
 
 def test_chemspace_synthesis_add_and_undo():
     bb_lib = chemspace.bb_lib_from_sdf(resource_path("bb.sdf"))
@@ -224,3 +354,106 @@ def test_chemspace_synthesis_serialize_deserialize_roundtrip():
     assert restored.count_reactions() == syn.count_reactions()
     assert len(restored.products()) == len(syn.products())
     assert restored.products()[0].smiles() == syn.products()[0].smiles()
+
+
+def test_chemspace_synthesis_roundtrip_keeps_settings():
+    bb_lib = chemspace.bb_lib_from_sdf(resource_path("bb.sdf"))
+    rxn_lib = chemspace.rxn_lib_from_plain_text(resource_path("rxn.txt"))
+    cs = chemspace.ChemicalSpace(bb_lib, rxn_lib, chemspace.IntermediateLibrary())
+
+    syn = cs.new_synthesis()
+    syn.set_main_product_only(True)
+    syn.set_max_heavy_atoms(100)
+    assert syn.add_building_block("EN300-250786").is_ok
+    assert syn.add_building_block("EN300-101318").is_ok
+    assert syn.add_reaction("ReactionA", None).is_ok
+    # Only later reactions see the new settings
+    syn.set_lazy_evaluation(True)
+    syn.set_max_outcomes_per_call(4)
+
+    restored = chemspace.Synthesis.deserialize(syn.serialize(), cs)
+
+    assert restored.main_product_only()
+    assert restored.max_heavy_atoms() == 100
+    assert restored.lazy_evaluation()
+    assert restored.max_outcomes_per_call() == 4
+    assert [p.smiles() for p in restored.products()] == [
+        p.smiles() for p in syn.products()
+    ]
+
+
+def test_chemspace_synthesis_uses_reaction_cache():
+    bb_lib = chemspace.bb_lib_from_sdf(resource_path("bb.sdf"))
+    rxn_lib = chemspace.rxn_lib_from_plain_text(resource_path("rxn.txt"))
+    int_lib = chemspace.IntermediateLibrary()
+    cs = chemspace.ChemicalSpace(bb_lib, rxn_lib, int_lib)
+    assert cs.reaction_cache() is None
+
+    cache = cs.enable_reaction_cache(1024)
+    products = []
+    for _ in range(2):
+        syn = cs.new_synthesis()
+        assert syn.add_building_block("EN300-250786").is_ok
+        assert syn.add_building_block("EN300-101318").is_ok
+        assert syn.add_reaction("ReactionA", None).is_ok
+        products.append([p.smiles() for p in syn.products()])
+
+    assert products[0] == products[1]
+    stats = cache.stats()
+    assert stats.hits > 0
+    assert stats.hit_rate > 0.0
+
+    with tempfile.NamedTemporaryFile() as tmp:
+        cache.save(tmp.name)
+        restored = chemistry.ReactionCache(
+            1024, reactions_fingerprint=cs.rxn_lib().fingerprint()
+        )
+        restored.load(tmp.name)
+        # Keys refer to the reactions of the library the cache was saved with
+        with pytest.raises(RuntimeError, match="other reactions"):
+            chemistry.ReactionCache(1024).load(tmp.name)
+    assert cache.reactions_fingerprint() == cs.rxn_lib().fingerprint()
+    assert restored.size() == cache.size()
+
+
+def test_chemspace_synthesis_survives_disabling_reaction_cache():
+    bb_lib = chemspace.bb_lib_from_sdf(resource_path("bb.sdf"))
+    rxn_lib = chemspace.rxn_lib_from_plain_text(resource_path("rxn.txt"))
+    int_lib = chemspace.IntermediateLibrary()
+    cs = chemspace.ChemicalSpace(bb_lib, rxn_lib, int_lib)
+
+    cs.enable_reaction_cache(1024)
+    syn = cs.new_synthesis()
+    syn.set_lazy_evaluation(True)
+    assert syn.add_building_block("EN300-250786").is_ok
+    assert syn.add_building_block("EN300-101318").is_ok
+    assert syn.add_reaction("ReactionA", None).is_ok
+
+    # The pending node still holds the cache it was pushed with
+    cs.disable_reaction_cache()
+    assert cs.reaction_cache() is None
+    assert len(syn.products()) > 0
+
+
+def test_chemspace_synthesis_nodes_outlive_dropped_space():
+    bb_lib = chemspace.bb_lib_from_sdf(resource_path("bb.sdf"))
+    rxn_lib = chemspace.rxn_lib_from_plain_text(resource_path("rxn.txt"))
+    cs = chemspace.ChemicalSpace(bb_lib, rxn_lib, chemspace.IntermediateLibrary())
+
+    syn = cs.new_synthesis()
+    assert syn.add_building_block("EN300-250786").is_ok
+    assert syn.add_building_block("EN300-101318").is_ok
+    assert syn.add_reaction("ReactionA", None).is_ok
+    expected = [p.smiles() for p in syn.products()]
+
+    top = syn.synthesis().stack_top()
+    nodes = syn.synthesis().nodes()
+    precursors = top.precursors(0)
+    del cs, bb_lib, rxn_lib, syn
+    gc.collect()
+
+    # Borrowed molecules are copied out, and the nodes keep the space alive
+    assert top.at(0).smiles() == expected[0]
+    assert nodes[0].at(0).smiles() != ""
+    assert all(p.molecule.smiles() != "" for p in precursors)
+    assert precursors[0].precursor_node.at(0).smiles() != ""
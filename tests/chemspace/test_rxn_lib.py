@@ -114,3 +114,41 @@ def test_rxn_lib_from_json_skips_invalid_entries_when_ignore_errors_true(
     assert rxn_lib.get("Valid").name == "Valid"
     with pytest.raises(Exception):
         rxn_lib.get("Broken")
+
+
+def test_rxn_lib_shares_identical_reactant_templates(tmp_path: Path):
+    path = tmp_path / "shared_templates.json"
+    path.write_text(
+        json.dumps(
+            [
+                {
+                    "name": "Methylation",
+                    "reactants": {"A": "[C:1]-[Br]"},
+                    "product": "[C:1]-[C]",
+                },
+                {
+                    "name": "Amination",
+                    "reactants": {"B": "[C:2]-[Br]", "C": "[NH2:3]"},
+                    "product": "[C:2]-[N:3]",
+                },
+            ]
+        ),
+        encoding="utf-8",
+    )
+    rxn_lib = chemspace.rxn_lib_from_json(path)
+
+    # The alkyl bromide templates only differ in atom map numbers
+    assert rxn_lib.num_reactant_templates() == 2
+
+    mol = chemistry.Molecule.from_smiles("BrCCCBr")
+    matches = rxn_lib.match_reactants(mol)
+    assert [(m.reaction_name, m.reactant_name, m.count) for m in matches] == [
+        ("Methylation", "A", 2),
+        ("Amination", "B", 2),
+    ]
+
+    capped = rxn_lib.match_reactants(mol, max_count=1)
+    assert [(m.reaction_name, m.reactant_name, m.count) for m in capped] == [
+        ("Methylation", "A", 1),
+        ("Amination", "B", 1),
+    ]
@@ -67,3 +67,16 @@ def test_fcfp4_matches_reference_bits_from_csv():
     for smiles, _, fcfp4_indices in rows:
         result = fp(Molecule.from_smiles(smiles))
         assert _nonzero_indices(result) == fcfp4_indices
+
+
+def test_incremental_fingerprints_match_reference_bits_from_csv():
+    rows = _load_reference_rows()
+    assert rows
+
+    ecfp4 = descriptor.MorganFingerprint.ecfp4(incremental=True)
+    fcfp4 = descriptor.MorganFingerprint.fcfp4(incremental=True)
+    assert ecfp4.incremental()
+    for smiles, ecfp4_indices, fcfp4_indices in rows:
+        mol = Molecule.from_smiles(smiles)
+        assert _nonzero_indices(ecfp4(mol)) == ecfp4_indices
+        assert _nonzero_indices(fcfp4(mol)) == fcfp4_indices
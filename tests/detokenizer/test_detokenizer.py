@@ -1,3 +1,4 @@
+import gc
 from pathlib import Path
 
 import numpy as np
@@ -195,3 +196,20 @@ def test_tokenize_then_multithreaded_detokenize_round_trip_is_consistent():
             input_tokens, token_def
         )
         assert len(syn.products()) > 0
+
+
+def test_detokenized_syntheses_outlive_dropped_space():
+    cs = make_chemical_space()
+    token_def = descriptor.TokenDef()
+    tokens = make_valid_tokens(cs, token_def)
+
+    syn = detokenizer.detokenize(tokens, cs, token_def)
+    mt_detok = detokenizer.MultiThreadedDetokenizer(cs, token_def)
+    batch = mt_detok(np.stack([tokens, tokens], axis=0))
+    expected = [p.smiles() for p in syn.products()]
+    del cs, mt_detok
+    gc.collect()
+
+    assert [p.smiles() for p in syn.products()] == expected
+    for item in batch:
+        assert [p.smiles() for p in item.products()] == expected
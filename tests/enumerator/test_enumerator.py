@@ -232,6 +232,20 @@ class TestRandomEnumerator:
             assert syn.count_building_blocks() >= 1
             assert len(syn.products()) >= 1
 
+    def test_returned_syntheses_are_not_changed_by_later_calls(self):
+        """Test that syntheses returned by next() are independent snapshots."""
+        cs = make_chemical_space()
+        enumerator_obj = enumerator.RandomEnumerator(cs, random_seed=444)
+
+        syntheses = [enumerator_obj.next() for _ in range(10)]
+        before = [(len(s.postfix_notation().tokens()), s.products()[0].smiles()) for s in syntheses]
+
+        for _ in range(10):
+            enumerator_obj.next()
+
+        after = [(len(s.postfix_notation().tokens()), s.products()[0].smiles()) for s in syntheses]
+        assert before == after
+
     def test_next_after_next_with_product(self):
         """Test that next() works after next_with_product()."""
         cs = make_chemical_space()